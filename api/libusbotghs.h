@@ -128,6 +128,120 @@ typedef enum {
     USBOTG_HS_EP_DIR_BOTH,
 } usbotghs_ep_dir_t;
 
+/*
+ * OUT EP completion policy: when the upper layer handler is called for
+ * a data OUT transfer (EP0 always completes on short packet or full RAM FIFO)
+ * - SHORT_PKT: on a short (or zero-length) packet, or when the RAM FIFO is full
+ * - FULL_BUFFER: only when the RAM FIFO is full, short packets are appended
+ *   (as SHORT_PKT in DMA mode, the core DMA not resuming after a short packet)
+ * - EVERY_PKT: after each received packet, the transfer being one packet long
+ */
+typedef enum {
+    USBOTG_HS_EP_COMPLETE_SHORT_PKT   = 0,
+    USBOTG_HS_EP_COMPLETE_FULL_BUFFER = 1,
+    USBOTG_HS_EP_COMPLETE_EVERY_PKT   = 2,
+} usbotghs_ep_completion_t;
+
+/*
+ * Transmission segment, used for vectored (scatter-gather) transmissions.
+ * See usbotghs_send_datav().
+ */
+typedef struct {
+    const uint8_t *base;    /* segment content */
+    uint32_t       len;     /* segment length, in bytes */
+} usbotghs_iovec_t;
+
+/*
+ * RXFLVL handler statistics: how many RxFIFO status entries each handler
+ * execution drained. See usbotghs_get_rxflvl_stats().
+ */
+#define USBOTGHS_RXFLVL_STATS_BUCKETS 8
+
+typedef struct {
+    uint32_t irqs;          /* RXFLVL handler executions */
+    uint32_t entries;       /* RxFIFO status entries handled */
+    uint32_t budget_hits;   /* executions stopped by the budget with entries left */
+    uint32_t drained[USBOTGHS_RXFLVL_STATS_BUCKETS]; /* executions per drained entries (1, 2, ..., 8 or more) */
+} usbotghs_rxflvl_stats_t;
+
+/*
+ * OUT EP receive error counters. Packets which can't be received are dropped one
+ * by one from the shared RxFIFO, without disturbing the other EPs.
+ * See usbotghs_get_ep_err_stats().
+ */
+typedef struct {
+    uint32_t discarded_pkts;  /* packets dropped from the RxFIFO */
+    uint32_t discarded_bytes; /* bytes dropped from the RxFIFO */
+    uint32_t not_configured;  /* packets received while the EP is not configured */
+    uint32_t rejected;        /* data packets not receivable (STUP pending, no room in the RAM FIFO) */
+    uint32_t bad_setup;       /* invalid SETUP packets (not on EP0, bad size) */
+} usbotghs_ep_err_stats_t;
+
+/*
+ * Core DMA thresholding (DTHRCTL), DMA mode only. With thresholding, the core
+ * starts moving a packet between its FIFOs and the memory (OUT) or the bus (IN)
+ * as soon as the threshold amount of it is available, instead of the whole
+ * packet. Lengths are in 32bits words, from 8 to 511.
+ * See usbotghs_set_dma_thresholds().
+ */
+typedef struct {
+    uint16_t rx_thr_len;     /* RxFIFO threshold length (RXTHRLEN) */
+    uint16_t tx_thr_len;     /* IN EPs TxFIFO threshold length (TXTHRLEN) */
+    bool     rx_thr;         /* RxFIFO thresholding (RXTHREN) */
+    bool     noniso_thr;     /* non-isochronous IN EPs thresholding (NONISOTHREN) */
+    bool     iso_thr;        /* isochronous IN EPs thresholding (ISOTHREN) */
+    bool     arb_parking;    /* arbiter parking, against RxFIFO overrun and TxFIFO underrun (ARPEN) */
+} usbotghs_dma_thr_cfg_t;
+
+#define USBOTGHS_DMA_THR_LEN_MIN 8
+#define USBOTGHS_DMA_THR_LEN_MAX 511
+
+/*
+ * DMA endpoint buffers pool usage, see usbotghs_get_dma_pool_stats()
+ */
+typedef struct {
+    uint32_t block_size;      /* size of each pool buffer, in bytes */
+    uint16_t blocks;          /* number of pool buffers */
+    uint16_t in_use;          /* currently allocated buffers */
+    uint16_t high_water;      /* max simultaneously allocated buffers */
+    uint32_t alloc_failures;  /* allocations refused, the pool being empty */
+    uint32_t rejected_bufs;   /* transfers refused, their buffer not being usable by the core DMA */
+    uint32_t rejected_sizes;  /* transfers refused, their size not being handled by the core DMA */
+} usbotghs_dma_pool_stats_t;
+
+/*
+ * Build-time helpers for usbotghs_send_words() payloads.
+ *
+ * USBOTGHS_LE32() packs four bytes into a little-endian Core FIFO word.
+ * USBOTGHS_WORD_IMAGE() declares a word-aligned image of the given bytes,
+ * both readable as bytes (.bytes) and as Core FIFO words (.words), e.g.:
+ *
+ *   static USBOTGHS_WORD_IMAGE(dev_desc, 0x12, 0x01, 0x00, 0x02, ...);
+ *   usbotghs_send_words(dev_desc.words, USBOTGHS_WORD_IMAGE_SIZE(dev_desc), 0);
+ *
+ * The Core FIFO is little-endian, as the Cortex-M core: the image words are
+ * the packed bytes, no per-byte work is done at send time.
+ */
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__)
+# error "word images require a little-endian target"
+#endif
+
+#define USBOTGHS_LE32(b0, b1, b2, b3) \
+    ((uint32_t)(uint8_t)(b0)         | ((uint32_t)(uint8_t)(b1) << 8) | \
+    ((uint32_t)(uint8_t)(b2) << 16) | ((uint32_t)(uint8_t)(b3) << 24))
+
+/* number of Core FIFO words needed to hold size bytes */
+#define USBOTGHS_WORDS_LEN(size) (((size) + 3) / 4)
+
+#define USBOTGHS_WORD_IMAGE(name, ...) \
+    const union { \
+        uint8_t  bytes[sizeof((const uint8_t[]){ __VA_ARGS__ })]; \
+        uint32_t words[USBOTGHS_WORDS_LEN(sizeof((const uint8_t[]){ __VA_ARGS__ }))]; \
+    } name = { .bytes = { __VA_ARGS__ } }
+
+/* image payload size, in bytes */
+#define USBOTGHS_WORD_IMAGE_SIZE(name) (sizeof((name).bytes))
+
 /*********************************************************************************
  * About handlers
  *
@@ -223,13 +337,24 @@ mbed_error_t usbotghs_configure(usbotghs_dev_mode_t mode,
  * layer that the content has been sent. Although, it is possible to push some
  * other data in the internal FIFO if needed, while this FIFO is not full
  * (check for this function return value)
+ * On data (non-control) EPs, a transfer requested while the previous one is not
+ * yet complete is queued, and started by the driver as soon as the previous one
+ * is complete. Upto CONFIG_USR_DEV_USBOTGHS_XMIT_QUEUE_DEPTH transfers can be
+ * queued per EP. The upper layer is informed of each transfer completion. A
+ * queued transfer which can't be started when its turn comes (e.g. the bus is
+ * suspended) is dropped, and completed with a size of 0.
+ * In DMA mode, the core DMA reads src directly during the transfer: it must be
+ * word-aligned and out of the CCM RAM (see usbotghs_dma_buf_alloc()), except
+ * for small control and interrupt transfers, which are copied through the EP
+ * bounce buffer (see usbotghs_set_dma_bounce_threshold()).
  *
  * @src the RAM FIFO from which the data are read
  * @size the amount of data bytes to send
  * @ep the endpoint on which the data are to be sent
  *
  * @return MBED_ERROR_NONE if data has been correctly transmitted into the internal
- * core FIFO, or MBED_ERROR_BUSY if the interal core FIFO for the given EP is full
+ * core FIFO (or queued), or MBED_ERROR_BUSY if the interal core FIFO for the given
+ * EP is full (or the EP transfers queue is full)
  */
 /*@
     @ requires \separated(src + (0 .. size-1),GHOST_in_eps+(0 .. USBOTGHS_MAX_IN_EP - 1));
@@ -264,6 +389,52 @@ mbed_error_t usbotghs_configure(usbotghs_dev_mode_t mode,
 
 mbed_error_t usbotghs_send_data(uint8_t *src, uint32_t size, uint8_t ep_id);
 
+/*
+ * Vectored (scatter-gather) variant of usbotghs_send_data().
+ * The @iovcnt segments of @iov are sent, in order, as a single USB transfer,
+ * without having to be copied into a contiguous buffer first. Both the
+ * segments array and the segments content are read during the whole transfer
+ * and must stay untouched until the upper layer is informed of its completion.
+ *
+ * @iov the segments to send
+ * @iovcnt the number of segments in iov
+ * @ep the endpoint on which the data are to be sent
+ *
+ * @return MBED_ERROR_NONE if the transfer has been started, MBED_ERROR_INVPARAM if
+ * iov is invalid or its total size is null, or the same errors as
+ * usbotghs_send_data()
+ */
+/*@
+    @ assigns GHOST_in_eps[ep_id].state;
+    @ assigns \result \from indirect:ep_id, indirect:iov, indirect:iovcnt;
+    @ ensures ep_id >= USBOTGHS_MAX_IN_EP ==> \result == MBED_ERROR_INVPARAM;
+    @ ensures (iov == \null || iovcnt == 0) ==> \result == MBED_ERROR_INVPARAM;
+    @ ensures \result == MBED_ERROR_INVPARAM || \result == MBED_ERROR_BUSY || \result == MBED_ERROR_INVSTATE || \result == MBED_ERROR_NONE ;
+*/
+mbed_error_t usbotghs_send_datav(const usbotghs_iovec_t *iov, uint8_t iovcnt, uint8_t ep_id);
+
+/*
+ * Word-packed variant of usbotghs_send_data(), for constant payloads (e.g.
+ * descriptors) pre-packed at build time (see USBOTGHS_WORD_IMAGE()).
+ * The words are written as is into the Core FIFO, without byte reassembly.
+ * The last word may be partially used, its unused bytes are not sent.
+ *
+ * @src the payload, as USBOTGHS_WORDS_LEN(size) little-endian words
+ * @size the amount of data bytes to send
+ * @ep the endpoint on which the data are to be sent
+ *
+ * @return the same errors as usbotghs_send_data()
+ */
+/*@
+    @ requires \separated(src + (0 .. USBOTGHS_WORDS_LEN(size)-1),GHOST_in_eps+(0 .. USBOTGHS_MAX_IN_EP - 1));
+    @ assigns GHOST_in_eps[ep_id].state;
+    @ assigns \result \from indirect:ep_id, indirect:src, indirect:size;
+    @ ensures ep_id >= USBOTGHS_MAX_IN_EP ==> \result == MBED_ERROR_INVPARAM;
+    @ ensures (src == \null || size == 0) ==> \result == MBED_ERROR_INVPARAM;
+    @ ensures \result == MBED_ERROR_INVPARAM || \result == MBED_ERROR_BUSY || \result == MBED_ERROR_INVSTATE || \result == MBED_ERROR_NONE ;
+*/
+mbed_error_t usbotghs_send_words(const uint32_t *src, uint32_t size, uint8_t ep_id);
+
 /*
  * Configure for receiving data. Receiving data is a triggering event, not a direct call.
  * As a consequence, the upper layers have to specify the amount of data requested for
@@ -278,6 +449,11 @@ mbed_error_t usbotghs_send_data(uint8_t *src, uint32_t size, uint8_t ep_id);
  * - If not, data is silently stored in FIFO RAM (targetted by dst), and the driver waits
  *   for the next content while 'size' amount of data is not reached
  *
+ * In DMA mode, data EPs content is written by the core DMA directly in dst,
+ * which must be word-aligned and out of the CCM RAM, size being a multiple of
+ * the EP mpsize (see usbotghs_dma_buf_alloc()), except for small control and
+ * interrupt transfers, which are copied from the EP bounce buffer.
+ *
  * @return MBED_ERROR_NONE if setup is ok, or various possible other errors (INVSTATE
  * for invalid enpoint type, INVPARAM if dst is NULL or size invalid)
  */
@@ -325,7 +501,131 @@ mbed_error_t usbotghs_send_data(uint8_t *src, uint32_t size, uint8_t ep_id);
 mbed_error_t usbotghs_set_recv_fifo(uint8_t *dst, uint32_t size, uint8_t epid);
 
 /*
- * Send a special zero-length packet on EP ep
+ * Same as usbotghs_set_recv_fifo(), for a transfer made of a header followed
+ * by a payload (e.g. a mass storage CBW and the associated data): the first
+ * hdr_size bytes of the transfer are stored in hdr, the next ones in payload,
+ * without re-arming the EP in between. The upper layer handler is called twice:
+ * first with the header size, as soon as the header is received (the payload
+ * may still be in progress), then with the payload size at the end of the
+ * transfer. If a short packet ends the transfer within the header (e.g. a
+ * command block sent on its own), the handler is called with the received
+ * header size, the EP being already re-armed on the payload. Not supported in
+ * DMA mode.
+ *
+ * @return MBED_ERROR_NONE if setup is ok, MBED_ERROR_INVPARAM on invalid
+ * parameter, MBED_ERROR_INVSTATE if the RAM FIFO is busy or the EP uses
+ * another receive mode, MBED_ERROR_UNSUPORTED_CMD in DMA mode
+ */
+/*@
+  @ assigns GHOST_opaque_drv_privates;
+  @ assigns \result \from indirect:epid, indirect:hdr, indirect:hdr_size, indirect:payload, indirect:payload_size;
+  @ ensures (hdr == NULL || payload == NULL || hdr_size == 0 || payload_size == 0 || epid >= USBOTGHS_MAX_OUT_EP) ==> \result == MBED_ERROR_INVPARAM;
+  */
+mbed_error_t usbotghs_set_recv_fifo_split(uint8_t *hdr, uint32_t hdr_size,
+                                          uint8_t *payload, uint32_t payload_size,
+                                          uint8_t epid);
+
+/*
+ * Post a receive buffer on the given data OUT EP. Posted buffers are used one
+ * after the other, in posting order: when a transfer completes, the driver
+ * immediately arms the EP with the next posted buffer and then calls the upper
+ * layer OUT handler, which retrieves the filled buffer with
+ * usbotghs_get_recv_buffer(). The buffer is owned by the driver until then.
+ *
+ * Posting the first buffer switches the EP to this mode (usbotghs_set_recv_fifo()
+ * is then refused on it) until the EP is configured again. If no buffer is
+ * armed, the EP is enabled here. Buffers must always be posted from the same
+ * context (e.g. the OUT handler or the main thread).
+ *
+ * @dst the receive buffer
+ * @size the buffer size, in bytes. It should be a multiple of the EP mpsize
+ * @ep_id the OUT EP identifier (EP0 excluded)
+ *
+ * @return MBED_ERROR_NONE on success, MBED_ERROR_INVPARAM on invalid parameter,
+ * MBED_ERROR_INVSTATE if the EP is not configured or a usbotghs_set_recv_fifo()
+ * transfer is in progress, MBED_ERROR_NOSTORAGE if the ring is full
+ */
+/*@
+  @ assigns GHOST_opaque_drv_privates;
+  @ assigns \result \from indirect:dst, indirect:size, indirect:ep_id;
+  @ ensures (dst == NULL || ep_id == 0 || ep_id >= USBOTGHS_MAX_OUT_EP) ==> \result == MBED_ERROR_INVPARAM;
+  @ ensures \result == MBED_ERROR_NONE || \result == MBED_ERROR_INVPARAM || \result == MBED_ERROR_INVSTATE || \result == MBED_ERROR_NOSTORAGE;
+  */
+mbed_error_t usbotghs_post_recv_buffer(uint8_t *dst, uint32_t size, uint8_t ep_id);
+
+/*
+ * Get back the oldest filled receive buffer of the given data OUT EP, with
+ * the received data size. The buffer can be posted again once processed.
+ * Buffers must always be retrieved from the same context.
+ *
+ * @return MBED_ERROR_NONE on success, MBED_ERROR_INVPARAM on invalid parameter,
+ * MBED_ERROR_NOTFOUND if no filled buffer is pending
+ */
+/*@
+  @ assigns GHOST_opaque_drv_privates, *dst, *size;
+  @ assigns \result \from indirect:ep_id;
+  @ ensures (dst == NULL || size == NULL || ep_id == 0 || ep_id >= USBOTGHS_MAX_OUT_EP) ==> \result == MBED_ERROR_INVPARAM;
+  @ ensures \result == MBED_ERROR_NONE || \result == MBED_ERROR_INVPARAM || \result == MBED_ERROR_NOTFOUND;
+  */
+mbed_error_t usbotghs_get_recv_buffer(uint8_t **dst, uint32_t *size, uint8_t ep_id);
+
+/*
+ * Switch the given data OUT EP to streaming mode: received data are
+ * continuously written in the buf circular buffer, without per-transfer
+ * upper layer action. The upper layer OUT handler is called, with the amount
+ * of pending data, when this amount reaches the watermark, on short packets
+ * (end of an host transfer) and when the buffer is full. The EP only NAKs the
+ * host while less than mpsize bytes are free in the buffer.
+ *
+ * The EP stays in this mode until it is configured again. This mode is not
+ * supported in DMA mode.
+ *
+ * @buf the circular buffer
+ * @size the buffer size, a power of two bigger than the EP mpsize
+ * @watermark pending data level, in bytes, triggering the upper layer handler
+ * @ep_id the OUT EP identifier (EP0 excluded)
+ *
+ * @return MBED_ERROR_NONE on success, MBED_ERROR_INVPARAM on invalid parameter,
+ * MBED_ERROR_INVSTATE if the EP is not configured, is busy or is already in
+ * another receive mode
+ */
+/*@
+  @ assigns GHOST_opaque_drv_privates;
+  @ assigns \result \from indirect:buf, indirect:size, indirect:watermark, indirect:ep_id;
+  @ ensures (buf == NULL || ep_id == 0 || ep_id >= USBOTGHS_MAX_OUT_EP) ==> \result == MBED_ERROR_INVPARAM;
+  */
+mbed_error_t usbotghs_set_recv_stream(uint8_t *buf, uint32_t size, uint32_t watermark, uint8_t ep_id);
+
+/*
+ * Get the pending data of the given streaming OUT EP. Only the part which is
+ * contiguous in the circular buffer is returned: once released, the next
+ * call returns the remaining data from the buffer start.
+ *
+ * @data set to the first pending byte
+ * @len set to the contiguous pending data size, in bytes (0 if none)
+ */
+/*@
+  @ assigns GHOST_opaque_drv_privates, *data, *len;
+  @ assigns \result \from indirect:ep_id;
+  @ ensures (data == NULL || len == NULL || ep_id == 0 || ep_id >= USBOTGHS_MAX_OUT_EP) ==> \result == MBED_ERROR_INVPARAM;
+  */
+mbed_error_t usbotghs_recv_stream_peek(uint8_t **data, uint32_t *len, uint8_t ep_id);
+
+/*
+ * Release len bytes of consumed data of the given streaming OUT EP. If the EP
+ * was NAKing for lack of room, it is enabled again.
+ */
+/*@
+  @ assigns GHOST_opaque_drv_privates;
+  @ assigns \result \from indirect:len, indirect:ep_id;
+  @ ensures (ep_id == 0 || ep_id >= USBOTGHS_MAX_OUT_EP) ==> \result == MBED_ERROR_INVPARAM;
+  */
+mbed_error_t usbotghs_recv_stream_release(uint32_t len, uint8_t ep_id);
+
+/*
+ * Send a special zero-length packet on EP ep. On a busy data IN EP, the ZLP is
+ * queued behind the current transfer. The upper layer IN handler is not called
+ * on its completion.
  */
 /*
   spec ok with CONFIG_USR_DRV_USBOTGHS_MODE_DEVICE == 1
@@ -347,6 +647,46 @@ mbed_error_t usbotghs_set_recv_fifo(uint8_t *dst, uint32_t size, uint8_t epid);
    */
 mbed_error_t usbotghs_send_zlp(uint8_t ep_id);
 
+/*
+ * Set the ZLP termination policy of the given IN EP (disabled by default, and
+ * at each EP configuration). When enabled, the driver terminates each transfer
+ * which size is a multiple of the EP mpsize with a ZLP, and the upper layer
+ * IN handler is called once the ZLP is sent. The upper layer doesn't need
+ * to call usbotghs_send_zlp() for these transfers anymore.
+ *
+ * @ep_id the IN EP identifier
+ * @enable true to enable the automatic ZLP, false to disable it
+ *
+ * @return MBED_ERROR_NONE on success, MBED_ERROR_INVPARAM if ep_id is invalid,
+ * or MBED_ERROR_INVSTATE if the EP is not configured
+ */
+/*@
+  @ assigns GHOST_opaque_drv_privates;
+  @ assigns \result \from indirect:ep_id, indirect:enable;
+  @ ensures (ep_id >= USBOTGHS_MAX_IN_EP) ==> \result == MBED_ERROR_INVPARAM ;
+  @ ensures (\result == MBED_ERROR_NONE || \result == MBED_ERROR_INVPARAM || \result == MBED_ERROR_INVSTATE) ;
+  */
+mbed_error_t usbotghs_endpoint_set_auto_zlp(uint8_t ep_id, bool enable);
+
+/*
+ * Set the completion policy of the given data OUT EP (short packet by default,
+ * and at each EP configuration). See usbotghs_ep_completion_t.
+ *
+ * @ep_id the OUT EP identifier (EP0 always completes on short packet)
+ * @completion the completion policy
+ *
+ * @return MBED_ERROR_NONE on success, MBED_ERROR_INVPARAM if ep_id or
+ * completion is invalid, MBED_ERROR_INVSTATE if the EP is not configured, or
+ * MBED_ERROR_BUSY if a transfer is armed on the EP
+ */
+/*@
+  @ assigns GHOST_opaque_drv_privates;
+  @ assigns \result \from indirect:ep_id, indirect:completion;
+  @ ensures (ep_id == 0 || ep_id >= USBOTGHS_MAX_OUT_EP) ==> \result == MBED_ERROR_INVPARAM ;
+  @ ensures (\result == MBED_ERROR_NONE || \result == MBED_ERROR_INVPARAM || \result == MBED_ERROR_INVSTATE || \result == MBED_ERROR_BUSY) ;
+  */
+mbed_error_t usbotghs_endpoint_set_completion(uint8_t ep_id, usbotghs_ep_completion_t completion);
+
 /*
  * Activate the configuration global stall mode. If any EP has its stall mode configured,
  * it can override the global stall mode
@@ -438,6 +778,8 @@ mbed_error_t usbotghs_endpoint_clear_nak(uint8_t ep_id, usbotghs_ep_dir_t dir);
 
 /*
  * Activate the given EP (for e.g. to transmit data)
+ * OUT EPs complete on short packet, see usbotghs_endpoint_set_completion()
+ * to select another completion policy.
  */
 /*@
   @ assigns GHOST_in_eps[0 .. USBOTGHS_MAX_IN_EP - 1].state;
@@ -709,4 +1051,121 @@ uint16_t usbotghs_get_ep_mpsize(usbotghs_ep_type_t type);
   */
 usbotghs_port_speed_t usbotghs_get_speed(void);
 
+/*
+ * Get the RXFLVL handler statistics, to size the per-interrupt RxFIFO status
+ * entries budget (USR_DEV_USBOTGHS_RXFLVL_BUDGET). The counters are updated
+ * from the ISR: the snapshot is only consistent if the device is idle.
+ */
+/*@
+  @ assigns *stats ;
+  */
+void usbotghs_get_rxflvl_stats(usbotghs_rxflvl_stats_t *stats);
+
+/*
+ * Reset the RXFLVL handler statistics.
+ */
+void usbotghs_clear_rxflvl_stats(void);
+
+/*
+ * Get the receive error counters of the given OUT EP. As for the RXFLVL
+ * statistics, the counters are updated from the ISR.
+ *
+ * @return MBED_ERROR_NONE on success, MBED_ERROR_INVPARAM on invalid parameter
+ */
+/*@
+  @ assigns *stats ;
+  @ ensures (stats == NULL || ep_id >= USBOTGHS_MAX_OUT_EP) ==> \result == MBED_ERROR_INVPARAM;
+  */
+mbed_error_t usbotghs_get_ep_err_stats(uint8_t ep_id, usbotghs_ep_err_stats_t *stats);
+
+/*
+ * Reset the receive error counters of the given OUT EP.
+ */
+mbed_error_t usbotghs_clear_ep_err_stats(uint8_t ep_id);
+
+/*
+ * Set the core DMA thresholds. They are programmed at device initialization
+ * (usbotghs_configure()), or immediately if the device is already initialized,
+ * in which case no transfer should be in progress. The defaults are set by
+ * CONFIG_USR_DEV_USBOTGHS_DMA_(RX|TX)_THRESHOLD.
+ *
+ * @return MBED_ERROR_NONE on success, MBED_ERROR_INVPARAM if cfg is NULL or a
+ * length is out of range, MBED_ERROR_UNSUPORTED_CMD if DMA mode is not enabled
+ */
+/*@
+  @ assigns GHOST_opaque_drv_privates;
+  @ ensures cfg == NULL ==> \result == MBED_ERROR_INVPARAM || \result == MBED_ERROR_UNSUPORTED_CMD;
+  */
+mbed_error_t usbotghs_set_dma_thresholds(const usbotghs_dma_thr_cfg_t *cfg);
+
+/*
+ * Get the current core DMA thresholds.
+ */
+/*@
+  @ assigns *cfg;
+  @ ensures cfg == NULL ==> \result == MBED_ERROR_INVPARAM || \result == MBED_ERROR_UNSUPORTED_CMD;
+  */
+mbed_error_t usbotghs_get_dma_thresholds(usbotghs_dma_thr_cfg_t *cfg);
+
+/*
+ * Allocate a buffer from the driver DMA pool, in O(1). Pool buffers are
+ * word-aligned, in DMA-reachable SRAM, and their size (returned in size) is a
+ * multiple of 512 bytes: they can be used as is as RAM FIFOs in DMA mode. The
+ * pool is not protected against concurrent accesses: it must always be used
+ * from the same context.
+ *
+ * @return MBED_ERROR_NONE on success, MBED_ERROR_INVPARAM on invalid parameter,
+ * MBED_ERROR_NOMEM if the pool is empty, MBED_ERROR_UNSUPORTED_CMD if DMA mode
+ * is not enabled
+ */
+/*@
+  @ assigns GHOST_opaque_drv_privates, *buf, *size;
+  @ ensures (buf == NULL || size == NULL) ==> \result == MBED_ERROR_INVPARAM || \result == MBED_ERROR_UNSUPORTED_CMD;
+  */
+mbed_error_t usbotghs_dma_buf_alloc(uint8_t **buf, uint32_t *size);
+
+/*
+ * Give back a buffer allocated with usbotghs_dma_buf_alloc() to the pool.
+ * The buffer must not be used by a transfer anymore.
+ *
+ * @return MBED_ERROR_NONE on success, MBED_ERROR_INVPARAM if buf is not an
+ * allocated pool buffer, MBED_ERROR_UNSUPORTED_CMD if DMA mode is not enabled
+ */
+/*@
+  @ assigns GHOST_opaque_drv_privates;
+  @ ensures buf == NULL ==> \result == MBED_ERROR_INVPARAM || \result == MBED_ERROR_UNSUPORTED_CMD;
+  */
+mbed_error_t usbotghs_dma_buf_free(uint8_t *buf);
+
+/*
+ * Get the DMA pool usage (high-water mark included) and the number of
+ * transfers the driver refused in DMA mode, by cause.
+ */
+/*@
+  @ assigns *stats;
+  @ ensures stats == NULL ==> \result == MBED_ERROR_INVPARAM;
+  */
+mbed_error_t usbotghs_get_dma_pool_stats(usbotghs_dma_pool_stats_t *stats);
+
+/*
+ * Reset the DMA pool counters. The high-water mark restarts from the number
+ * of buffers currently in use.
+ */
+void usbotghs_clear_dma_pool_stats(void);
+
+/*
+ * Set the size up to which interrupt EPs transfers not compliant with the core
+ * DMA constraints are copied through the EP bounce buffer instead of being
+ * refused (0 to refuse them all). Control EPs transfers are always bounced
+ * when needed. Bulk and isochronous EPs transfers are never bounced.
+ *
+ * @return MBED_ERROR_NONE on success, MBED_ERROR_INVPARAM if size is bigger than
+ * the bounce buffers (CONFIG_USR_DEV_USBOTGHS_DMA_BOUNCE_SIZE),
+ * MBED_ERROR_UNSUPORTED_CMD if DMA mode is not enabled
+ */
+/*@
+  @ assigns GHOST_opaque_drv_privates;
+  */
+mbed_error_t usbotghs_set_dma_bounce_threshold(uint32_t size);
+
 #endif /*!LIBUSBOTGHS_H_ */
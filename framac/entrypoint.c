@@ -206,15 +206,15 @@ void test_fcn_driver_eva(void)
 #if 0
     //usbotghs_ctx.in_eps[EP0].mpsize = Frama_C_interval_16(0,65535);
     /* manual lock update for reentrency test purpose only */
-    usbotghs_ctx.in_eps[EP0].fifo_lck = 1 ;
+    usbotghs_ctx.in_eps[EP0].fifo_owner = USBOTG_HS_FIFO_APP_OWNED ;
     usbotghs_send_data((uint8_t *)&resp[0], size, EP0);
-    usbotghs_ctx.in_eps[EP0].fifo_lck = 0 ;
+    usbotghs_ctx.in_eps[EP0].fifo_owner = USBOTG_HS_FIFO_DRIVER_OWNED ;
 
     usbotghs_send_data((uint8_t *)&resp[0], 512, EP0);
     /* manual set of EP 4 */
     usbotghs_ctx.in_eps[4].mpsize = Frama_C_interval_16(0,65535);
     usbotghs_ctx.in_eps[4].id = 4 ;
-    usbotghs_ctx.in_eps[4].fifo_lck = 0 ;
+    usbotghs_ctx.in_eps[4].fifo_owner = USBOTG_HS_FIFO_DRIVER_OWNED ;
     usbotghs_ctx.in_eps[4].configured = 1 ;
     /* send data on EP 4 */
 
@@ -247,9 +247,9 @@ void test_fcn_driver_eva(void)
     usbotghs_set_recv_fifo((uint8_t *)&resp[0], size, 7); /* inexistant EP */
 
     /* trying to set fifo while locked */
-    usbotghs_ctx.out_eps[1].fifo_lck = true;
+    usbotghs_ctx.out_eps[1].fifo_owner = USBOTG_HS_FIFO_APP_OWNED;
     usbotghs_set_recv_fifo((uint8_t *)&resp[0], size, 1);
-    usbotghs_ctx.out_eps[1].fifo_lck = false;
+    usbotghs_ctx.out_eps[1].fifo_owner = USBOTG_HS_FIFO_DRIVER_OWNED;
 
 #if 0
     usbotghs_configure_endpoint(ep_id,type,dir,64,USB_BACKEND_EP_ODDFRAME,&handler_ep);
@@ -281,9 +281,9 @@ void test_fcn_driver_eva(void)
     usbotghs_send_data((uint8_t *)&resp[0], 515, 2);
 
     /* simulating async lock */
-    usbotghs_ctx.in_eps[2].fifo_lck = true;
+    usbotghs_ctx.in_eps[2].fifo_owner = USBOTG_HS_FIFO_APP_OWNED;
     usbotghs_send_data((uint8_t *)&resp[0], 512, 2);
-    usbotghs_ctx.in_eps[2].fifo_lck = false;
+    usbotghs_ctx.in_eps[2].fifo_owner = USBOTG_HS_FIFO_DRIVER_OWNED;
 
 
     usbotghs_txfifo_flush_all();
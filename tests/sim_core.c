@@ -0,0 +1,254 @@
+/*
+ *
+ * Copyright 2019 The wookey project team <wookey@ssi.gouv.fr>
+ *   - Ryad     Benadjila
+ *   - Arnauld  Michelizza
+ *   - Mathieu  Renard
+ *   - Philippe Thierry
+ *   - Philippe Trebuchet
+ *
+ * This package is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * the Free Software Foundation; either version 3 of the License, or (at
+ * ur option) any later version.
+ *
+ * This package is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this package; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ */
+#define _GNU_SOURCE
+#include <signal.h>
+#include <string.h>
+#include <sys/mman.h>
+#if defined(__x86_64__) && defined(__linux__)
+# include <ucontext.h>
+# define SIM_FIFO_TRAPS 1
+#endif
+
+#include "libc/types.h"
+#include "libs/usbctrl/api/libusbctrl.h"
+#include "api/libusbotghs.h"
+#include "usbotghs.h"
+#include "ulpi.h"
+#include "sim_core.h"
+
+uint8_t sim_regs[SIM_REGS_SIZE] __attribute__((aligned(SIM_PAGE_SIZE)));
+
+#define SIM_FIFO_BASE   (sim_regs + SIM_PAGE_SIZE)
+#define SIM_FIFO_SIZE   (USBOTGHS_MAX_IN_EP * SIM_PAGE_SIZE)
+
+static uint32_t rx_words[SIM_FIFO_WORDS];
+static uint32_t rx_head = 0;
+static uint32_t rx_tail = 0;
+static uint32_t rx_underflows = 0;
+
+static uint32_t tx_words[USBOTGHS_MAX_IN_EP][SIM_FIFO_WORDS];
+static uint32_t tx_cnt[USBOTGHS_MAX_IN_EP];
+
+static char events[1024];
+
+void sim_reset(void)
+{
+    /* the FIFO windows are not memory: only the registers page is cleared */
+    memset(sim_regs, 0, SIM_PAGE_SIZE);
+    rx_head = 0;
+    rx_tail = 0;
+    rx_underflows = 0;
+    memset(tx_cnt, 0, sizeof(tx_cnt));
+    events[0] = '\0';
+}
+
+void sim_rx_push(const uint8_t *data, uint32_t size)
+{
+    uint32_t word;
+
+    while (size > 0 && rx_tail < SIM_FIFO_WORDS) {
+        word = 0;
+        for (uint8_t i = 0; i < 4 && size > 0; ++i, --size) {
+            word |= (uint32_t)(*data++) << (8 * i);
+        }
+        rx_words[rx_tail++] = word;
+    }
+}
+
+uint32_t sim_rx_left(void)
+{
+    return rx_tail - rx_head;
+}
+
+uint32_t sim_rx_underflows(void)
+{
+    return rx_underflows;
+}
+
+uint32_t sim_tx_count(uint8_t ep)
+{
+    return tx_cnt[ep];
+}
+
+const uint32_t *sim_tx_words(uint8_t ep)
+{
+    return tx_words[ep];
+}
+
+static uint32_t sim_rx_pop(void)
+{
+    if (rx_head == rx_tail) {
+        rx_underflows++;
+        return 0xdeadbeef;
+    }
+    return rx_words[rx_head++];
+}
+
+static void sim_tx_push(uint8_t ep, uint32_t word)
+{
+    /* DTXFSTS.INEPTFSAV: the EP TxFIFO free space, in words */
+    volatile uint32_t *dtxfsts = (volatile uint32_t *)(void *)&sim_regs[0x918 + 0x20 * ep];
+
+    if (tx_cnt[ep] < SIM_FIFO_WORDS) {
+        tx_words[ep][tx_cnt[ep]++] = word;
+    }
+    if ((*dtxfsts & 0xffff) > 0) {
+        (*dtxfsts)--;
+    }
+}
+
+#if SIM_FIFO_TRAPS
+/*
+ * A FIFO window access faults (the pages are not accessible): the page is
+ * opened and the access is single-stepped. A read gets the next RxFIFO word
+ * (written at the accessed address before the access is replayed), a written
+ * word is collected once the access is done, then the page is closed again.
+ */
+#define X86_EFLAGS_TF   0x100
+#define X86_PF_WRITE    0x2
+
+static volatile uint32_t *pending_write = NULL;
+static uint8_t pending_ep = 0;
+static uint8_t *pending_page = NULL;
+
+static void sim_fifo_segv(int sig, siginfo_t *si, void *uctx)
+{
+    ucontext_t *uc = uctx;
+    uint8_t *addr = si->si_addr;
+    volatile uint32_t *word;
+
+    (void)sig;
+    if (addr < SIM_FIFO_BASE || addr >= SIM_FIFO_BASE + SIM_FIFO_SIZE) {
+        /* real fault: crash on the faulty access */
+        signal(SIGSEGV, SIG_DFL);
+        return;
+    }
+    word = (volatile uint32_t *)((uintptr_t)addr & ~(uintptr_t)3);
+    pending_page = (uint8_t *)((uintptr_t)addr & ~(uintptr_t)(SIM_PAGE_SIZE - 1));
+    mprotect(pending_page, SIM_PAGE_SIZE, PROT_READ | PROT_WRITE);
+    if (uc->uc_mcontext.gregs[REG_ERR] & X86_PF_WRITE) {
+        pending_write = word;
+        pending_ep = (uint8_t)((pending_page - SIM_FIFO_BASE) / SIM_PAGE_SIZE);
+    } else {
+        *word = sim_rx_pop();
+    }
+    uc->uc_mcontext.gregs[REG_EFL] |= X86_EFLAGS_TF;
+}
+
+static void sim_fifo_step(int sig, siginfo_t *si, void *uctx)
+{
+    ucontext_t *uc = uctx;
+
+    (void)sig;
+    (void)si;
+    if (pending_write != NULL) {
+        sim_tx_push(pending_ep, *pending_write);
+        pending_write = NULL;
+    }
+    mprotect(pending_page, SIM_PAGE_SIZE, PROT_NONE);
+    uc->uc_mcontext.gregs[REG_EFL] &= ~X86_EFLAGS_TF;
+}
+
+bool sim_fifo_start(void)
+{
+    struct sigaction sa;
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_flags = SA_SIGINFO;
+    sa.sa_sigaction = sim_fifo_segv;
+    if (sigaction(SIGSEGV, &sa, NULL) != 0) {
+        return false;
+    }
+    sa.sa_sigaction = sim_fifo_step;
+    if (sigaction(SIGTRAP, &sa, NULL) != 0) {
+        return false;
+    }
+    return mprotect(SIM_FIFO_BASE, SIM_FIFO_SIZE, PROT_NONE) == 0;
+}
+
+void sim_fifo_stop(void)
+{
+    mprotect(SIM_FIFO_BASE, SIM_FIFO_SIZE, PROT_READ | PROT_WRITE);
+    signal(SIGSEGV, SIG_DFL);
+    signal(SIGTRAP, SIG_DFL);
+}
+#else
+bool sim_fifo_start(void)
+{
+    return false;
+}
+
+void sim_fifo_stop(void)
+{
+}
+#endif
+
+void sim_event(const char *name)
+{
+    if (strlen(events) + strlen(name) + 2 > sizeof(events)) {
+        return;
+    }
+    strcat(events, name);
+    strcat(events, " ");
+}
+
+const char *sim_events(void)
+{
+    return events;
+}
+
+/* control plane (libusbctrl) */
+mbed_error_t usbctrl_handle_reset(uint32_t dev_id)
+{
+    (void)dev_id;
+    sim_event("reset");
+    return MBED_ERROR_NONE;
+}
+
+mbed_error_t usbctrl_handle_earlysuspend(uint32_t dev_id)
+{
+    (void)dev_id;
+    sim_event("earlysuspend");
+    return MBED_ERROR_NONE;
+}
+
+mbed_error_t usbctrl_handle_usbsuspend(uint32_t dev_id)
+{
+    (void)dev_id;
+    sim_event("usbsuspend");
+    return MBED_ERROR_NONE;
+}
+
+mbed_error_t usbctrl_handle_wakeup(uint32_t dev_id)
+{
+    (void)dev_id;
+    sim_event("wakeup");
+    return MBED_ERROR_NONE;
+}
+
+/* no ULPI PHY on host */
+mbed_error_t usbotghs_ulpi_reset(void)
+{
+    return MBED_ERROR_NONE;
+}
@@ -0,0 +1,80 @@
+/*
+ *
+ * Copyright 2019 The wookey project team <wookey@ssi.gouv.fr>
+ *   - Ryad     Benadjila
+ *   - Arnauld  Michelizza
+ *   - Mathieu  Renard
+ *   - Philippe Thierry
+ *   - Philippe Trebuchet
+ *
+ * This package is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * the Free Software Foundation; either version 3 of the License, or (at
+ * ur option) any later version.
+ *
+ * This package is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this package; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ */
+#ifndef TESTS_SIM_CORE_H_
+#define TESTS_SIM_CORE_H_
+
+/*
+ * Host simulation of the USB OTG HS core, for the host tests.
+ *
+ * The register block is a host memory block (see stubs/libc/regutils.h):
+ * control and status registers are plain memory words, set by the tests
+ * and read back after the driver calls.
+ *
+ * The EP FIFO windows (4KB each, any address of a window pushes to the EP
+ * TxFIFO or pops from the RxFIFO) are simulated by trapping the accesses
+ * to these pages: each word written by the driver is appended to the EP
+ * TxFIFO stream (and taken from its DTXFSTS free space, which the tests
+ * give back as the core would send the packets), each word read is taken
+ * from the RxFIFO stream. This is only supported on x86_64 Linux hosts:
+ * elsewhere, sim_fifo_start() fails and the tests relying on it are
+ * skipped.
+ */
+
+#include "libc/types.h"
+
+#define SIM_PAGE_SIZE       0x1000
+/* registers page and EP0 to EP5 FIFO windows */
+#define SIM_REGS_SIZE       (8 * SIM_PAGE_SIZE)
+/* size of each simulated FIFO stream, in 32bits words */
+#define SIM_FIFO_WORDS      4096
+
+extern uint8_t sim_regs[SIM_REGS_SIZE];
+
+/* clear the registers and the FIFO streams */
+void sim_reset(void);
+
+/* trap the EP FIFO windows accesses. Returns false if the host can't */
+bool sim_fifo_start(void);
+void sim_fifo_stop(void);
+
+/* append size bytes to the RxFIFO, the last word being zero-padded */
+void sim_rx_push(const uint8_t *data, uint32_t size);
+/* RxFIFO words not popped yet by the driver */
+uint32_t sim_rx_left(void);
+/* RxFIFO pops while it was empty */
+uint32_t sim_rx_underflows(void);
+
+/* words pushed by the driver to the EP TxFIFO since the last reset */
+uint32_t sim_tx_count(uint8_t ep);
+const uint32_t *sim_tx_words(uint8_t ep);
+
+/*
+ * control plane events received by the libusbctrl stub, as a space-separated
+ * list of names (e.g. "earlysuspend usbsuspend wakeup "). Tests may append
+ * their own events (e.g. from the EP handlers) with sim_event().
+ */
+void sim_event(const char *name);
+const char *sim_events(void);
+
+#endif/*!TESTS_SIM_CORE_H_*/
@@ -0,0 +1,9 @@
+/*
+ * Host build stub of the libstd nostd API: nothing used by the driver
+ */
+#ifndef TESTS_STUBS_NOSTD_H_
+#define TESTS_STUBS_NOSTD_H_
+
+#include "libc/types.h"
+
+#endif/*!TESTS_STUBS_NOSTD_H_*/
@@ -0,0 +1,48 @@
+/*
+ * Host build stub of the libstd register accessors. The USB OTG HS register
+ * block is simulated by a host memory block (see sim_core.c): a register
+ * address is turned into the same offset in sim_regs.
+ */
+#ifndef TESTS_STUBS_REGUTILS_H_
+#define TESTS_STUBS_REGUTILS_H_
+
+#include "libc/types.h"
+
+extern uint8_t sim_regs[];
+
+#define REG_ADDR(addr) ((volatile uint32_t *)(void *)(sim_regs + ((addr) - USB_OTG_HS_BASE)))
+
+static inline uint32_t read_reg_value(volatile uint32_t *reg)
+{
+    return *reg;
+}
+
+static inline void write_reg_value(volatile uint32_t *reg, uint32_t value)
+{
+    *reg = value;
+}
+
+static inline uint32_t get_reg_value(volatile const uint32_t *reg, uint32_t mask, uint8_t pos)
+{
+    return (*reg & mask) >> pos;
+}
+
+static inline void set_reg_value(volatile uint32_t *reg, uint32_t value, uint32_t mask, uint8_t pos)
+{
+    *reg = (*reg & ~mask) | ((value << pos) & mask);
+}
+
+static inline void set_reg_bits(volatile uint32_t *reg, uint32_t value)
+{
+    *reg |= value;
+}
+
+static inline void clear_reg_bits(volatile uint32_t *reg, uint32_t value)
+{
+    *reg &= ~value;
+}
+
+#define get_reg(REG, FIELD) get_reg_value(REG, FIELD##_Msk, FIELD##_Pos)
+#define set_reg(REG, VALUE, FIELD) set_reg_value(REG, VALUE, FIELD##_Msk, FIELD##_Pos)
+
+#endif/*!TESTS_STUBS_REGUTILS_H_*/
@@ -0,0 +1,22 @@
+/*
+ * Host build stub of the libstd handlers sanitation API: on host, any
+ * handler is a valid one
+ */
+#ifndef TESTS_STUBS_SANHANDLERS_H_
+#define TESTS_STUBS_SANHANDLERS_H_
+
+#include "libc/types.h"
+
+static inline int handler_sanity_check(physaddr_t handler)
+{
+    (void)handler;
+    return 0;
+}
+
+static inline int handler_sanity_check_with_panic(physaddr_t handler)
+{
+    (void)handler;
+    return 0;
+}
+
+#endif/*!TESTS_STUBS_SANHANDLERS_H_*/
@@ -0,0 +1,9 @@
+/*
+ * Host build stub of the libstd stdio API
+ */
+#ifndef TESTS_STUBS_STDIO_H_
+#define TESTS_STUBS_STDIO_H_
+
+#include <stdio.h>
+
+#endif/*!TESTS_STUBS_STDIO_H_*/
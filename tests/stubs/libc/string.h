@@ -0,0 +1,9 @@
+/*
+ * Host build stub of the libstd string API
+ */
+#ifndef TESTS_STUBS_STRING_H_
+#define TESTS_STUBS_STRING_H_
+
+#include <string.h>
+
+#endif/*!TESTS_STUBS_STRING_H_*/
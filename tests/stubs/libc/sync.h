@@ -0,0 +1,38 @@
+/*
+ * Host build stub of the libstd sync API
+ */
+#ifndef TESTS_STUBS_SYNC_H_
+#define TESTS_STUBS_SYNC_H_
+
+#include "libc/types.h"
+
+static inline void request_data_membarrier(void)
+{
+    __asm__ volatile("" ::: "memory");
+}
+
+static inline void set_u8_with_membarrier(volatile uint8_t *target, uint8_t val)
+{
+    *target = val;
+    request_data_membarrier();
+}
+
+static inline void set_u16_with_membarrier(volatile uint16_t *target, uint16_t val)
+{
+    *target = val;
+    request_data_membarrier();
+}
+
+static inline void set_u32_with_membarrier(volatile uint32_t *target, uint32_t val)
+{
+    *target = val;
+    request_data_membarrier();
+}
+
+static inline void set_bool_with_membarrier(volatile bool *target, bool val)
+{
+    *target = val;
+    request_data_membarrier();
+}
+
+#endif/*!TESTS_STUBS_SYNC_H_*/
@@ -0,0 +1,120 @@
+/*
+ * Host build stub of the libstd syscall API: the device_t layout filled by
+ * usbotghs_declare(), and syscalls which always succeed. The device is never
+ * declared nor mapped by the host tests.
+ */
+#ifndef TESTS_STUBS_SYSCALL_H_
+#define TESTS_STUBS_SYSCALL_H_
+
+#include "libc/types.h"
+
+enum {
+    GPIO_PA = 0, GPIO_PB, GPIO_PC, GPIO_PD, GPIO_PE, GPIO_PF, GPIO_PG, GPIO_PH, GPIO_PI,
+};
+
+typedef enum {
+    SYS_E_DONE = 0,
+    SYS_E_INVAL,
+    SYS_E_DENIED,
+    SYS_E_BUSY,
+} e_syscall_ret;
+
+enum { INIT_DEVACCESS = 0 };
+enum { CFG_DEV_MAP = 0 };
+enum { DEV_MAP_AUTO = 0, DEV_MAP_VOLUNTARY };
+enum { IRQ_ISR_STANDARD = 0, IRQ_ISR_FORCE_MAINTHREAD, IRQ_ISR_WITHOUT_MAINTHREAD };
+enum { IRQ_PH_NIL = 0, IRQ_PH_READ, IRQ_PH_WRITE, IRQ_PH_AND, IRQ_PH_MASK };
+
+#define GPIO_MASK_SET_MODE    (1 << 0)
+#define GPIO_MASK_SET_TYPE    (1 << 1)
+#define GPIO_MASK_SET_SPEED   (1 << 2)
+#define GPIO_MASK_SET_PUPD    (1 << 3)
+#define GPIO_MASK_SET_AFR     (1 << 6)
+
+enum { GPIO_PIN_INPUT_MODE = 0, GPIO_PIN_OUTPUT_MODE, GPIO_PIN_ALTERNATE_MODE, GPIO_PIN_ANALOG_MODE };
+enum { GPIO_NOPULL = 0, GPIO_PULLUP, GPIO_PULLDOWN };
+enum { GPIO_PIN_OTYPER_PP = 0, GPIO_PIN_OTYPER_OD };
+enum { GPIO_PIN_LOW_SPEED = 0, GPIO_PIN_MEDIUM_SPEED, GPIO_PIN_HIGH_SPEED, GPIO_PIN_VERY_HIGH_SPEED };
+#define GPIO_AF_OTG_HS 10
+
+typedef void (*user_handler_t)(uint8_t irq, uint32_t status, uint32_t data);
+
+typedef struct {
+    uint8_t instr;
+    union {
+        struct {
+            uint16_t offset;
+        } read;
+        struct {
+            uint16_t offset;
+            uint32_t value;
+            uint32_t mask;
+        } write;
+        struct {
+            uint16_t offset_dest;
+            uint16_t offset_src;
+            uint32_t mask;
+            uint8_t  mode;
+        } and;
+        struct {
+            uint16_t offset_dest;
+            uint16_t offset_src;
+            uint16_t offset_mask;
+            uint8_t  mode;
+        } mask;
+    };
+} dev_irq_ph_action_t;
+
+typedef struct {
+    dev_irq_ph_action_t action[10];
+    uint16_t status;
+    uint16_t data;
+} dev_irq_ph_t;
+
+typedef struct {
+    user_handler_t handler;
+    uint8_t irq;
+    uint8_t mode;
+    dev_irq_ph_t posthook;
+} dev_irq_info_t;
+
+typedef struct {
+    uint8_t mask;
+    struct {
+        uint8_t port;
+        uint8_t pin;
+    } kref;
+    uint8_t mode;
+    uint8_t pupd;
+    uint8_t type;
+    uint8_t speed;
+    uint32_t afr;
+} dev_gpio_info_t;
+
+typedef struct {
+    char name[16];
+    physaddr_t address;
+    uint32_t size;
+    uint8_t irq_num;
+    uint8_t gpio_num;
+    uint8_t map_mode;
+    dev_irq_info_t irqs[4];
+    dev_gpio_info_t gpios[16];
+} device_t;
+
+static inline e_syscall_ret sys_init(int type, device_t *dev, int *desc)
+{
+    (void)type;
+    (void)dev;
+    *desc = 0;
+    return SYS_E_DONE;
+}
+
+static inline e_syscall_ret sys_cfg(int type, int desc)
+{
+    (void)type;
+    (void)desc;
+    return SYS_E_DONE;
+}
+
+#endif/*!TESTS_STUBS_SYSCALL_H_*/
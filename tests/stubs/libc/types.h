@@ -0,0 +1,36 @@
+/*
+ * Host build stub of the libstd types used by the driver
+ */
+#ifndef TESTS_STUBS_TYPES_H_
+#define TESTS_STUBS_TYPES_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef uint32_t physaddr_t;
+
+#define __explicit_fallthrough __attribute__((fallthrough));
+
+typedef enum {
+    MBED_ERROR_NONE = 0,
+    MBED_ERROR_NOMEM,
+    MBED_ERROR_NOSTORAGE,
+    MBED_ERROR_NOBACKEND,
+    MBED_ERROR_INVCREDENCIALS,
+    MBED_ERROR_UNSUPORTED_CMD,
+    MBED_ERROR_INVSTATE,
+    MBED_ERROR_NOTREADY,
+    MBED_ERROR_BUSY,
+    MBED_ERROR_DENIED,
+    MBED_ERROR_UNKNOWN,
+    MBED_ERROR_INVPARAM,
+    MBED_ERROR_WRERROR,
+    MBED_ERROR_RDERROR,
+    MBED_ERROR_INITFAIL,
+    MBED_ERROR_TOOBIG,
+    MBED_ERROR_NOTFOUND,
+    MBED_ERROR_INTR,
+} mbed_error_t;
+
+#endif/*!TESTS_STUBS_TYPES_H_*/
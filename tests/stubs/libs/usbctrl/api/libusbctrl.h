@@ -0,0 +1,26 @@
+/*
+ * Host build stub of the libusbctrl API: the backend driver types, mapped on
+ * the USB OTG HS ones, and the control plane events the driver reports,
+ * implemented by the tests (see sim_core.c)
+ */
+#ifndef TESTS_STUBS_LIBUSBCTRL_H_
+#define TESTS_STUBS_LIBUSBCTRL_H_
+
+#include "libc/types.h"
+#include "api/libusbotghs.h"
+
+#define usb_backend_drv_ep_dir_t        usbotghs_ep_dir_t
+#define usb_backend_drv_ep_state_t      usbotghs_ep_state_t
+#define usb_backend_drv_ep_toggle_t     usbotghs_ep_toggle_t
+#define usb_backend_drv_ep_type_t       usbotghs_ep_type_t
+#define usb_backend_drv_epx_mpsize_t    usbotghs_epx_mpsize_t
+#define usb_backend_drv_ioep_handler_t  usbotghs_ioep_handler_t
+#define usb_backend_drv_mode_t          usbotghs_dev_mode_t
+#define usb_backend_drv_port_speed_t    usbotghs_port_speed_t
+
+mbed_error_t usbctrl_handle_reset(uint32_t dev_id);
+mbed_error_t usbctrl_handle_earlysuspend(uint32_t dev_id);
+mbed_error_t usbctrl_handle_usbsuspend(uint32_t dev_id);
+mbed_error_t usbctrl_handle_wakeup(uint32_t dev_id);
+
+#endif/*!TESTS_STUBS_LIBUSBCTRL_H_*/
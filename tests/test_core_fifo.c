@@ -0,0 +1,261 @@
+/*
+ *
+ * Copyright 2019 The wookey project team <wookey@ssi.gouv.fr>
+ *   - Ryad     Benadjila
+ *   - Arnauld  Michelizza
+ *   - Mathieu  Renard
+ *   - Philippe Thierry
+ *   - Philippe Trebuchet
+ *
+ * This package is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * the Free Software Foundation; either version 3 of the License, or (at
+ * ur option) any later version.
+ *
+ * This package is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this package; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ */
+
+/*
+ * Host test of the Core FIFO copy paths, on the simulated EP FIFO windows
+ * (see sim_core.h): whatever the RAM FIFO alignment and the transfer size,
+ * the driver must push the same little-endian word stream to the Core
+ * TxFIFO, and must pop exactly the words of a received packet from the
+ * Core RxFIFO, without writing past the packet in the RAM FIFO, whether the
+ * packet is read or dropped.
+ *
+ * With the 'bench' argument, the copy paths are also timed, the FIFO
+ * windows being plain memory (no trap): this only compares the CPU cost of
+ * the word-burst and byte paths on the host, not the AHB access time of
+ * the target.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "libc/types.h"
+#include "api/libusbotghs.h"
+#include "usbotghs.h"
+#include "usbotghs_fifos.h"
+#include "sim_core.h"
+
+#define TEST_EP        1
+#define TEST_BUF_SZ    1024
+
+static unsigned int failures = 0;
+
+#define CHECK_EQ(name, val, expected) do { \
+    if ((uint32_t)(val) != (uint32_t)(expected)) { \
+        printf("  %s: %u, expected %u\n", name, (unsigned int)(val), (unsigned int)(expected)); \
+        failures++; \
+    } \
+} while (0)
+
+/* offsets 1 to 3 make an unaligned RAM FIFO, size % 4 selects the tail */
+static const uint8_t offsets[] = { 0, 1, 2, 3 };
+static const uint32_t sizes[] = { 1, 2, 3, 4, 5, 7, 31, 32, 33, 35, 36, 63, 64, 509, 512 };
+
+static uint32_t buf_w[(TEST_BUF_SZ + 8) / 4];
+static uint8_t * const buf = (uint8_t *)buf_w;
+static uint8_t ref[TEST_BUF_SZ];
+
+#define GUARD   0xa5
+
+static void pattern(uint8_t *dst, uint32_t size, uint8_t seed)
+{
+    for (uint32_t i = 0; i < size; ++i) {
+        dst[i] = (uint8_t)(seed + 7 * i + (i >> 8));
+    }
+}
+
+static void in_ep_set(uint8_t *fifo, uint32_t size)
+{
+    usbotghs_ep_t *ep = &(usbotghs_get_context()->in_eps[TEST_EP]);
+
+    memset(ep, 0, sizeof(*ep));
+    ep->id = TEST_EP;
+    ep->configured = true;
+    ep->mpsize = 512;
+    ep->fifo = fifo;
+    ep->fifo_size = size;
+    ep->fifo_owner = USBOTG_HS_FIFO_DRIVER_OWNED;
+}
+
+static void out_ep_set(uint8_t *fifo, uint32_t size)
+{
+    usbotghs_ep_t *ep = &(usbotghs_get_context()->out_eps[TEST_EP]);
+
+    memset(ep, 0, sizeof(*ep));
+    ep->id = TEST_EP;
+    ep->configured = true;
+    ep->mpsize = 512;
+    ep->fifo = fifo;
+    ep->fifo_size = size;
+    ep->fifo_owner = USBOTG_HS_FIFO_DRIVER_OWNED;
+}
+
+/*
+ * usbotghs_write_core_fifo() through usbotghs_write_epx_fifo(): aligned
+ * word bursts, unaligned byte path, and 1 to 3 bytes tail
+ */
+static void test_write_core_fifo(void)
+{
+    char name[64];
+    const uint32_t *words;
+    uint32_t expected;
+    uint8_t *src;
+
+    printf("%s\n", __func__);
+    for (uint8_t o = 0; o < sizeof(offsets); ++o) {
+        for (uint8_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s) {
+            sim_reset();
+            src = &buf[offsets[o]];
+            pattern(src, sizes[s], s);
+            in_ep_set(src, sizes[s]);
+            snprintf(name, sizeof(name), "write off %u size %u", offsets[o], sizes[s]);
+            CHECK_EQ(name, usbotghs_write_epx_fifo(sizes[s], TEST_EP), MBED_ERROR_NONE);
+            snprintf(name, sizeof(name), "words off %u size %u", offsets[o], sizes[s]);
+            CHECK_EQ(name, sim_tx_count(TEST_EP), (sizes[s] + 3) / 4);
+            words = sim_tx_words(TEST_EP);
+            for (uint32_t i = 0; i < sim_tx_count(TEST_EP); ++i) {
+                /* same packing as the RxFIFO: little-endian, zero-padded */
+                expected = 0;
+                for (uint32_t b = 0; b < 4 && 4 * i + b < sizes[s]; ++b) {
+                    expected |= (uint32_t)src[4 * i + b] << (8 * b);
+                }
+                if (words[i] != expected) {
+                    printf("  off %u size %u word %u: 0x%08x, expected 0x%08x\n",
+                           offsets[o], sizes[s], i, words[i], expected);
+                    failures++;
+                    break;
+                }
+            }
+        }
+    }
+}
+
+/*
+ * usbotghs_read_core_fifo() through usbotghs_read_epx_fifo(): aligned word
+ * bursts, unaligned byte path, and 1 to 3 bytes residue
+ */
+static void test_read_core_fifo(void)
+{
+    char name[64];
+    uint8_t *dst;
+
+    printf("%s\n", __func__);
+    for (uint8_t o = 0; o < sizeof(offsets); ++o) {
+        for (uint8_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s) {
+            sim_reset();
+            memset(buf, GUARD, TEST_BUF_SZ + 8);
+            dst = &buf[offsets[o]];
+            pattern(ref, sizes[s], s);
+            sim_rx_push(ref, sizes[s]);
+            out_ep_set(dst, sizes[s]);
+            snprintf(name, sizeof(name), "read off %u size %u", offsets[o], sizes[s]);
+            CHECK_EQ(name, usbotghs_read_epx_fifo(sizes[s], TEST_EP), MBED_ERROR_NONE);
+            snprintf(name, sizeof(name), "data off %u size %u", offsets[o], sizes[s]);
+            CHECK_EQ(name, memcmp(dst, ref, sizes[s]), 0);
+            /* the whole packet, and only it, is popped */
+            snprintf(name, sizeof(name), "left off %u size %u", offsets[o], sizes[s]);
+            CHECK_EQ(name, sim_rx_left(), 0);
+            snprintf(name, sizeof(name), "underflows off %u size %u", offsets[o], sizes[s]);
+            CHECK_EQ(name, sim_rx_underflows(), 0);
+            snprintf(name, sizeof(name), "guard off %u size %u", offsets[o], sizes[s]);
+            CHECK_EQ(name, dst[sizes[s]], GUARD);
+            CHECK_EQ(name, usbotghs_get_context()->out_eps[TEST_EP].fifo_idx, sizes[s]);
+        }
+    }
+}
+
+/*
+ * usbotghs_rxfifo_discard(): a dropped packet is popped from the Core RxFIFO,
+ * the packet queued behind it being kept
+ */
+static void test_rxfifo_discard(void)
+{
+    char name[64];
+
+    printf("%s\n", __func__);
+    for (uint8_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s) {
+        sim_reset();
+        pattern(ref, sizes[s], s);
+        sim_rx_push(ref, sizes[s]);
+        /* next packet */
+        sim_rx_push(ref, 4);
+        usbotghs_rxfifo_discard(sizes[s], TEST_EP);
+        snprintf(name, sizeof(name), "left size %u", sizes[s]);
+        CHECK_EQ(name, sim_rx_left(), 1);
+    }
+}
+
+static double bench_write(uint8_t offset, uint32_t size, uint32_t loops)
+{
+    struct timespec start, end;
+    uint8_t *src = &buf[offset];
+
+    pattern(src, size, 0);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (uint32_t i = 0; i < loops; ++i) {
+        in_ep_set(src, size);
+        usbotghs_write_epx_fifo(size, TEST_EP);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return ((end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec)) / loops;
+}
+
+static double bench_read(uint8_t offset, uint32_t size, uint32_t loops)
+{
+    struct timespec start, end;
+    uint8_t *dst = &buf[offset];
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (uint32_t i = 0; i < loops; ++i) {
+        out_ep_set(dst, size);
+        usbotghs_read_epx_fifo(size, TEST_EP);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return ((end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec)) / loops;
+}
+
+static void bench(void)
+{
+    const uint32_t loops = 100000;
+
+    printf("%s: 512 bytes packet, ns per packet (host CPU, untrapped FIFO)\n", __func__);
+    sim_reset();
+    for (uint8_t o = 0; o < sizeof(offsets); ++o) {
+        printf("  write, RAM FIFO offset %u: %.1f\n", offsets[o], bench_write(offsets[o], 512, loops));
+    }
+    for (uint8_t o = 0; o < sizeof(offsets); ++o) {
+        printf("  read, RAM FIFO offset %u: %.1f\n", offsets[o], bench_read(offsets[o], 512, loops));
+    }
+}
+
+int main(int argc, char **argv)
+{
+    if (argc > 1 && strcmp(argv[1], "bench") == 0) {
+        bench();
+        return 0;
+    }
+    if (!sim_fifo_start()) {
+        printf("FIFO windows can't be simulated on this host: skipped\n");
+        return 0;
+    }
+    test_write_core_fifo();
+    test_read_core_fifo();
+    test_rxfifo_discard();
+    sim_fifo_stop();
+    if (failures != 0) {
+        printf("FAILED: %u check(s)\n", failures);
+        return 1;
+    }
+    printf("OK\n");
+    return 0;
+}
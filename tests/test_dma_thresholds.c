@@ -0,0 +1,180 @@
+/*
+ *
+ * Copyright 2019 The wookey project team <wookey@ssi.gouv.fr>
+ *   - Ryad     Benadjila
+ *   - Arnauld  Michelizza
+ *   - Mathieu  Renard
+ *   - Philippe Thierry
+ *   - Philippe Trebuchet
+ *
+ * This package is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * the Free Software Foundation; either version 3 of the License, or (at
+ * ur option) any later version.
+ *
+ * This package is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this package; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ */
+
+/*
+ * Host test of the DMA thresholds configuration (DMA build), on the simulated
+ * core (see sim_core.h): the thresholds are kept until the device mode
+ * initialization, then programmed to DTHRCTL at once, out of range lengths
+ * are refused without changing the configuration nor DTHRCTL.
+ *
+ * Which thresholds give the best throughput depends on the AHB load and the
+ * host polling, it can only be measured on target.
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include "libc/types.h"
+#include "api/libusbotghs.h"
+#include "usbotghs.h"
+#include "usbotghs_init.h"
+#include "sim_core.h"
+
+static unsigned int failures = 0;
+
+#define CHECK_EQ(name, val, expected) do { \
+    if ((uint32_t)(val) != (uint32_t)(expected)) { \
+        printf("  %s: %u, expected %u\n", name, (unsigned int)(val), (unsigned int)(expected)); \
+        failures++; \
+    } \
+} while (0)
+
+/* check the DTHRCTL fields against cfg */
+static void check_dthrctl(const usbotghs_dma_thr_cfg_t *cfg)
+{
+    CHECK_EQ("RXTHRLEN", get_reg(r_CORTEX_M_USBOTG_HS_DTHRCTL, USBOTG_HS_DTHRCTL_RXTHRLEN), cfg->rx_thr_len);
+    CHECK_EQ("TXTHRLEN", get_reg(r_CORTEX_M_USBOTG_HS_DTHRCTL, USBOTG_HS_DTHRCTL_TXTHRLEN), cfg->tx_thr_len);
+    CHECK_EQ("RXTHREN", get_reg(r_CORTEX_M_USBOTG_HS_DTHRCTL, USBOTG_HS_DTHRCTL_RXTHREN), cfg->rx_thr);
+    CHECK_EQ("NONISOTHREN", get_reg(r_CORTEX_M_USBOTG_HS_DTHRCTL, USBOTG_HS_DTHRCTL_NONISOTHREN), cfg->noniso_thr);
+    CHECK_EQ("ISOTHREN", get_reg(r_CORTEX_M_USBOTG_HS_DTHRCTL, USBOTG_HS_DTHRCTL_ISOTHREN), cfg->iso_thr);
+    CHECK_EQ("ARPEN", get_reg(r_CORTEX_M_USBOTG_HS_DTHRCTL, USBOTG_HS_DTHRCTL_ARPEN), cfg->arb_parking);
+}
+
+static void check_cfg(const usbotghs_dma_thr_cfg_t *expected)
+{
+    usbotghs_dma_thr_cfg_t cfg;
+
+    memset(&cfg, 0xff, sizeof(cfg));
+    CHECK_EQ("get", usbotghs_get_dma_thresholds(&cfg), MBED_ERROR_NONE);
+    CHECK_EQ("rx_thr_len", cfg.rx_thr_len, expected->rx_thr_len);
+    CHECK_EQ("tx_thr_len", cfg.tx_thr_len, expected->tx_thr_len);
+    CHECK_EQ("rx_thr", cfg.rx_thr, expected->rx_thr);
+    CHECK_EQ("noniso_thr", cfg.noniso_thr, expected->noniso_thr);
+    CHECK_EQ("iso_thr", cfg.iso_thr, expected->iso_thr);
+    CHECK_EQ("arb_parking", cfg.arb_parking, expected->arb_parking);
+}
+
+static const usbotghs_dma_thr_cfg_t cfg_init = {
+    .rx_thr_len  = 64,
+    .tx_thr_len  = 128,
+    .rx_thr      = true,
+    .noniso_thr  = false,
+    .iso_thr     = true,
+    .arb_parking = false,
+};
+
+/* the Kconfig thresholds are used by default */
+static void test_defaults(void)
+{
+    const usbotghs_dma_thr_cfg_t dflt = {
+        .rx_thr_len  = CONFIG_USR_DEV_USBOTGHS_DMA_RX_THRESHOLD,
+        .tx_thr_len  = CONFIG_USR_DEV_USBOTGHS_DMA_TX_THRESHOLD,
+        .rx_thr      = true,
+        .noniso_thr  = true,
+        .iso_thr     = false,
+        .arb_parking = true,
+    };
+
+    printf("%s\n", __func__);
+    check_cfg(&dflt);
+    CHECK_EQ("get NULL", usbotghs_get_dma_thresholds(NULL), MBED_ERROR_INVPARAM);
+}
+
+/* set before the device mode initialization, programmed by it */
+static void test_before_init(void)
+{
+    printf("%s\n", __func__);
+    sim_reset();
+    CHECK_EQ("set", usbotghs_set_dma_thresholds(&cfg_init), MBED_ERROR_NONE);
+    CHECK_EQ("DTHRCTL untouched", read_reg_value(r_CORTEX_M_USBOTG_HS_DTHRCTL), 0);
+    check_cfg(&cfg_init);
+
+    CHECK_EQ("init", usbotghs_initialize_device(), MBED_ERROR_NONE);
+    check_dthrctl(&cfg_init);
+}
+
+/* once the device is initialized, set at once, lengths bounds included */
+static void test_after_init(void)
+{
+    usbotghs_dma_thr_cfg_t cfg = {
+        .rx_thr_len  = USBOTGHS_DMA_THR_LEN_MIN,
+        .tx_thr_len  = USBOTGHS_DMA_THR_LEN_MAX,
+        .rx_thr      = false,
+        .noniso_thr  = true,
+        .iso_thr     = false,
+        .arb_parking = true,
+    };
+
+    printf("%s\n", __func__);
+    CHECK_EQ("set min/max", usbotghs_set_dma_thresholds(&cfg), MBED_ERROR_NONE);
+    check_dthrctl(&cfg);
+    check_cfg(&cfg);
+
+    cfg.rx_thr_len = USBOTGHS_DMA_THR_LEN_MAX;
+    cfg.tx_thr_len = USBOTGHS_DMA_THR_LEN_MIN;
+    CHECK_EQ("set max/min", usbotghs_set_dma_thresholds(&cfg), MBED_ERROR_NONE);
+    check_dthrctl(&cfg);
+    check_cfg(&cfg);
+}
+
+/* out of range lengths are refused, nothing is changed */
+static void test_invalid(void)
+{
+    const uint16_t bad[] = { 0, USBOTGHS_DMA_THR_LEN_MIN - 1, USBOTGHS_DMA_THR_LEN_MAX + 1, 0xffff };
+    usbotghs_dma_thr_cfg_t cur;
+    usbotghs_dma_thr_cfg_t cfg;
+    uint32_t dthrctl;
+    char name[32];
+
+    printf("%s\n", __func__);
+    CHECK_EQ("get", usbotghs_get_dma_thresholds(&cur), MBED_ERROR_NONE);
+    dthrctl = read_reg_value(r_CORTEX_M_USBOTG_HS_DTHRCTL);
+    CHECK_EQ("set NULL", usbotghs_set_dma_thresholds(NULL), MBED_ERROR_INVPARAM);
+    for (uint8_t i = 0; i < sizeof(bad) / sizeof(bad[0]); ++i) {
+        cfg = cfg_init;
+        cfg.rx_thr_len = bad[i];
+        snprintf(name, sizeof(name), "rx len %u", bad[i]);
+        CHECK_EQ(name, usbotghs_set_dma_thresholds(&cfg), MBED_ERROR_INVPARAM);
+        cfg = cfg_init;
+        cfg.tx_thr_len = bad[i];
+        snprintf(name, sizeof(name), "tx len %u", bad[i]);
+        CHECK_EQ(name, usbotghs_set_dma_thresholds(&cfg), MBED_ERROR_INVPARAM);
+    }
+    CHECK_EQ("DTHRCTL kept", read_reg_value(r_CORTEX_M_USBOTG_HS_DTHRCTL), dthrctl);
+    check_cfg(&cur);
+}
+
+int main(void)
+{
+    /* the device mode initialization can't be undone: keep this order */
+    test_defaults();
+    test_before_init();
+    test_after_init();
+    test_invalid();
+    if (failures != 0) {
+        printf("FAILED: %u check(s)\n", failures);
+        return 1;
+    }
+    printf("OK\n");
+    return 0;
+}
@@ -0,0 +1,186 @@
+/*
+ *
+ * Copyright 2019 The wookey project team <wookey@ssi.gouv.fr>
+ *   - Ryad     Benadjila
+ *   - Arnauld  Michelizza
+ *   - Mathieu  Renard
+ *   - Philippe Thierry
+ *   - Philippe Trebuchet
+ *
+ * This package is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * the Free Software Foundation; either version 3 of the License, or (at
+ * ur option) any later version.
+ *
+ * This package is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this package; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ */
+
+/*
+ * Host test of the Core FIFO RAM planner (usbotghs_fifo_plan()), on the EP
+ * sets of the usual Wookey USB functions.
+ *
+ * All sizes are in 32bits words. The Core FIFO RAM is 1024 words long, and
+ * EP0 TxFIFO is always 32 words (127 bytes transfers), at its top.
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include "libc/types.h"
+#include "api/libusbotghs.h"
+#include "usbotghs.h"
+#include "usbotghs_fifos.h"
+
+#define EP0_TX_DEPTH  32
+#define EP0_TX_START  (1024 - EP0_TX_DEPTH)
+
+static usbotghs_context_t ctx;
+static unsigned int failures = 0;
+
+#define CHECK_EQ(name, val, expected) do { \
+    if ((uint32_t)(val) != (uint32_t)(expected)) { \
+        printf("  %s: %u, expected %u\n", name, (unsigned int)(val), (unsigned int)(expected)); \
+        failures++; \
+    } \
+} while (0)
+
+/* driver functions used by the planner */
+usbotghs_context_t *usbotghs_get_context(void)
+{
+    return &ctx;
+}
+
+uint16_t usbotghs_get_ep_mpsize(usbotghs_ep_type_t type)
+{
+    (void)type;
+    /* high speed control EP */
+    return 64;
+}
+
+static void eps_reset(void)
+{
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.out_eps[0].mpsize = 64;
+    ctx.in_eps[0].mpsize = 64;
+}
+
+static void ep_set(usbotghs_ep_t *eps, uint8_t id, usbotghs_ep_type_t type, uint16_t mpsize)
+{
+    eps[id].id = id;
+    eps[id].configured = true;
+    eps[id].type = type;
+    eps[id].mpsize = mpsize;
+}
+
+static void check_layout(const usbotghs_fifo_layout_t *layout,
+                         uint16_t rx_depth, const uint16_t *tx_depth, uint16_t used)
+{
+    char name[32];
+    uint16_t start = rx_depth;
+
+    CHECK_EQ("rx_depth", layout->rx_depth, rx_depth);
+    CHECK_EQ("tx_start[0]", layout->tx_start[0], EP0_TX_START);
+    CHECK_EQ("tx_depth[0]", layout->tx_depth[0], EP0_TX_DEPTH);
+    /* other TxFIFOs follow the RxFIFO, in EP order */
+    for (uint8_t i = 1; i < USBOTGHS_MAX_IN_EP; ++i) {
+        snprintf(name, sizeof(name), "tx_start[%u]", i);
+        CHECK_EQ(name, layout->tx_start[i], start);
+        snprintf(name, sizeof(name), "tx_depth[%u]", i);
+        CHECK_EQ(name, layout->tx_depth[i], tx_depth[i]);
+        start += tx_depth[i];
+    }
+    CHECK_EQ("used", layout->used, used);
+    CHECK_EQ("overlap with EP0", start <= EP0_TX_START, true);
+}
+
+/*
+ * DFU: EP0 only, not yet configured (its mpsize is the default one)
+ * RxFIFO: (5 + 8) + 2 * (16 + 1) + 2 + 1 = 50
+ */
+static void test_dfu(void)
+{
+    usbotghs_fifo_layout_t layout;
+    const uint16_t tx_depth[USBOTGHS_MAX_IN_EP] = { EP0_TX_DEPTH, 0, 0, 0, 0, 0 };
+
+    printf("%s\n", __func__);
+    eps_reset();
+    ctx.out_eps[0].mpsize = 0;
+    CHECK_EQ("usbotghs_fifo_plan", usbotghs_fifo_plan(ctx.in_eps, ctx.out_eps, &layout), MBED_ERROR_NONE);
+    check_layout(&layout, 50, tx_depth, 50 + EP0_TX_DEPTH);
+}
+
+/*
+ * Mass storage: bulk IN EP1, bulk OUT EP2, 512 bytes packets
+ * RxFIFO: (5 + 8) + 2 * (128 + 1) + 4 + 1 = 276
+ * EP1 TxFIFO: 4 packets of 128 words
+ */
+static void test_mass_storage(void)
+{
+    usbotghs_fifo_layout_t layout;
+    const uint16_t tx_depth[USBOTGHS_MAX_IN_EP] = { EP0_TX_DEPTH, 512, 0, 0, 0, 0 };
+
+    printf("%s\n", __func__);
+    eps_reset();
+    ep_set(ctx.in_eps, 1, USBOTG_HS_EP_TYPE_BULK, 512);
+    ep_set(ctx.out_eps, 2, USBOTG_HS_EP_TYPE_BULK, 512);
+    CHECK_EQ("usbotghs_fifo_plan", usbotghs_fifo_plan(ctx.in_eps, ctx.out_eps, &layout), MBED_ERROR_NONE);
+    check_layout(&layout, 276, tx_depth, 276 + EP0_TX_DEPTH + 512);
+}
+
+/*
+ * CDC + HID: CDC notification (interrupt IN EP1, 16 bytes), CDC data (bulk IN
+ * and OUT EP2, 512 bytes), HID reports (interrupt IN and OUT EP3, 64 bytes)
+ * RxFIFO: (5 + 8) + 2 * (128 + 1) + 6 + 1 = 278
+ * EP1 and EP3 TxFIFOs: one packet, at least 16 words. EP2 TxFIFO: 4 packets
+ */
+static void test_cdc_hid(void)
+{
+    usbotghs_fifo_layout_t layout;
+    const uint16_t tx_depth[USBOTGHS_MAX_IN_EP] = { EP0_TX_DEPTH, 16, 512, 16, 0, 0 };
+
+    printf("%s\n", __func__);
+    eps_reset();
+    ep_set(ctx.in_eps, 1, USBOTG_HS_EP_TYPE_INT, 16);
+    ep_set(ctx.in_eps, 2, USBOTG_HS_EP_TYPE_BULK, 512);
+    ep_set(ctx.out_eps, 2, USBOTG_HS_EP_TYPE_BULK, 512);
+    ep_set(ctx.in_eps, 3, USBOTG_HS_EP_TYPE_INT, 64);
+    ep_set(ctx.out_eps, 3, USBOTG_HS_EP_TYPE_INT, 64);
+    CHECK_EQ("usbotghs_fifo_plan", usbotghs_fifo_plan(ctx.in_eps, ctx.out_eps, &layout), MBED_ERROR_NONE);
+    check_layout(&layout, 278, tx_depth, 278 + EP0_TX_DEPTH + 16 + 512 + 16);
+}
+
+/*
+ * Five isochronous IN EPs of 1024 bytes packets: 5 * 256 words, which don't
+ * fit in the Core FIFO RAM with the RxFIFO and EP0 TxFIFO
+ */
+static void test_overflow(void)
+{
+    usbotghs_fifo_layout_t layout;
+
+    printf("%s\n", __func__);
+    eps_reset();
+    for (uint8_t i = 1; i < USBOTGHS_MAX_IN_EP; ++i) {
+        ep_set(ctx.in_eps, i, USBOTG_HS_EP_TYPE_ISOCHRONOUS, 1024);
+    }
+    CHECK_EQ("usbotghs_fifo_plan", usbotghs_fifo_plan(ctx.in_eps, ctx.out_eps, &layout), MBED_ERROR_NOSTORAGE);
+}
+
+int main(void)
+{
+    test_dfu();
+    test_mass_storage();
+    test_cdc_hid();
+    test_overflow();
+    if (failures != 0) {
+        printf("FAILED: %u check(s)\n", failures);
+        return 1;
+    }
+    printf("OK\n");
+    return 0;
+}
@@ -0,0 +1,230 @@
+/*
+ *
+ * Copyright 2019 The wookey project team <wookey@ssi.gouv.fr>
+ *   - Ryad     Benadjila
+ *   - Arnauld  Michelizza
+ *   - Mathieu  Renard
+ *   - Philippe Thierry
+ *   - Philippe Trebuchet
+ *
+ * This package is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * the Free Software Foundation; either version 3 of the License, or (at
+ * ur option) any later version.
+ *
+ * This package is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this package; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ */
+
+/*
+ * Host test of the interrupt dispatch order of USBOTGHS_IRQHandler(), on the
+ * simulated core (see sim_core.h). Built twice: with
+ * CONFIG_USR_DEV_USBOTGHS_IRQ_DATA_FIRST, the pending data path events
+ * (RXFLVL, OEPINT, IEPINT) are serviced first, without it, the pending events
+ * are serviced by increasing GINTSTS bit. Masked events are never serviced.
+ *
+ * The ISR entry to handler latency depends on the core clock and the flash
+ * wait states, it can only be measured on target.
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include "libc/types.h"
+#include "api/libusbotghs.h"
+#include "usbotghs.h"
+#include "usbotghs_fifos.h"
+#include "usbotghs_handler.h"
+#include "sim_core.h"
+
+#define TEST_EP        1
+#define TEST_MPSIZE    64
+
+static unsigned int failures = 0;
+
+#define CHECK_EQ(name, val, expected) do { \
+    if ((uint32_t)(val) != (uint32_t)(expected)) { \
+        printf("  %s: %u, expected %u\n", name, (unsigned int)(val), (unsigned int)(expected)); \
+        failures++; \
+    } \
+} while (0)
+
+#define CHECK_EVENTS(expected) do { \
+    if (strcmp(sim_events(), expected) != 0) { \
+        printf("  events: \"%s\", expected \"%s\"\n", sim_events(), expected); \
+        failures++; \
+    } \
+} while (0)
+
+static uint8_t in_buf[TEST_MPSIZE];
+static uint8_t out_buf[TEST_MPSIZE];
+static uint32_t out_size = 0;
+
+static mbed_error_t out_handler(uint32_t dev_id, uint32_t size, uint8_t ep)
+{
+    (void)dev_id;
+    (void)ep;
+    out_size = size;
+    sim_event("out");
+    return MBED_ERROR_NONE;
+}
+
+static mbed_error_t in_handler(uint32_t dev_id, uint32_t size, uint8_t ep)
+{
+    (void)dev_id;
+    (void)size;
+    (void)ep;
+    sim_event("in");
+    return MBED_ERROR_NONE;
+}
+
+/* a 10 bytes IN transfer is in progress, and a RAM FIFO is set on OUT */
+static void setup(void)
+{
+    usbotghs_context_t *ctx = usbotghs_get_context();
+    usbotghs_ep_t *ep;
+
+    sim_reset();
+    usbotghs_xmit_queue_flush(TEST_EP);
+    ep = &ctx->in_eps[TEST_EP];
+    memset(ep, 0, sizeof(*ep));
+    ep->id = TEST_EP;
+    ep->configured = true;
+    ep->mpsize = TEST_MPSIZE;
+    ep->type = USBOTG_HS_EP_TYPE_BULK;
+    ep->handler = in_handler;
+    ep->fifo_owner = USBOTG_HS_FIFO_DRIVER_OWNED;
+    ep = &ctx->out_eps[TEST_EP];
+    memset(ep, 0, sizeof(*ep));
+    ep->id = TEST_EP;
+    ep->configured = true;
+    ep->mpsize = TEST_MPSIZE;
+    ep->type = USBOTG_HS_EP_TYPE_BULK;
+    ep->handler = out_handler;
+    ep->fifo_owner = USBOTG_HS_FIFO_DRIVER_OWNED;
+    write_reg_value(r_CORTEX_M_USBOTG_HS_DTXFSTS(TEST_EP), 0xffff);
+    write_reg_value(r_CORTEX_M_USBOTG_HS_DAINTMSK,
+                    USBOTG_HS_DAINTMSK_IEPM(TEST_EP) | USBOTG_HS_DAINT_OEPINT(TEST_EP));
+    CHECK_EQ("send", usbotghs_send_data(in_buf, 10, TEST_EP), MBED_ERROR_NONE);
+    CHECK_EQ("recv", usbotghs_set_recv_fifo(out_buf, sizeof(out_buf), TEST_EP), MBED_ERROR_NONE);
+    out_size = 0;
+}
+
+/*
+ * the core rises the sr events at once, the IN and OUT transfers being
+ * completed. Only the dr ones are unmasked.
+ */
+static void irq(uint32_t sr, uint32_t dr)
+{
+    write_reg_value(r_CORTEX_M_USBOTG_HS_DOEPCTL(TEST_EP), 0);
+    write_reg_value(r_CORTEX_M_USBOTG_HS_DAINT,
+                    USBOTG_HS_DAINTMSK_IEPM(TEST_EP) | USBOTG_HS_DAINT_OEPINT(TEST_EP));
+    write_reg_value(r_CORTEX_M_USBOTG_HS_DIEPINT(TEST_EP), USBOTG_HS_DIEPINT_XFRC_Msk);
+    write_reg_value(r_CORTEX_M_USBOTG_HS_DOEPINT(TEST_EP), USBOTG_HS_DOEPINT_XFRC_Msk);
+    USBOTGHS_IRQHandler(0, sr, dr);
+    write_reg_value(r_CORTEX_M_USBOTG_HS_DIEPINT(TEST_EP), 0);
+    write_reg_value(r_CORTEX_M_USBOTG_HS_DOEPINT(TEST_EP), 0);
+    write_reg_value(r_CORTEX_M_USBOTG_HS_DAINT, 0);
+}
+
+/* data and suspend events pending together */
+static void test_suspend(void)
+{
+    const uint32_t sr = USBOTG_HS_GINTSTS_ESUSP_Msk | USBOTG_HS_GINTSTS_USBSUSP_Msk |
+                        USBOTG_HS_GINTSTS_IEPINT_Msk | USBOTG_HS_GINTSTS_OEPINT_Msk;
+
+    printf("%s\n", __func__);
+    setup();
+    irq(sr, sr);
+#if CONFIG_USR_DEV_USBOTGHS_IRQ_DATA_FIRST
+    CHECK_EVENTS("out in earlysuspend usbsuspend ");
+#else
+    CHECK_EVENTS("earlysuspend usbsuspend in out ");
+#endif
+}
+
+/* a wakeup (highest GINTSTS bit) is serviced last in both orders */
+static void test_wakeup(void)
+{
+    const uint32_t sr = USBOTG_HS_GINTSTS_WKUPINT_Msk | USBOTG_HS_GINTSTS_USBSUSP_Msk |
+                        USBOTG_HS_GINTSTS_OEPINT_Msk;
+
+    printf("%s\n", __func__);
+    setup();
+    irq(sr, sr);
+#if CONFIG_USR_DEV_USBOTGHS_IRQ_DATA_FIRST
+    CHECK_EVENTS("out usbsuspend wakeup ");
+#else
+    CHECK_EVENTS("usbsuspend out wakeup ");
+#endif
+}
+
+/* pending but masked events are not serviced, whatever their kind */
+static void test_masked(void)
+{
+    const uint32_t sr = USBOTG_HS_GINTSTS_ESUSP_Msk | USBOTG_HS_GINTSTS_USBSUSP_Msk |
+                        USBOTG_HS_GINTSTS_IEPINT_Msk | USBOTG_HS_GINTSTS_OEPINT_Msk;
+
+    printf("%s\n", __func__);
+    setup();
+    irq(sr, USBOTG_HS_GINTSTS_USBSUSP_Msk | USBOTG_HS_GINTSTS_OEPINT_Msk);
+#if CONFIG_USR_DEV_USBOTGHS_IRQ_DATA_FIRST
+    CHECK_EVENTS("out usbsuspend ");
+#else
+    CHECK_EVENTS("usbsuspend out ");
+#endif
+    CHECK_EQ("IN still in progress", usbotghs_get_context()->in_eps[TEST_EP].state, USBOTG_HS_EP_STATE_DATA_IN);
+}
+
+/*
+ * a packet and the transfer completion pending together: in both orders,
+ * the RxFIFO is drained before the OUT transfer is completed
+ */
+static void test_rx_before_xfrc(void)
+{
+    const uint32_t sr = USBOTG_HS_GINTSTS_RXFLVL_Msk | USBOTG_HS_GINTSTS_ESUSP_Msk |
+                        USBOTG_HS_GINTSTS_OEPINT_Msk;
+    uint8_t pkt[10];
+
+    printf("%s\n", __func__);
+    setup();
+    for (uint8_t i = 0; i < sizeof(pkt); ++i) {
+        pkt[i] = (uint8_t)(0x30 + i);
+    }
+    sim_rx_push(pkt, sizeof(pkt));
+    write_reg_value(r_CORTEX_M_USBOTG_HS_GRXSTSP,
+                    (PKT_STATUS_OUT_DATA_PKT_RECV << 17) | (sizeof(pkt) << 4) | TEST_EP);
+    irq(sr, sr);
+#if CONFIG_USR_DEV_USBOTGHS_IRQ_DATA_FIRST
+    CHECK_EVENTS("out earlysuspend ");
+#else
+    CHECK_EVENTS("earlysuspend out ");
+#endif
+    CHECK_EQ("received", out_size, sizeof(pkt));
+    CHECK_EQ("data", memcmp(out_buf, pkt, sizeof(pkt)), 0);
+    CHECK_EQ("RxFIFO drained", sim_rx_left(), 0);
+}
+
+int main(void)
+{
+    test_suspend();
+    test_wakeup();
+    test_masked();
+    if (sim_fifo_start()) {
+        test_rx_before_xfrc();
+        sim_fifo_stop();
+    } else {
+        printf("FIFO windows can't be simulated on this host: RxFIFO test skipped\n");
+    }
+    if (failures != 0) {
+        printf("FAILED: %u check(s)\n", failures);
+        return 1;
+    }
+    printf("OK\n");
+    return 0;
+}
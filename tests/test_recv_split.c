@@ -0,0 +1,270 @@
+/*
+ *
+ * Copyright 2019 The wookey project team <wookey@ssi.gouv.fr>
+ *   - Ryad     Benadjila
+ *   - Arnauld  Michelizza
+ *   - Mathieu  Renard
+ *   - Philippe Thierry
+ *   - Philippe Trebuchet
+ *
+ * This package is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * the Free Software Foundation; either version 3 of the License, or (at
+ * ur option) any later version.
+ *
+ * This package is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this package; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ */
+
+/*
+ * Host test of the header/payload split receive, on the simulated core (see
+ * sim_core.h): the Core RxFIFO word straddling the header end is split between
+ * the two RAM FIFOs, and the upper layer is handed the header as soon as it
+ * is received, the EP being re-armed on the payload first when a short packet
+ * ends the transfer within the header.
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include "libc/types.h"
+#include "api/libusbotghs.h"
+#include "usbotghs.h"
+#include "usbotghs_fifos.h"
+#include "usbotghs_handler.h"
+#include "sim_core.h"
+
+#define TEST_EP         1
+#define TEST_MPSIZE     512
+#define TEST_HDR_SZ     TEST_MPSIZE
+#define TEST_PAYLOAD_SZ 1024
+
+static unsigned int failures = 0;
+
+#define CHECK_EQ(name, val, expected) do { \
+    if ((uint32_t)(val) != (uint32_t)(expected)) { \
+        printf("  %s: %u, expected %u\n", name, (unsigned int)(val), (unsigned int)(expected)); \
+        failures++; \
+    } \
+} while (0)
+
+#define GUARD   0xa5
+
+static uint8_t hdr[TEST_HDR_SZ + 4];
+static uint8_t payload[TEST_PAYLOAD_SZ + 4];
+static uint8_t ref[TEST_HDR_SZ + TEST_PAYLOAD_SZ];
+
+/* upper layer OUT completions, and the EP state at each of them */
+static uint32_t done[8];
+static uint32_t done_doepctl[8];
+static uint8_t *done_fifo[8];
+static uint8_t done_cnt = 0;
+
+static mbed_error_t out_handler(uint32_t dev_id, uint32_t size, uint8_t ep)
+{
+    (void)dev_id;
+    if (done_cnt < sizeof(done) / sizeof(done[0])) {
+        done[done_cnt] = size;
+        done_doepctl[done_cnt] = read_reg_value(r_CORTEX_M_USBOTG_HS_DOEPCTL(ep));
+        done_fifo[done_cnt] = usbotghs_get_context()->out_eps[ep].fifo;
+        done_cnt++;
+    }
+    return MBED_ERROR_NONE;
+}
+
+static usbotghs_ep_t *out_ep(void)
+{
+    return &(usbotghs_get_context()->out_eps[TEST_EP]);
+}
+
+static void setup(uint32_t hdr_size, uint32_t payload_size)
+{
+    usbotghs_ep_t *ep = out_ep();
+
+    sim_reset();
+    memset(ep, 0, sizeof(*ep));
+    ep->id = TEST_EP;
+    ep->configured = true;
+    ep->mpsize = TEST_MPSIZE;
+    ep->type = USBOTG_HS_EP_TYPE_BULK;
+    ep->handler = out_handler;
+    ep->fifo_owner = USBOTG_HS_FIFO_DRIVER_OWNED;
+    memset(hdr, GUARD, sizeof(hdr));
+    memset(payload, GUARD, sizeof(payload));
+    for (uint32_t i = 0; i < sizeof(ref); ++i) {
+        ref[i] = (uint8_t)(3 + 11 * i + (i >> 8));
+    }
+    done_cnt = 0;
+    CHECK_EQ("set split", usbotghs_set_recv_fifo_split(hdr, hdr_size, payload, payload_size, TEST_EP), MBED_ERROR_NONE);
+}
+
+/* the core received a packet of size bytes (data from ref + offset) */
+static void rxflvl(uint32_t offset, uint32_t size)
+{
+    sim_rx_push(&ref[offset], size);
+    write_reg_value(r_CORTEX_M_USBOTG_HS_GRXSTSP,
+                    (PKT_STATUS_OUT_DATA_PKT_RECV << 17) | (size << 4) | TEST_EP);
+    USBOTGHS_IRQHandler(0, USBOTG_HS_GINTSTS_RXFLVL_Msk, USBOTG_HS_GINTSTS_RXFLVL_Msk);
+}
+
+/* the core completes the current OUT transfer, and disables the EP */
+static void out_xfrc(void)
+{
+    write_reg_value(r_CORTEX_M_USBOTG_HS_DOEPCTL(TEST_EP), 0);
+    write_reg_value(r_CORTEX_M_USBOTG_HS_DAINT, USBOTG_HS_DAINT_OEPINT(TEST_EP));
+    write_reg_value(r_CORTEX_M_USBOTG_HS_DOEPINT(TEST_EP), USBOTG_HS_DOEPINT_XFRC_Msk);
+    USBOTGHS_IRQHandler(0, USBOTG_HS_GINTSTS_OEPINT_Msk, USBOTG_HS_GINTSTS_OEPINT_Msk);
+    write_reg_value(r_CORTEX_M_USBOTG_HS_DOEPINT(TEST_EP), 0);
+    write_reg_value(r_CORTEX_M_USBOTG_HS_DAINT, 0);
+}
+
+/*
+ * usbotghs_read_core_fifo_split() through usbotghs_read_epx_fifo(): whatever
+ * the header size, the Core FIFO word holding the header end is split between
+ * the two RAM FIFOs, and no byte is written past the header
+ */
+static void test_straddle(void)
+{
+    const uint32_t sizes[] = { 1, 2, 3, 4, 5, 7, 8, 9, 31 };
+    char name[64];
+
+    printf("%s\n", __func__);
+    for (uint8_t h = 0; h < sizeof(sizes) / sizeof(sizes[0]); ++h) {
+        for (uint32_t len = 1; len <= sizes[h] + 9; ++len) {
+            setup(sizes[h], TEST_PAYLOAD_SZ);
+            sim_rx_push(ref, len);
+            snprintf(name, sizeof(name), "read hdr %u len %u", sizes[h], len);
+            CHECK_EQ(name, usbotghs_read_epx_fifo(len, TEST_EP), MBED_ERROR_NONE);
+            snprintf(name, sizeof(name), "hdr %u len %u", sizes[h], len);
+            CHECK_EQ(name, memcmp(hdr, ref, len < sizes[h] ? len : sizes[h]), 0);
+            snprintf(name, sizeof(name), "hdr guard %u len %u", sizes[h], len);
+            CHECK_EQ(name, hdr[len < sizes[h] ? len : sizes[h]], GUARD);
+            if (len > sizes[h]) {
+                snprintf(name, sizeof(name), "payload hdr %u len %u", sizes[h], len);
+                CHECK_EQ(name, memcmp(payload, &ref[sizes[h]], len - sizes[h]), 0);
+            }
+            snprintf(name, sizeof(name), "payload guard hdr %u len %u", sizes[h], len);
+            CHECK_EQ(name, payload[len > sizes[h] ? len - sizes[h] : 0], GUARD);
+            snprintf(name, sizeof(name), "left hdr %u len %u", sizes[h], len);
+            CHECK_EQ(name, sim_rx_left(), 0);
+            CHECK_EQ(name, sim_rx_underflows(), 0);
+        }
+    }
+}
+
+/* the header end is reached on the second packet, the payload goes on after it */
+static void test_straddle_packets(void)
+{
+    printf("%s\n", __func__);
+    setup(13, TEST_PAYLOAD_SZ);
+    sim_rx_push(ref, 8);
+    CHECK_EQ("read 0", usbotghs_read_epx_fifo(8, TEST_EP), MBED_ERROR_NONE);
+    sim_rx_push(&ref[8], 10);
+    CHECK_EQ("read 1", usbotghs_read_epx_fifo(10, TEST_EP), MBED_ERROR_NONE);
+    sim_rx_push(&ref[18], 7);
+    CHECK_EQ("read 2", usbotghs_read_epx_fifo(7, TEST_EP), MBED_ERROR_NONE);
+    CHECK_EQ("hdr", memcmp(hdr, ref, 13), 0);
+    CHECK_EQ("hdr guard", hdr[13], GUARD);
+    CHECK_EQ("payload", memcmp(payload, &ref[13], 12), 0);
+    CHECK_EQ("payload guard", payload[12], GUARD);
+    CHECK_EQ("left", sim_rx_left(), 0);
+}
+
+/*
+ * a command block sent on its own: the short packet ends the transfer on the
+ * header, the EP is re-armed on the payload before the header is handed
+ */
+static void test_short_hdr(void)
+{
+    printf("%s\n", __func__);
+    setup(31, TEST_PAYLOAD_SZ);
+    rxflvl(0, 31);
+    CHECK_EQ("no completion on reception", done_cnt, 0);
+    out_xfrc();
+    CHECK_EQ("hdr completion", done_cnt, 1);
+    CHECK_EQ("hdr size", done[0], 31);
+    CHECK_EQ("re-armed before completion", done_doepctl[0] & (USBOTG_HS_DOEPCTL_CNAK_Msk | USBOTG_HS_DOEPCTL_EPENA_Msk),
+             USBOTG_HS_DOEPCTL_CNAK_Msk | USBOTG_HS_DOEPCTL_EPENA_Msk);
+    CHECK_EQ("armed on payload", done_fifo[0] == payload, true);
+    CHECK_EQ("payload xfrsiz", get_reg_value(r_CORTEX_M_USBOTG_HS_DOEPTSIZ(TEST_EP),
+                                             USBOTG_HS_DOEPTSIZ_XFRSIZ_Msk(TEST_EP),
+                                             USBOTG_HS_DOEPTSIZ_XFRSIZ_Pos(TEST_EP)), TEST_PAYLOAD_SZ);
+    CHECK_EQ("hdr", memcmp(hdr, ref, 31), 0);
+
+    /* data stage */
+    rxflvl(31, TEST_MPSIZE);
+    rxflvl(31 + TEST_MPSIZE, 100);
+    CHECK_EQ("no completion before XFRC", done_cnt, 1);
+    out_xfrc();
+    CHECK_EQ("payload completion", done_cnt, 2);
+    CHECK_EQ("payload size", done[1], TEST_MPSIZE + 100);
+    CHECK_EQ("payload", memcmp(payload, &ref[31], TEST_MPSIZE + 100), 0);
+}
+
+/* a short packet ending within the header: the received part is handed */
+static void test_truncated_hdr(void)
+{
+    printf("%s\n", __func__);
+    setup(31, TEST_PAYLOAD_SZ);
+    rxflvl(0, 20);
+    out_xfrc();
+    CHECK_EQ("hdr completion", done_cnt, 1);
+    CHECK_EQ("hdr size", done[0], 20);
+    CHECK_EQ("armed on payload", done_fifo[0] == payload, true);
+}
+
+/* the header ends on a full packet: handed on reception, the transfer goes on */
+static void test_full_pkt_hdr(void)
+{
+    printf("%s\n", __func__);
+    setup(TEST_HDR_SZ, TEST_PAYLOAD_SZ);
+    rxflvl(0, TEST_MPSIZE);
+    CHECK_EQ("hdr completion", done_cnt, 1);
+    CHECK_EQ("hdr size", done[0], TEST_MPSIZE);
+    CHECK_EQ("not re-armed", done_fifo[0] == hdr, true);
+    rxflvl(TEST_MPSIZE, 40);
+    out_xfrc();
+    CHECK_EQ("payload completion", done_cnt, 2);
+    CHECK_EQ("payload size", done[1], 40);
+    CHECK_EQ("payload", memcmp(payload, &ref[TEST_MPSIZE], 40), 0);
+}
+
+/* a short packet holding the header and the begining of the payload */
+static void test_short_pkt_crossing(void)
+{
+    printf("%s\n", __func__);
+    setup(31, TEST_PAYLOAD_SZ);
+    rxflvl(0, 40);
+    CHECK_EQ("hdr completion", done_cnt, 1);
+    CHECK_EQ("hdr size", done[0], 31);
+    out_xfrc();
+    CHECK_EQ("payload completion", done_cnt, 2);
+    CHECK_EQ("payload size", done[1], 9);
+    CHECK_EQ("payload", memcmp(payload, &ref[31], 9), 0);
+}
+
+int main(void)
+{
+    if (!sim_fifo_start()) {
+        printf("FIFO windows can't be simulated on this host: skipped\n");
+        return 0;
+    }
+    test_straddle();
+    test_straddle_packets();
+    test_short_hdr();
+    test_truncated_hdr();
+    test_full_pkt_hdr();
+    test_short_pkt_crossing();
+    sim_fifo_stop();
+    if (failures != 0) {
+        printf("FAILED: %u check(s)\n", failures);
+        return 1;
+    }
+    printf("OK\n");
+    return 0;
+}
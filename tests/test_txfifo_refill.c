@@ -0,0 +1,181 @@
+/*
+ *
+ * Copyright 2019 The wookey project team <wookey@ssi.gouv.fr>
+ *   - Ryad     Benadjila
+ *   - Arnauld  Michelizza
+ *   - Mathieu  Renard
+ *   - Philippe Thierry
+ *   - Philippe Trebuchet
+ *
+ * This package is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * the Free Software Foundation; either version 3 of the License, or (at
+ * ur option) any later version.
+ *
+ * This package is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this package; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ */
+
+/*
+ * Host test of the Core TxFIFO refill on TXFE events, on the simulated core
+ * (see sim_core.h). Built twice: with CONFIG_USR_DEV_USBOTGHS_TRIGER_XMIT_ON_HALF,
+ * each refill pushes at most half of the EP TxFIFO (and at least one
+ * packet), without it, as many packets as the TxFIFO free space allows.
+ *
+ * The core is modeled as sending one half of the TxFIFO between two TXFE
+ * events. The throughput gain of the half-empty refill depends on the bus
+ * and AHB timings, it can only be measured on target.
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include "libc/types.h"
+#include "api/libusbotghs.h"
+#include "usbotghs.h"
+#include "usbotghs_fifos.h"
+#include "usbotghs_handler.h"
+#include "sim_core.h"
+
+#define TEST_EP         1
+#define TEST_MPSIZE     512
+/* EP TxFIFO: 4 packets */
+#define TEST_DEPTH      (4 * TEST_MPSIZE / 4)
+
+static unsigned int failures = 0;
+
+#define CHECK_EQ(name, val, expected) do { \
+    if ((uint32_t)(val) != (uint32_t)(expected)) { \
+        printf("  %s: %u, expected %u\n", name, (unsigned int)(val), (unsigned int)(expected)); \
+        failures++; \
+    } \
+} while (0)
+
+static uint32_t buf_w[4096 / 4];
+static uint8_t * const buf = (uint8_t *)buf_w;
+static uint32_t done = 0;
+
+static mbed_error_t in_handler(uint32_t dev_id, uint32_t size, uint8_t ep)
+{
+    (void)dev_id;
+    (void)ep;
+    done = size;
+    return MBED_ERROR_NONE;
+}
+
+static void setup(void)
+{
+    usbotghs_ep_t *ep = &(usbotghs_get_context()->in_eps[TEST_EP]);
+
+    sim_reset();
+    memset(ep, 0, sizeof(*ep));
+    ep->id = TEST_EP;
+    ep->configured = true;
+    ep->mpsize = TEST_MPSIZE;
+    ep->type = USBOTG_HS_EP_TYPE_BULK;
+    ep->handler = in_handler;
+    ep->fifo_owner = USBOTG_HS_FIFO_DRIVER_OWNED;
+    set_reg(r_CORTEX_M_USBOTG_HS_DIEPTXF(TEST_EP), TEST_DEPTH, USBOTG_HS_DIEPTXF_INEPTXFD);
+    write_reg_value(r_CORTEX_M_USBOTG_HS_DTXFSTS(TEST_EP), TEST_DEPTH);
+    write_reg_value(r_CORTEX_M_USBOTG_HS_DAINTMSK, USBOTG_HS_DAINTMSK_IEPM(TEST_EP));
+    for (uint32_t i = 0; i < sizeof(buf_w); ++i) {
+        buf[i] = (uint8_t)(i * 13 + (i >> 8));
+    }
+    done = 0;
+}
+
+/* the core sent half of the TxFIFO, then rises TXFE */
+static void txfe(void)
+{
+    uint32_t avail = get_reg(r_CORTEX_M_USBOTG_HS_DTXFSTS(TEST_EP), USBOTG_HS_DTXFSTS_INEPTFSAV);
+
+    avail += TEST_DEPTH / 2;
+    if (avail > TEST_DEPTH) {
+        avail = TEST_DEPTH;
+    }
+    write_reg_value(r_CORTEX_M_USBOTG_HS_DTXFSTS(TEST_EP), avail);
+    write_reg_value(r_CORTEX_M_USBOTG_HS_DAINT, USBOTG_HS_DAINTMSK_IEPM(TEST_EP));
+    write_reg_value(r_CORTEX_M_USBOTG_HS_DIEPINT(TEST_EP), USBOTG_HS_DIEPINT_TXFE_Msk);
+    USBOTGHS_IRQHandler(0, USBOTG_HS_GINTSTS_IEPINT_Msk, USBOTG_HS_GINTSTS_IEPINT_Msk);
+    write_reg_value(r_CORTEX_M_USBOTG_HS_DIEPINT(TEST_EP), 0);
+    write_reg_value(r_CORTEX_M_USBOTG_HS_DAINT, 0);
+}
+
+/*
+ * Send size bytes, and check the words pushed at the transfer start and at
+ * each TXFE event against chunks (0 terminated), then the pushed stream.
+ */
+static void check_refill(uint32_t size, const uint32_t *chunks)
+{
+    char name[48];
+    uint32_t pushed = 0;
+    uint8_t n = 0;
+
+    CHECK_EQ("send", usbotghs_send_data(buf, size, TEST_EP), MBED_ERROR_NONE);
+    for (n = 0; chunks[n] != 0; ++n) {
+        if (n > 0) {
+            snprintf(name, sizeof(name), "TXFE unmasked before chunk %u", n);
+            CHECK_EQ(name, read_reg_value(r_CORTEX_M_USBOTG_HS_DIEPEMPMSK) & USBOTG_HS_DIEPEMPMSK_INEPTXFEM(TEST_EP),
+                     USBOTG_HS_DIEPEMPMSK_INEPTXFEM(TEST_EP));
+            txfe();
+        }
+        snprintf(name, sizeof(name), "chunk %u", n);
+        CHECK_EQ(name, sim_tx_count(TEST_EP) - pushed, chunks[n]);
+        pushed = sim_tx_count(TEST_EP);
+    }
+    CHECK_EQ("pushed", pushed, (size + 3) / 4);
+    CHECK_EQ("stream", memcmp(sim_tx_words(TEST_EP), buf, size), 0);
+    CHECK_EQ("TXFE masked", read_reg_value(r_CORTEX_M_USBOTG_HS_DIEPEMPMSK) & USBOTG_HS_DIEPEMPMSK_INEPTXFEM(TEST_EP), 0);
+    CHECK_EQ("state", usbotghs_get_context()->in_eps[TEST_EP].state, USBOTG_HS_EP_STATE_DATA_IN);
+    CHECK_EQ("no completion before XFRC", done, 0);
+}
+
+/* 8 full packets */
+static void test_full_packets(void)
+{
+#ifdef CONFIG_USR_DEV_USBOTGHS_TRIGER_XMIT_ON_HALF
+    /* one half (2 packets) per refill */
+    const uint32_t chunks[] = { 256, 256, 256, 256, 0 };
+#else
+    /* the whole TxFIFO, then what the core sent */
+    const uint32_t chunks[] = { 512, 256, 256, 0 };
+#endif
+    printf("%s\n", __func__);
+    setup();
+    check_refill(8 * TEST_MPSIZE, chunks);
+}
+
+/* 5 full packets and a short one */
+static void test_short_packet(void)
+{
+#ifdef CONFIG_USR_DEV_USBOTGHS_TRIGER_XMIT_ON_HALF
+    const uint32_t chunks[] = { 256, 256, 128 + 25, 0 };
+#else
+    const uint32_t chunks[] = { 512, 128 + 25, 0 };
+#endif
+    printf("%s\n", __func__);
+    setup();
+    check_refill(5 * TEST_MPSIZE + 100, chunks);
+}
+
+int main(void)
+{
+    if (!sim_fifo_start()) {
+        printf("FIFO windows can't be simulated on this host: skipped\n");
+        return 0;
+    }
+    test_full_packets();
+    test_short_packet();
+    sim_fifo_stop();
+    if (failures != 0) {
+        printf("FAILED: %u check(s)\n", failures);
+        return 1;
+    }
+    printf("OK\n");
+    return 0;
+}
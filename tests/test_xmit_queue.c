@@ -0,0 +1,239 @@
+/*
+ *
+ * Copyright 2019 The wookey project team <wookey@ssi.gouv.fr>
+ *   - Ryad     Benadjila
+ *   - Arnauld  Michelizza
+ *   - Mathieu  Renard
+ *   - Philippe Thierry
+ *   - Philippe Trebuchet
+ *
+ * This package is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * the Free Software Foundation; either version 3 of the License, or (at
+ * ur option) any later version.
+ *
+ * This package is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this package; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ */
+
+/*
+ * Host test of the IN transfers queue of data EPs, on the simulated core
+ * (see sim_core.h): transfers requested on a busy EP are started in order on
+ * each XFRC, queued ZLPs have no upper layer completion, the queue depth is
+ * enforced, queued transfers which can't be started are completed toward
+ * the upper layer with a size of 0, and a send does not unmask an EP IN
+ * interrupt which was masked before.
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include "libc/types.h"
+#include "api/libusbotghs.h"
+#include "usbotghs.h"
+#include "usbotghs_fifos.h"
+#include "usbotghs_handler.h"
+#include "sim_core.h"
+
+#define TEST_EP        1
+#define TEST_MPSIZE    64
+
+static unsigned int failures = 0;
+
+#define CHECK_EQ(name, val, expected) do { \
+    if ((uint32_t)(val) != (uint32_t)(expected)) { \
+        printf("  %s: %u, expected %u\n", name, (unsigned int)(val), (unsigned int)(expected)); \
+        failures++; \
+    } \
+} while (0)
+
+static uint8_t data[8][256];
+
+/* upper layer IN completions */
+static uint32_t done[16];
+static uint8_t done_cnt = 0;
+
+static mbed_error_t in_handler(uint32_t dev_id, uint32_t size, uint8_t ep)
+{
+    (void)dev_id;
+    (void)ep;
+    if (done_cnt < sizeof(done) / sizeof(done[0])) {
+        done[done_cnt++] = size;
+    }
+    return MBED_ERROR_NONE;
+}
+
+static usbotghs_ep_t *in_ep(void)
+{
+    return &(usbotghs_get_context()->in_eps[TEST_EP]);
+}
+
+static void setup(void)
+{
+    usbotghs_ep_t *ep = in_ep();
+
+    sim_reset();
+    usbotghs_xmit_queue_flush(TEST_EP);
+    memset(ep, 0, sizeof(*ep));
+    ep->id = TEST_EP;
+    ep->configured = true;
+    ep->mpsize = TEST_MPSIZE;
+    ep->type = USBOTG_HS_EP_TYPE_BULK;
+    ep->handler = in_handler;
+    ep->fifo_owner = USBOTG_HS_FIFO_DRIVER_OWNED;
+    /* room for any transfer in the Core TxFIFO, EP IN interrupt unmasked */
+    write_reg_value(r_CORTEX_M_USBOTG_HS_DTXFSTS(TEST_EP), 0xffff);
+    write_reg_value(r_CORTEX_M_USBOTG_HS_DAINTMSK, USBOTG_HS_DAINTMSK_IEPM(TEST_EP));
+    done_cnt = 0;
+}
+
+/* the core completes the current IN transfer */
+static void in_xfrc(void)
+{
+    write_reg_value(r_CORTEX_M_USBOTG_HS_DAINT, USBOTG_HS_DAINTMSK_IEPM(TEST_EP));
+    write_reg_value(r_CORTEX_M_USBOTG_HS_DIEPINT(TEST_EP), USBOTG_HS_DIEPINT_XFRC_Msk);
+    USBOTGHS_IRQHandler(0, USBOTG_HS_GINTSTS_IEPINT_Msk, USBOTG_HS_GINTSTS_IEPINT_Msk);
+    write_reg_value(r_CORTEX_M_USBOTG_HS_DIEPINT(TEST_EP), 0);
+    write_reg_value(r_CORTEX_M_USBOTG_HS_DAINT, 0);
+}
+
+/* transfers requested on a busy EP are started in order, on each XFRC */
+static void test_order(void)
+{
+    printf("%s\n", __func__);
+    setup();
+    CHECK_EQ("send 0", usbotghs_send_data(data[0], 100, TEST_EP), MBED_ERROR_NONE);
+    CHECK_EQ("send 1", usbotghs_send_data(data[1], 50, TEST_EP), MBED_ERROR_NONE);
+    CHECK_EQ("send 2", usbotghs_send_data(data[2], 30, TEST_EP), MBED_ERROR_NONE);
+    CHECK_EQ("current", in_ep()->fifo == data[0], true);
+    CHECK_EQ("IEPM restored", read_reg_value(r_CORTEX_M_USBOTG_HS_DAINTMSK), USBOTG_HS_DAINTMSK_IEPM(TEST_EP));
+
+    in_xfrc();
+    CHECK_EQ("completions 1", done_cnt, 1);
+    CHECK_EQ("completion 0", done[0], 100);
+    CHECK_EQ("current 1", in_ep()->fifo == data[1], true);
+    CHECK_EQ("size 1", in_ep()->fifo_size, 50);
+
+    in_xfrc();
+    CHECK_EQ("completions 2", done_cnt, 2);
+    CHECK_EQ("completion 1", done[1], 50);
+    CHECK_EQ("current 2", in_ep()->fifo == data[2], true);
+
+    in_xfrc();
+    CHECK_EQ("completions 3", done_cnt, 3);
+    CHECK_EQ("completion 2", done[2], 30);
+    CHECK_EQ("idle", in_ep()->state, USBOTG_HS_EP_STATE_IDLE);
+}
+
+/* a queued ZLP is sent between two transfers, without upper layer completion */
+static void test_zlp(void)
+{
+    printf("%s\n", __func__);
+    setup();
+    CHECK_EQ("send 0", usbotghs_send_data(data[0], TEST_MPSIZE, TEST_EP), MBED_ERROR_NONE);
+    CHECK_EQ("send zlp", usbotghs_send_zlp(TEST_EP), MBED_ERROR_NONE);
+    CHECK_EQ("send 1", usbotghs_send_data(data[1], 10, TEST_EP), MBED_ERROR_NONE);
+
+    in_xfrc();
+    CHECK_EQ("completions 1", done_cnt, 1);
+    CHECK_EQ("completion 0", done[0], TEST_MPSIZE);
+    CHECK_EQ("zlp in progress", in_ep()->fifo_size, 0);
+    CHECK_EQ("zlp state", in_ep()->state, USBOTG_HS_EP_STATE_DATA_IN);
+
+    in_xfrc();
+    CHECK_EQ("no zlp completion", done_cnt, 1);
+    CHECK_EQ("current 1", in_ep()->fifo == data[1], true);
+
+    in_xfrc();
+    CHECK_EQ("completions 2", done_cnt, 2);
+    CHECK_EQ("completion 1", done[1], 10);
+}
+
+/* up to CONFIG_USR_DEV_USBOTGHS_XMIT_QUEUE_DEPTH transfers are queued */
+static void test_full(void)
+{
+    char name[32];
+
+    printf("%s\n", __func__);
+    setup();
+    CHECK_EQ("send 0", usbotghs_send_data(data[0], 10, TEST_EP), MBED_ERROR_NONE);
+    for (uint8_t i = 1; i <= CONFIG_USR_DEV_USBOTGHS_XMIT_QUEUE_DEPTH; ++i) {
+        snprintf(name, sizeof(name), "queue %u", i);
+        CHECK_EQ(name, usbotghs_send_data(data[i % 8], 10 + i, TEST_EP), MBED_ERROR_NONE);
+    }
+    CHECK_EQ("queue full", usbotghs_send_data(data[0], 10, TEST_EP), MBED_ERROR_BUSY);
+    CHECK_EQ("IEPM restored", read_reg_value(r_CORTEX_M_USBOTG_HS_DAINTMSK), USBOTG_HS_DAINTMSK_IEPM(TEST_EP));
+    for (uint8_t i = 0; i <= CONFIG_USR_DEV_USBOTGHS_XMIT_QUEUE_DEPTH; ++i) {
+        in_xfrc();
+    }
+    CHECK_EQ("completions", done_cnt, CONFIG_USR_DEV_USBOTGHS_XMIT_QUEUE_DEPTH + 1);
+    for (uint8_t i = 0; i < done_cnt; ++i) {
+        snprintf(name, sizeof(name), "completion %u", i);
+        CHECK_EQ(name, done[i], 10 + i);
+    }
+}
+
+/*
+ * the bus is suspended before the queued transfers are started: they are
+ * dropped, and each of them is completed with a size of 0, after the current
+ * transfer
+ */
+static void test_dropped(void)
+{
+    printf("%s\n", __func__);
+    setup();
+    CHECK_EQ("send 0", usbotghs_send_data(data[0], 100, TEST_EP), MBED_ERROR_NONE);
+    CHECK_EQ("send 1", usbotghs_send_data(data[1], 50, TEST_EP), MBED_ERROR_NONE);
+    CHECK_EQ("send 2", usbotghs_send_data(data[2], 30, TEST_EP), MBED_ERROR_NONE);
+    write_reg_value(r_CORTEX_M_USBOTG_HS_DSTS, USBOTG_HS_DSTS_SUSPSTS_Msk);
+
+    in_xfrc();
+    CHECK_EQ("completions", done_cnt, 3);
+    CHECK_EQ("completion 0", done[0], 100);
+    CHECK_EQ("dropped 1", done[1], 0);
+    CHECK_EQ("dropped 2", done[2], 0);
+    CHECK_EQ("idle", in_ep()->state, USBOTG_HS_EP_STATE_IDLE);
+
+    /* the queue is empty, a new transfer starts at once on resume */
+    write_reg_value(r_CORTEX_M_USBOTG_HS_DSTS, 0);
+    CHECK_EQ("send 3", usbotghs_send_data(data[3], 20, TEST_EP), MBED_ERROR_NONE);
+    CHECK_EQ("current 3", in_ep()->fifo == data[3], true);
+}
+
+/* the EP IN interrupt mask is given back as it was before each send */
+static void test_iepm_kept(void)
+{
+    printf("%s\n", __func__);
+    setup();
+    write_reg_value(r_CORTEX_M_USBOTG_HS_DAINTMSK, 0);
+    CHECK_EQ("send 0", usbotghs_send_data(data[0], 100, TEST_EP), MBED_ERROR_NONE);
+    CHECK_EQ("send 1", usbotghs_send_data(data[1], 50, TEST_EP), MBED_ERROR_NONE);
+    CHECK_EQ("send zlp", usbotghs_send_zlp(TEST_EP), MBED_ERROR_NONE);
+    CHECK_EQ("IEPM kept masked", read_reg_value(r_CORTEX_M_USBOTG_HS_DAINTMSK), 0);
+
+    /* other EPs interrupts are left untouched */
+    write_reg_value(r_CORTEX_M_USBOTG_HS_DAINTMSK, USBOTG_HS_DAINTMSK_IEPM(TEST_EP + 1));
+    CHECK_EQ("send 2", usbotghs_send_data(data[2], 30, TEST_EP), MBED_ERROR_NONE);
+    CHECK_EQ("other IEPM kept", read_reg_value(r_CORTEX_M_USBOTG_HS_DAINTMSK),
+             USBOTG_HS_DAINTMSK_IEPM(TEST_EP + 1));
+}
+
+int main(void)
+{
+    test_order();
+    test_zlp();
+    test_full();
+    test_dropped();
+    test_iepm_kept();
+    if (failures != 0) {
+        printf("FAILED: %u check(s)\n", failures);
+        return 1;
+    }
+    printf("OK\n");
+    return 0;
+}
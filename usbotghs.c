@@ -34,6 +34,7 @@
 #include "usbotghs_init.h"
 #include "usbotghs_fifos.h"
 #include "usbotghs_handler.h"
+#include "usbotghs_pool.h"
 #include "usbotghs_regs.h"
 #include "ulpi.h"
 #include "generated/usb_otg_hs.h"
@@ -71,8 +72,7 @@
  */
 
 static const char *devname = "usb-otg-hs";
-/* buffer for setup packets */
-// TODO to use static uint8_t   setup_packet[8];
+/* SETUP packets are received in the context SETUP slots (see usbotghs_handler.c) */
 
 /* local context. Only one as there is one USB OTG device per SoC */
 
@@ -378,7 +378,7 @@ reset ? */
     usbotghs_ctx.in_eps[0].fifo = NULL; /* not yet configured */
     usbotghs_ctx.in_eps[0].fifo_idx = 0; /* not yet configured */
     usbotghs_ctx.in_eps[0].fifo_size = 0; /* not yet configured */
-    usbotghs_ctx.in_eps[0].fifo_lck = false;
+    usbotghs_ctx.in_eps[0].fifo_owner = USBOTG_HS_FIFO_DRIVER_OWNED;
     usbotghs_ctx.in_eps[0].dir = USBOTG_HS_EP_DIR_IN;
     if (mode == USBOTGHS_MODE_DEVICE) {
         usbotghs_ctx.in_eps[0].core_txfifo_empty = true;
@@ -396,7 +396,7 @@ reset ? */
     usbotghs_ctx.out_eps[0].fifo = 0; /* not yet configured */
     usbotghs_ctx.out_eps[0].fifo_idx = 0; /* not yet configured */
     usbotghs_ctx.out_eps[0].fifo_size = 0; /* not yet configured */
-    usbotghs_ctx.in_eps[0].fifo_lck = false;
+    usbotghs_ctx.in_eps[0].fifo_owner = USBOTG_HS_FIFO_DRIVER_OWNED;
 
     usbotghs_ctx.speed = USBOTG_HS_SPEED_HS; /* default. In device mode, wait for enumeration */
 
@@ -421,103 +421,23 @@ uint16_t usbotghs_get_ep_mpsize(usbotghs_ep_type_t type)
 
 
 /*
- * Sending data put content in the USB OTG FIFO and ask the EP to read from it to
- * send the data on the line (by activating the EP (field USBAEP of out EPs))
- * We must wait data sent IT to be sure that content is effectively transmitted
+ * Start the transmission of the EP RAM FIFO content, previously set by
+ * usbotghs_set_xmit_fifo() or usbotghs_set_xmit_fifov().
+ * Here, we have to split the FIFO content, taking into account the
+ * current EP mpsize, and schedule transmission into the Core TxFIFO.
  */
-
-
-/*
-TODO : add specification for !CONFIG_USR_DRV_USBOTGHS_MODE_DEVICE
-*/
-
 /*@
- @ requires \separated(GHOST_in_eps+(0 .. USBOTGHS_MAX_IN_EP - 1),&GHOST_opaque_drv_privates,&usbotghs_ctx, src + (0 .. size-1), (uint32_t *) (USB_BACKEND_MEMORY_BASE .. USB_BACKEND_MEMORY_END));
-
- @ assigns *((uint32_t *) (USB_BACKEND_MEMORY_BASE .. USB_BACKEND_MEMORY_END)), *((uint32_t *) r_CORTEX_M_USBOTG_HS_GINTMSK), usbotghs_ctx.in_eps[ep_id], usbotghs_ctx.in_eps[ep_id].fifo, usbotghs_ctx.in_eps[ep_id].fifo_lck, usbotghs_ctx.in_eps[ep_id].fifo_idx,usbotghs_ctx.in_eps[ep_id].fifo_size, usbotghs_ctx.in_eps[ep_id].state;
-
-
- // private function contract
- @ ensures ((ep_id < USBOTGHS_MAX_IN_EP) && src != NULL && size > 0 && ((usbotghs_ctx.in_eps[ep_id].configured != \true) || (usbotghs_ctx.in_eps[ep_id].mpsize == 0))) ==> \result == MBED_ERROR_INVSTATE ;
-
- @ ensures ( (ep_id < USBOTGHS_MAX_IN_EP) && src != NULL && size > 0 && ((usbotghs_ctx.in_eps[ep_id].configured == \true) && (usbotghs_ctx.in_eps[ep_id].mpsize > 0)) && usbotghs_ctx.in_eps[ep_id].fifo_lck == \true) ==> \result == MBED_ERROR_INVSTATE  ;
-
- @ ensures ((ep_id < USBOTGHS_MAX_IN_EP) && src != NULL && size > 0 && ((usbotghs_ctx.in_eps[ep_id].configured == \true) && (usbotghs_ctx.in_eps[ep_id].mpsize > 0)) && usbotghs_ctx.in_eps[ep_id].fifo_lck != \true) ==> \result == MBED_ERROR_INVPARAM || \result == MBED_ERROR_BUSY || \result == MBED_ERROR_INVSTATE || \result == MBED_ERROR_NONE ;
-
- */
-mbed_error_t usbotghs_send_data(uint8_t *src, uint32_t size, uint8_t ep_id)
+  @ requires ep_id < USBOTGHS_MAX_IN_EP;
+  @ requires ep == &usbotghs_ctx.in_eps[ep_id];
+  @ requires ep->mpsize > 0 && ep->fifo_size > 0;
+  @ requires \separated(GHOST_in_eps+(0 .. USBOTGHS_MAX_IN_EP - 1), &usbotghs_ctx, (uint32_t *) (USB_BACKEND_MEMORY_BASE .. USB_BACKEND_MEMORY_END));
+  @ assigns *((uint32_t *) (USB_BACKEND_MEMORY_BASE .. USB_BACKEND_MEMORY_END)), usbotghs_ctx.in_eps[ep_id], GHOST_in_eps[ep_id].state;
+  */
+static mbed_error_t usbotghs_start_xmit(usbotghs_ep_t *ep, uint8_t ep_id)
 {
-    /* no public (exported) variable is set. This GHOST var is used as countermeasure to public assignment
-     * specification for functions that assign private global content */
-    //@ ghost GHOST_opaque_drv_privates = 1;
-
     uint32_t packet_count = 0;
+    uint32_t xfr_size = 0;
     mbed_error_t errcode = MBED_ERROR_NONE;
-    uint32_t fifo_size = 0;
-    usbotghs_context_t *ctx = usbotghs_get_context();
-
-    usbotghs_ep_t *ep = NULL;
-
-#if CONFIG_USR_DRV_USBOTGHS_MODE_DEVICE
-
-    if(ep_id >= USBOTGHS_MAX_IN_EP)
-    {
-        errcode = MBED_ERROR_INVPARAM;
-        goto err_init;
-    }
-    /*@ assert ep_id <USBOTGHS_MAX_IN_EP; */
-    ep = &ctx->in_eps[ep_id];
-    /* @ assert ep == &usbotghs_ctx.in_eps[ep_id] ; */
-#else
-# error "not yet supported!"
-#endif
-
-
-    if (src == NULL) {
-        errcode = MBED_ERROR_INVPARAM;
-        goto err;
-    }
-    /*@ assert src !=\null;*/
-    if (size == 0) {
-        errcode = MBED_ERROR_INVPARAM;
-        goto err;
-    }
-    /*@ assert size !=0;*/
-    if (ep->configured != true || ep->mpsize == 0) {
-        log_printf("[USBOTG][HS] ep %d not configured\n", ep->id);
-        errcode = MBED_ERROR_INVSTATE;
-        goto err;
-    }
-    /*@ assert ep->configured == true && ep->mpsize >0 ;*/
-    fifo_size = USBOTG_HS_TX_CORE_FIFO_SZ;
-
-    /* configure EP FIFO internal informations */
-
-    if ((errcode = usbotghs_set_xmit_fifo(src, size, ep_id)) != MBED_ERROR_NONE) {
-      log_printf("[USBOTG][HS] failed to set EP%d TxFIFO!\n", ep_id);
-      /*@ assert  errcode== MBED_ERROR_INVSTATE && \at(usbotghs_ctx.in_eps,Pre)[ep_id].fifo_lck == \true; */
-      goto err_init;
-    }
-
-    /* giving these three assertions, next call to usbotghs_write_epx_fifo() should has its
-     * preconditions granted. */
-    /* PTH: not needed --> set_xmit_fifo returns MBED_ERROR_NONE means that fifo wasn't lock
-     * at the tie if its execution */
-    /* Here are the precodntions of a **valid** set_xmit_fifo() execution: */
-    /*  assert \at(usbotghs_ctx.in_eps,Pre)[ep_id].fifo_lck == \false; */
-    /* Here are the postconditions of a **valid** set_xmit_fifo() execution: */
-    /*@ assert \valid(ep->fifo+(0..ep->fifo_size-1));*/
-    /*@ assert ep->fifo_lck == \false && ep->fifo == src && ep->fifo_idx==0 && ep->fifo_size==size; */
-    /*@ assert ep->mpsize <= fifo_size; */
-
-
-    /*
-     * Here, we have to split the src content, taking into account the
-     * current EP mpsize, and schedule transmission into the Core TxFIFO.
-     */
-
-    /* XXX: Here we assume fifo size == mpsize, which is bad..., fifo is bigger */
-    uint32_t residual_size = size;
 
     /*
      * We can configure the core to handle the transmission of upto:
@@ -534,49 +454,66 @@ mbed_error_t usbotghs_send_data(uint8_t *src, uint32_t size, uint8_t ep_id)
      * First we configure the number of packets to transfer and the number of
      * bytes to transfer
      */
-    packet_count = (size / ep->mpsize) + ((size % ep->mpsize) ? 1: 0);
+    xfr_size = ep->fifo_size;
+#if CONFIG_USR_DRV_USBOTGHS_MODE_DEVICE
+    /* EP 0 is not able to handle more than 3 packets and 127 bytes per transfer. For bigger
+     * transfers, the driver must fragment data transfer transparently */
+    if (ep_id == 0) {
+        xfr_size = usbotghs_ep0_fragment_size(ep->fifo_size, ep->mpsize);
+    }
+#endif
+    packet_count = (xfr_size / ep->mpsize) + ((xfr_size % ep->mpsize) ? 1: 0);
+    /* a transfer ending with a full packet is terminated by a ZLP, sent by
+     * iepint_handler() on XFRC, when the EP policy requires it */
+    ep->zlp_pending = (ep->auto_zlp && (ep->fifo_size % ep->mpsize) == 0);
 
-    log_printf("[USBOTG][HS] need to write %d pkt on ep %d, total size: %d\n", packet_count, ep_id, size);
+    log_printf("[USBOTG][HS] need to write %d pkt on ep %d, total size: %d\n", packet_count, ep_id, ep->fifo_size);
 #if CONFIG_USR_DRV_USBOTGHS_MODE_DEVICE
     /* 1. Program the OTG_HS_DIEPTSIZx register for the transfer size
      * and the corresponding packet count. */
-    /* EP 0 is not able to handle more than one packet of mpsize size per transfer. For bigger
-     * transfers, the driver must fragment data transfer transparently */
-
-
-    if (ep_id > 0 || size <= ep->mpsize) {
-        set_reg_value(r_CORTEX_M_USBOTG_HS_DIEPTSIZ(ep_id), packet_count, USBOTG_HS_DIEPTSIZ_PKTCNT_Msk(ep_id), USBOTG_HS_DIEPTSIZ_PKTCNT_Pos(ep_id));
-        set_reg_value(r_CORTEX_M_USBOTG_HS_DIEPTSIZ(ep_id),size,USBOTG_HS_DIEPTSIZ_XFRSIZ_Msk(ep_id),USBOTG_HS_DIEPTSIZ_XFRSIZ_Pos(ep_id));
-    } else {
+    if (xfr_size < ep->fifo_size) {
         log_printf("[USBOTG][HS] need to write more data than the EP is able in a single transfer\n");
-        set_reg_value(r_CORTEX_M_USBOTG_HS_DIEPTSIZ(ep_id),1,USBOTG_HS_DIEPTSIZ_PKTCNT_Msk(ep_id),USBOTG_HS_DIEPTSIZ_PKTCNT_Pos(ep_id));
-        set_reg_value(r_CORTEX_M_USBOTG_HS_DIEPTSIZ(ep_id),ep->mpsize,USBOTG_HS_DIEPTSIZ_XFRSIZ_Msk(ep_id), USBOTG_HS_DIEPTSIZ_XFRSIZ_Pos(ep_id));
     }
+    set_reg_value(r_CORTEX_M_USBOTG_HS_DIEPTSIZ(ep_id), packet_count, USBOTG_HS_DIEPTSIZ_PKTCNT_Msk(ep_id), USBOTG_HS_DIEPTSIZ_PKTCNT_Pos(ep_id));
+    set_reg_value(r_CORTEX_M_USBOTG_HS_DIEPTSIZ(ep_id), xfr_size, USBOTG_HS_DIEPTSIZ_XFRSIZ_Msk(ep_id), USBOTG_HS_DIEPTSIZ_XFRSIZ_Pos(ep_id));
+#if CONFIG_USR_DEV_USBOTGHS_DMA
+    /* The core DMA fetches the transfer (or the first EP0 fragment) by itself
+     * from the RAM FIFO (or its bounce buffer copy): the whole content is
+     * considered pushed, and XFRC rises once sent */
+    usbotghs_xmit_dma_prepare(ep_id, xfr_size);
+    ep->fifo_idx = xfr_size;
+    set_u8_with_membarrier(&ep->state, USBOTG_HS_EP_STATE_DATA_IN);
+#else
     set_u8_with_membarrier(&ep->state, USBOTG_HS_EP_STATE_DATA_IN_WIP);
+#endif
     //@ ghost GHOST_in_eps[ep_id].state = usbotghs_ctx.in_eps[ep_id].state;
 
     /* 2. Enable endpoint for transmission. */
     set_reg_bits(r_CORTEX_M_USBOTG_HS_DIEPCTL(ep_id),USBOTG_HS_DIEPCTL_CNAK_Msk | USBOTG_HS_DIEPCTL_EPENA_Msk);
+#if CONFIG_USR_DEV_USBOTGHS_DMA
+    /* no Core TxFIFO write: next EP0 fragments are started by iepint_handler() */
+    return errcode;
+#endif
 
 #else/* Host mode */
 # error "not yet implemented!"
 #endif
 
     /* Fragmentation on EP0 case: we don't loop on the input FIFO to
-     * synchronously transmit the data, we just write the first packet
-     * into the FIFO, and we wait for IEPINT. The successive next
-     * contents will be transmitted by iepint by detecting that
+     * synchronously transmit the data, we just write the first fragment
+     * (upto 3 packets) into the FIFO, and we wait for IEPINT. The successive
+     * next fragments will be transmitted by iepint by detecting that
      * ep->fifo_idx is smaller than ep->fifo_size (data transmission
      * not finished) */
 
-    if (ep_id == 0 && size > ep->mpsize) {
-        log_printf("[USBOTG][HS] fragment: initiate the first fragment to send (MPSize) on EP0\n");
+    if (ep_id == 0 && xfr_size < ep->fifo_size) {
+        log_printf("[USBOTG][HS] fragment: initiate the first fragment to send (%d bytes) on EP0\n", xfr_size);
         /* wait for enough space in TxFIFO */
 
 #ifndef __FRAMAC__
         /* we can't rely on contrôled timeout for xFIFU flush, as the flush time depend on multiple HW constraints which are hard to dimension.
          * In nominal case, we wait for the TxFIFO to be flushed, except in case of busy error. In FramaC case, we must provide a loop terminaison. */
-        while (get_reg(r_CORTEX_M_USBOTG_HS_DTXFSTS(ep_id), USBOTG_HS_DTXFSTS_INEPTFSAV) < (ep->mpsize / 4)) {
+        while (get_reg(r_CORTEX_M_USBOTG_HS_DTXFSTS(ep_id), USBOTG_HS_DTXFSTS_INEPTFSAV) < (xfr_size / 4)) {
             if (get_reg(r_CORTEX_M_USBOTG_HS_DSTS, USBOTG_HS_DSTS_SUSPSTS)){
                 log_printf("[USBOTG][HS] Suspended!\n");
                 errcode = MBED_ERROR_BUSY;
@@ -592,7 +529,7 @@ mbed_error_t usbotghs_send_data(uint8_t *src, uint32_t size, uint8_t ep_id)
           */
         for (uint8_t cpt=0; cpt<CPT_HARD; cpt++)
         {
-            if (get_reg(r_CORTEX_M_USBOTG_HS_DTXFSTS(ep_id), USBOTG_HS_DTXFSTS_INEPTFSAV) < (ep->mpsize / 4)) {
+            if (get_reg(r_CORTEX_M_USBOTG_HS_DTXFSTS(ep_id), USBOTG_HS_DTXFSTS_INEPTFSAV) < (xfr_size / 4)) {
                 if (get_reg(r_CORTEX_M_USBOTG_HS_DSTS, USBOTG_HS_DSTS_SUSPSTS)){
                     log_printf("[USBOTG][HS] Suspended!\n");
                     errcode = MBED_ERROR_BUSY;
@@ -609,162 +546,460 @@ mbed_error_t usbotghs_send_data(uint8_t *src, uint32_t size, uint8_t ep_id)
 # error "not yet supported!"
 #endif
         /* write data from SRC to FIFO */
-        errcode = usbotghs_write_epx_fifo(ep->mpsize, ep->id);
+        errcode = usbotghs_write_epx_fifo(xfr_size, ep->id);
         goto err_fragment;
     }
 
     /*
      * Case of packets WITHOUT fragmentation
-     * Now, we need to loop on the FIFO write and transmit, while there is
-     * data to send. The Core FIFO will handle the decrement of XFRSIZ and
-     * PKTCNT automatically, and will rise the XFRC interrupt when both reach
-     * 0.
-     */
-    /*
-     * First, we push FIFO size multiple into the FIFO
+     * The Core FIFO will handle the decrement of XFRSIZ and PKTCNT
+     * automatically, and will rise the XFRC interrupt when both reach 0.
+     * We don't wait for the Core TxFIFO to drain here: only what the Core
+     * TxFIFO can hold now is pushed, the next packets are pushed by
+     * iepint_handler() on TxFIFO empty events.
      */
-    /* this loop doesn't have loop invariant for loop counters as there is no sequencial decrement upto 0 with a step of 1 */
-    /*@
-      @ loop invariant \valid(ep->fifo+(0..ep->fifo_size-1));
-      @ loop invariant \separated(ep->fifo + (0 .. ep->fifo_size-1), (uint32_t *) (USB_BACKEND_MEMORY_BASE .. USB_BACKEND_MEMORY_END));
-      @ loop invariant fifo_size >0 ;
-      // loop assigns residual_size, errcode, ep->state , *((uint32_t *)((int)(0x40040000 + (int)(0x1000 * (int)((int)usbotghs_ctx.in_eps[ep->id].id + 1))))), *((uint32_t *) r_CORTEX_M_USBOTG_HS_GINTMSK), usbotghs_ctx.in_eps[ep->id].fifo_idx, usbotghs_ctx.in_eps[ep->id].fifo_lck, ep->fifo[\at(ep->fifo_idx,LoopEntry)];
-      // no variant as residual_size doesn't decrement harmonicaly to 0
-      //
-      @ loop assigns residual_size, errcode, ep->state , *((uint32_t *)((int)(0x40040000 + (int)(0x1000 * (int)((int)ep->id + 1))))), *((uint32_t *) r_CORTEX_M_USBOTG_HS_GINTMSK), ep->fifo_idx, ep->fifo_lck, ep->fifo[\at(ep->fifo_idx,LoopEntry)];
-      // loop variant residual_size ;
+    if ((errcode = usbotghs_fill_epx_txfifo(ep_id)) != MBED_ERROR_NONE) {
+        goto err;
+    }
 
-      */
-    while (residual_size >= fifo_size) {
-      /*@ assert residual_size >= fifo_size; */
-#ifndef __FRAMAC__
-        while (get_reg(r_CORTEX_M_USBOTG_HS_DTXFSTS(ep_id), USBOTG_HS_DTXFSTS_INEPTFSAV) < (fifo_size / 4)) {
-            if (get_reg(r_CORTEX_M_USBOTG_HS_DSTS, USBOTG_HS_DSTS_SUSPSTS)){
-                log_printf("[USBOTG][HS] Suspended!\n");
-                errcode = MBED_ERROR_BUSY;
-                goto err;
-            }
-        }
+    if(get_reg(r_CORTEX_M_USBOTG_HS_DSTS, USBOTG_HS_DSTS_SUSPSTS)) {
+        errcode = MBED_ERROR_BUSY;
+        goto err;
+    }
+    return errcode;
+err:
+    /* From whatever we come from to this point, the current transfer is complete
+     * (with failure or not on upper level). IEPINT can inform the upper layer */
+    ep->zlp_pending = false;
+    clear_reg_bits(r_CORTEX_M_USBOTG_HS_DIEPEMPMSK, USBOTG_HS_DIEPEMPMSK_INEPTXFEM(ep_id));
+    set_u8_with_membarrier(&ep->state, USBOTG_HS_EP_STATE_IDLE);
+#if CONFIG_USR_DRV_USBOTGHS_MODE_DEVICE
+    //@ ghost GHOST_in_eps[ep_id].state = usbotghs_ctx.in_eps[ep_id].state;
 #else
+# error "not yet supported!"
+#endif
+    return errcode;
+err_fragment:
+    set_u8_with_membarrier(&ep->state, USBOTG_HS_EP_STATE_DATA_IN);
+    return errcode;
+}
 
-        /*@
-          @ loop invariant \valid(ep->fifo+(0..ep->fifo_size));
-          @ loop invariant \separated(ep->fifo + (0 .. ep->fifo_size-1), (uint32_t *) (USB_BACKEND_MEMORY_BASE .. USB_BACKEND_MEMORY_END));
-          @ loop invariant fifo_size >0 ;
-          @ loop invariant 0<=cpt<= CPT_HARD ;
-          @ loop assigns cpt, errcode ;
-          @ loop variant CPT_HARD - cpt ;
-          */
-        for(uint32_t cpt=0; cpt<CPT_HARD; cpt++)
-        {
-            if (get_reg(r_CORTEX_M_USBOTG_HS_DTXFSTS(ep_id), USBOTG_HS_DTXFSTS_INEPTFSAV) < (fifo_size / 4)) {
-                if (get_reg(r_CORTEX_M_USBOTG_HS_DSTS, USBOTG_HS_DSTS_SUSPSTS)){
-                    log_printf("[USBOTG][HS] Suspended!\n");
-                    errcode = MBED_ERROR_BUSY;
-                    goto err;
-                }
-            }
+
+/*
+ * Start a standalone zero-length packet transfer on a data IN EP. The EP is kept
+ * busy until the ZLP XFRC, so that the transfers requested meanwhile are queued.
+ * As for EP0 ZLPs, the upper layer is not informed of its completion.
+ */
+/*@
+  @ requires 0 < ep_id < USBOTGHS_MAX_IN_EP;
+  @ requires ep == &usbotghs_ctx.in_eps[ep_id];
+  @ assigns *((uint32_t *) (USB_BACKEND_MEMORY_BASE .. USB_BACKEND_MEMORY_END)), usbotghs_ctx.in_eps[ep_id], GHOST_in_eps[ep_id].state;
+  */
+static void usbotghs_start_xmit_zlp(usbotghs_ep_t *ep, uint8_t ep_id)
+{
+    ep->fifo = NULL;
+    ep->fifo_idx = 0;
+    ep->fifo_size = 0;
+    ep->iov = NULL;
+    ep->zlp_pending = false;
+    set_u8_with_membarrier(&ep->state, USBOTG_HS_EP_STATE_DATA_IN);
+    //@ ghost GHOST_in_eps[ep_id].state = usbotghs_ctx.in_eps[ep_id].state;
+    usbotghs_xmit_zlp(ep_id);
+}
+
+/*
+ * Hold off the given EP IN events (and only them) while its transfer is set:
+ * iepint_handler() must neither complete nor refill it meanwhile. Return the
+ * previous EP IN interrupt mask, given back to usbotghs_in_ep_unmask(): the EP
+ * IN interrupt is only unmasked again if it was before.
+ */
+/*@
+  @ requires ep_id < USBOTGHS_MAX_IN_EP;
+  @ assigns *((uint32_t *) (USB_BACKEND_MEMORY_BASE .. USB_BACKEND_MEMORY_END));
+  */
+static inline uint32_t usbotghs_in_ep_mask(uint8_t ep_id)
+{
+    uint32_t iepm = read_reg_value(r_CORTEX_M_USBOTG_HS_DAINTMSK) & USBOTG_HS_DAINTMSK_IEPM(ep_id);
+
+    clear_reg_bits(r_CORTEX_M_USBOTG_HS_DAINTMSK, USBOTG_HS_DAINTMSK_IEPM(ep_id));
+    return iepm;
+}
+
+/*@
+  @ assigns *((uint32_t *) (USB_BACKEND_MEMORY_BASE .. USB_BACKEND_MEMORY_END));
+  */
+static inline void usbotghs_in_ep_unmask(uint32_t iepm)
+{
+    if (iepm != 0) {
+        set_reg_bits(r_CORTEX_M_USBOTG_HS_DAINTMSK, iepm);
+    }
+}
+
+/*
+ * Data IN EPs handle a queue of pending transfers: when a transfer is already
+ * in progress on the EP, the new one is queued, and will be started by
+ * iepint_handler() at the current transfer completion. The caller must have
+ * masked the EP IN interrupt (DAINTMSK), in order to avoid a race with the
+ * completion of the current transfer.
+ * EP0 (control) transfers are not queued.
+ */
+/*@
+  @ requires ep_id < USBOTGHS_MAX_IN_EP;
+  @ requires \valid_read(req);
+  @ requires \valid(queued);
+  @ assigns *((uint32_t *) (USB_BACKEND_MEMORY_BASE .. USB_BACKEND_MEMORY_END)), *queued;
+  */
+static mbed_error_t usbotghs_xmit_queue_if_busy(const usbotghs_xmit_req_t *req,
+                                                uint8_t ep_id, bool *queued)
+{
+    mbed_error_t errcode = MBED_ERROR_NONE;
+    usbotghs_context_t *ctx = usbotghs_get_context();
+    uint8_t state;
+
+    *queued = false;
+    if (ep_id == 0) {
+        goto err;
+    }
+    state = ctx->in_eps[ep_id].state;
+    if (state == USBOTG_HS_EP_STATE_DATA_IN_WIP || state == USBOTG_HS_EP_STATE_DATA_IN) {
+        log_printf("[USBOTG][HS] ep %d busy, queuing transfer\n", ep_id);
+        if (usbotghs_xmit_enqueue(req, ep_id) != MBED_ERROR_NONE) {
+            errcode = MBED_ERROR_BUSY;
         }
-#endif
+        *queued = true;
+    }
+err:
+    return errcode;
+}
+
+/*
+ * Start the next queued transfer of the given IN EP, if any. This is called by
+ * iepint_handler() on transfer completion, before informing the upper layer, so
+ * that back-to-back transfers keep the link busy.
+ * A queued transfer which can't be started is dropped, and the next one is
+ * tried. Its sender was told that it was accepted: the number of dropped
+ * transfers is returned in dropped, so that iepint_handler() completes each of
+ * them toward the upper layer.
+ */
+/*@
+  @ requires ep_id < USBOTGHS_MAX_IN_EP;
+  @ requires \valid(dropped);
+  @ requires \separated(GHOST_in_eps+(0 .. USBOTGHS_MAX_IN_EP - 1), &usbotghs_ctx, (uint32_t *) (USB_BACKEND_MEMORY_BASE .. USB_BACKEND_MEMORY_END), dropped);
+  @ assigns *((uint32_t *) (USB_BACKEND_MEMORY_BASE .. USB_BACKEND_MEMORY_END)), usbotghs_ctx.in_eps[ep_id], GHOST_in_eps[ep_id].state, *dropped;
+  */
+mbed_error_t usbotghs_xmit_next(uint8_t ep_id, uint8_t *dropped)
+{
+    mbed_error_t errcode = MBED_ERROR_NONE;
+    usbotghs_context_t *ctx = usbotghs_get_context();
+    usbotghs_ep_t *ep = &ctx->in_eps[ep_id];
+    usbotghs_xmit_req_t req;
+
+    *dropped = 0;
+    /*@
+      @ loop invariant 0 <= i <= CONFIG_USR_DEV_USBOTGHS_XMIT_QUEUE_DEPTH;
+      @ loop assigns i, req, errcode, *dropped, *((uint32_t *) (USB_BACKEND_MEMORY_BASE .. USB_BACKEND_MEMORY_END)), usbotghs_ctx.in_eps[ep_id], GHOST_in_eps[ep_id].state;
+      @ loop variant CONFIG_USR_DEV_USBOTGHS_XMIT_QUEUE_DEPTH - i;
+      */
+    for (uint8_t i = 0; i < CONFIG_USR_DEV_USBOTGHS_XMIT_QUEUE_DEPTH; ++i) {
+        if (usbotghs_xmit_dequeue(&req, ep_id) != MBED_ERROR_NONE) {
+            /* nothing more to send */
+            break;
+        }
+        if (req.size == 0) {
+            /* queued by usbotghs_send_zlp() */
+            usbotghs_start_xmit_zlp(ep, ep_id);
+            break;
+        }
+        if (req.iov != NULL) {
+            errcode = usbotghs_set_xmit_fifov(req.iov, req.iov_cnt, req.size, ep_id);
+        } else if (req.words) {
+            errcode = usbotghs_set_xmit_fifo_words((const uint32_t*)req.src, req.size, ep_id);
+        } else {
+            errcode = usbotghs_set_xmit_fifo(req.src, req.size, ep_id);
+        }
+        if (errcode == MBED_ERROR_NONE) {
+            errcode = usbotghs_start_xmit(ep, ep_id);
+        }
+        if (errcode == MBED_ERROR_NONE) {
+            break;
+        }
+        log_printf("[USBOTG][HS] ep %d: failed to start queued transfer, dropped\n", ep_id);
+        (*dropped)++;
+    }
+    return errcode;
+}
+
+/*
+ * Sending data put content in the USB OTG FIFO and ask the EP to read from it to
+ * send the data on the line (by activating the EP (field USBAEP of out EPs))
+ * This function does not wait for the transfer to be done: the Core TxFIFO is
+ * refilled by iepint_handler(), which informs the upper layer on XFRC, once the
+ * content is effectively transmitted.
+ */
+
+
+/*
+TODO : add specification for !CONFIG_USR_DRV_USBOTGHS_MODE_DEVICE
+*/
+
+/*@
+ @ requires \separated(GHOST_in_eps+(0 .. USBOTGHS_MAX_IN_EP - 1),&GHOST_opaque_drv_privates,&usbotghs_ctx, src + (0 .. size-1), (uint32_t *) (USB_BACKEND_MEMORY_BASE .. USB_BACKEND_MEMORY_END));
+
+ @ assigns *((uint32_t *) (USB_BACKEND_MEMORY_BASE .. USB_BACKEND_MEMORY_END)), usbotghs_ctx.in_eps[ep_id], usbotghs_ctx.in_eps[ep_id].fifo, usbotghs_ctx.in_eps[ep_id].fifo_owner, usbotghs_ctx.in_eps[ep_id].fifo_idx,usbotghs_ctx.in_eps[ep_id].fifo_size, usbotghs_ctx.in_eps[ep_id].state;
+
+
+ // private function contract
+ @ ensures ((ep_id < USBOTGHS_MAX_IN_EP) && src != NULL && size > 0 && ((usbotghs_ctx.in_eps[ep_id].configured != \true) || (usbotghs_ctx.in_eps[ep_id].mpsize == 0))) ==> \result == MBED_ERROR_INVSTATE ;
+
+ @ ensures ( (ep_id < USBOTGHS_MAX_IN_EP) && src != NULL && size > 0 && ((usbotghs_ctx.in_eps[ep_id].configured == \true) && (usbotghs_ctx.in_eps[ep_id].mpsize > 0)) && usbotghs_ctx.in_eps[ep_id].fifo_owner != USBOTG_HS_FIFO_DRIVER_OWNED) ==> \result == MBED_ERROR_INVSTATE  ;
+
+ @ ensures ((ep_id < USBOTGHS_MAX_IN_EP) && src != NULL && size > 0 && ((usbotghs_ctx.in_eps[ep_id].configured == \true) && (usbotghs_ctx.in_eps[ep_id].mpsize > 0)) && usbotghs_ctx.in_eps[ep_id].fifo_owner == USBOTG_HS_FIFO_DRIVER_OWNED) ==> \result == MBED_ERROR_INVPARAM || \result == MBED_ERROR_BUSY || \result == MBED_ERROR_INVSTATE || \result == MBED_ERROR_NONE ;
+
+ */
+mbed_error_t usbotghs_send_data(uint8_t *src, uint32_t size, uint8_t ep_id)
+{
+    /* no public (exported) variable is set. This GHOST var is used as countermeasure to public assignment
+     * specification for functions that assign private global content */
+    //@ ghost GHOST_opaque_drv_privates = 1;
+
+    mbed_error_t errcode = MBED_ERROR_NONE;
+    bool queued = false;
+    uint32_t iepm = 0;
+    usbotghs_xmit_req_t req = { 0 };
+    usbotghs_context_t *ctx = usbotghs_get_context();
+
+    usbotghs_ep_t *ep = NULL;
 
-        if (residual_size == fifo_size) {
-            /* last block, no more WIP */
 #if CONFIG_USR_DRV_USBOTGHS_MODE_DEVICE
-            set_u8_with_membarrier(&ep->state, USBOTG_HS_EP_STATE_DATA_IN);
-            //@ ghost GHOST_in_eps[ep_id].state = usbotghs_ctx.in_eps[ep_id].state;
+
+    if(ep_id >= USBOTGHS_MAX_IN_EP)
+    {
+        errcode = MBED_ERROR_INVPARAM;
+        goto err_init;
+    }
+    /*@ assert ep_id <USBOTGHS_MAX_IN_EP; */
+    ep = &ctx->in_eps[ep_id];
+    /* @ assert ep == &usbotghs_ctx.in_eps[ep_id] ; */
 #else
 # error "not yet supported!"
 #endif
-        }
 
-        /* @ assert \separated(&usbotghs_ctx,r_CORTEX_M_USBOTG_HS_DTXFSTS(ep_id),r_CORTEX_M_USBOTG_HS_GINTMSK, USBOTG_HS_DEVICE_FIFO(usbotghs_ctx.in_eps[ep_id].id))  ; */
-        /* write data from SRC to FIFO */
-        usbotghs_write_epx_fifo(fifo_size, ep->id);
 
+    if (src == NULL) {
+        errcode = MBED_ERROR_INVPARAM;
+        goto err_init;
+    }
+    /*@ assert src !=\null;*/
+    if (size == 0) {
+        errcode = MBED_ERROR_INVPARAM;
+        goto err_init;
+    }
+    /*@ assert size !=0;*/
+    if (ep->configured != true || ep->mpsize == 0) {
+        log_printf("[USBOTG][HS] ep %d not configured\n", ep->id);
+        errcode = MBED_ERROR_INVSTATE;
+        goto err_init;
+    }
+    /*@ assert ep->configured == true && ep->mpsize >0 ;*/
+#if CONFIG_USR_DEV_USBOTGHS_DMA
+    /* the core DMA must be able to fetch the content, in place or bounced */
+    if ((errcode = usbotghs_dma_xfer_check(ep, ep_id, src, size, false)) != MBED_ERROR_NONE) {
+        goto err_init;
+    }
+#endif
 
-        /* wait for XMIT data to be transfered (wait for iepint (or oepint in
-         * host mode) to set the EP in correct state */
+    /* Hold off this EP IN events (and only them) while its transfer is set */
+    iepm = usbotghs_in_ep_mask(ep_id);
 
-        //usbotghs_wait_for_xmit_complete(ep);
-        residual_size -= fifo_size;
-	    /*@ assert residual_size >= 0; */
-	    /*  assert residual_size == \at(residual_size,LoopCurrent) - fifo_size ;*/
-        log_printf("[USBOTG][HS] EP: %d: residual: %d\n", ep_id, residual_size);
+    /* EP busy ? queue the transfer */
+    req.src = src;
+    req.size = size;
+    if ((errcode = usbotghs_xmit_queue_if_busy(&req, ep_id, &queued)) != MBED_ERROR_NONE || queued) {
+        goto err_unmask;
     }
 
-    /*@ assert residual_size >= 0; */
-    /*@ assert residual_size < fifo_size; */
-    /* Now, if there is residual size shorter than FIFO size, just send it */
-    if (residual_size > 0) {
-        /* wait while there is enough space in TxFIFO */
-#ifndef __FRAMAC__
-        while (get_reg(r_CORTEX_M_USBOTG_HS_DTXFSTS(ep_id), USBOTG_HS_DTXFSTS_INEPTFSAV)  < ((residual_size / 4) + (residual_size & 3 ? 1 : 0))) {
-#else
+    /* configure EP FIFO internal informations */
+
+    if ((errcode = usbotghs_set_xmit_fifo(src, size, ep_id)) != MBED_ERROR_NONE) {
+      log_printf("[USBOTG][HS] failed to set EP%d TxFIFO!\n", ep_id);
+      /*@ assert  errcode== MBED_ERROR_INVSTATE && \at(usbotghs_ctx.in_eps,Pre)[ep_id].fifo_owner != USBOTG_HS_FIFO_DRIVER_OWNED; */
+      goto err_unmask;
+    }
+
+    /* giving these three assertions, next call to usbotghs_write_epx_fifo() should has its
+     * preconditions granted. */
+    /* PTH: not needed --> set_xmit_fifo returns MBED_ERROR_NONE means that fifo wasn't lock
+     * at the tie if its execution */
+    /* Here are the precodntions of a **valid** set_xmit_fifo() execution: */
+    /*  assert \at(usbotghs_ctx.in_eps,Pre)[ep_id].fifo_owner == USBOTG_HS_FIFO_DRIVER_OWNED; */
+    /* Here are the postconditions of a **valid** set_xmit_fifo() execution: */
+    /*@ assert \valid(ep->fifo+(0..ep->fifo_size-1));*/
+    /*@ assert ep->fifo_owner == USBOTG_HS_FIFO_DRIVER_OWNED && ep->fifo == src && ep->fifo_idx==0 && ep->fifo_size==size; */
+    /*@ assert ep->mpsize <= USBOTG_HS_TX_CORE_FIFO_SZ; */
+
+    errcode = usbotghs_start_xmit(ep, ep_id);
+err_unmask:
+    usbotghs_in_ep_unmask(iepm);
+    return errcode;
+err_init:
+    return errcode;
+}
+
+
+/*
+ * Vectored variant of usbotghs_send_data(): the segments are streamed, in order,
+ * into the Core TxFIFO as a single transfer, without being first copied into a
+ * contiguous buffer.
+ */
+/*@
+ @ requires \separated(GHOST_in_eps+(0 .. USBOTGHS_MAX_IN_EP - 1),&GHOST_opaque_drv_privates,&usbotghs_ctx, (uint32_t *) (USB_BACKEND_MEMORY_BASE .. USB_BACKEND_MEMORY_END));
+ @ assigns *((uint32_t *) (USB_BACKEND_MEMORY_BASE .. USB_BACKEND_MEMORY_END)), usbotghs_ctx.in_eps[ep_id], GHOST_in_eps[ep_id].state, GHOST_opaque_drv_privates;
+ */
+mbed_error_t usbotghs_send_datav(const usbotghs_iovec_t *iov, uint8_t iovcnt, uint8_t ep_id)
+{
+    /* no public (exported) variable is set. This GHOST var is used as countermeasure to public assignment
+     * specification for functions that assign private global content */
+    //@ ghost GHOST_opaque_drv_privates = 1;
+
+    mbed_error_t errcode = MBED_ERROR_NONE;
+    usbotghs_context_t *ctx = usbotghs_get_context();
+    usbotghs_ep_t *ep = NULL;
+    uint32_t size = 0;
+    bool queued = false;
+    uint32_t iepm = 0;
+    usbotghs_xmit_req_t req = { 0 };
 
-            /*@
-              @ loop invariant \valid(ep->fifo+(0..ep->fifo_size));
-              @ loop invariant \separated(ep->fifo + (0 .. ep->fifo_size-1), (uint32_t *) (USB_BACKEND_MEMORY_BASE .. USB_BACKEND_MEMORY_END));
-              @ loop invariant 0<=cpt<= CPT_HARD ;
-              @ loop assigns cpt, errcode ;
-              @ loop variant CPT_HARD - cpt;
-              */
-        for(uint32_t cpt=0; cpt<CPT_HARD; cpt++){
-            if (get_reg(r_CORTEX_M_USBOTG_HS_DTXFSTS(ep_id), USBOTG_HS_DTXFSTS_INEPTFSAV)  < ((residual_size / 4) + (residual_size & 3 ? 1 : 0))) {
-#endif
-               if (get_reg(r_CORTEX_M_USBOTG_HS_DSTS, USBOTG_HS_DSTS_SUSPSTS)){
-                    log_printf("[USBOTG][HS] Suspended!\n");
-                    errcode = MBED_ERROR_BUSY;
-                    goto err;
-                }
-#ifdef __FRAMAC__
-            }
-#endif
-        }
-        /* last block, no more WIP */
 #if CONFIG_USR_DRV_USBOTGHS_MODE_DEVICE
-        set_u8_with_membarrier(&ep->state, USBOTG_HS_EP_STATE_DATA_IN);
-            //@ ghost GHOST_in_eps[ep_id].state = usbotghs_ctx.in_eps[ep_id].state;
+    if (ep_id >= USBOTGHS_MAX_IN_EP) {
+        errcode = MBED_ERROR_INVPARAM;
+        goto err_init;
+    }
+    ep = &ctx->in_eps[ep_id];
 #else
 # error "not yet supported!"
 #endif
-        /* set the EP state to DATA OUT WIP (not yet transmitted) */
-        log_printf("[USBOTGHS] write %d len data on ep %d core fifo\n", residual_size, ep->id);
-        /*@ assert residual_size <= fifo_size; */
-        usbotghs_write_epx_fifo(residual_size, ep->id);
-        /* wait for XMIT data to be transfered (wait for iepint (or oepint in
-         * host mode) to set the EP in correct state */
-        residual_size = 0;
+    if (iov == NULL || iovcnt == 0) {
+        errcode = MBED_ERROR_INVPARAM;
+        goto err_init;
     }
-
-    if(get_reg(r_CORTEX_M_USBOTG_HS_DSTS, USBOTG_HS_DSTS_SUSPSTS)) {
-        errcode = MBED_ERROR_BUSY;
-        goto err;
+    /*@
+      @ loop invariant 0 <= i <= iovcnt;
+      @ loop assigns i, size, errcode;
+      @ loop variant iovcnt - i;
+      */
+    for (uint8_t i = 0; i < iovcnt; ++i) {
+        if (iov[i].base == NULL || (size + iov[i].len) < size) {
+            errcode = MBED_ERROR_INVPARAM;
+            goto err_init;
+        }
+        size += iov[i].len;
+    }
+    if (size == 0) {
+        errcode = MBED_ERROR_INVPARAM;
+        goto err_init;
+    }
+    if (ep->configured != true || ep->mpsize == 0) {
+        log_printf("[USBOTG][HS] ep %d not configured\n", ep->id);
+        errcode = MBED_ERROR_INVSTATE;
+        goto err_init;
+    }
+#if CONFIG_USR_DEV_USBOTGHS_DMA
+    /* the core DMA can only read a contiguous buffer */
+    errcode = MBED_ERROR_UNSUPORTED_CMD;
+    goto err_init;
+#endif
+    /* Hold off this EP IN events while its transfer is set */
+    iepm = usbotghs_in_ep_mask(ep_id);
+    /* EP busy ? queue the transfer */
+    req.size = size;
+    req.iov = iov;
+    req.iov_cnt = iovcnt;
+    if ((errcode = usbotghs_xmit_queue_if_busy(&req, ep_id, &queued)) != MBED_ERROR_NONE || queued) {
+        goto err_unmask;
+    }
+    if ((errcode = usbotghs_set_xmit_fifov(iov, iovcnt, size, ep_id)) != MBED_ERROR_NONE) {
+        log_printf("[USBOTG][HS] failed to set EP%d TxFIFO!\n", ep_id);
+        goto err_unmask;
     }
+    errcode = usbotghs_start_xmit(ep, ep_id);
+err_unmask:
+    usbotghs_in_ep_unmask(iepm);
     return errcode;
-err:
-    /* From whatever we come from to this point, the current transfer is complete
-     * (with failure or not on upper level). IEPINT can inform the upper layer */
-    set_u8_with_membarrier(&ep->state, USBOTG_HS_EP_STATE_IDLE);
+err_init:
+    /* a rejected call leaves the EP state untouched: a transfer may be in
+     * progress on it */
+    return errcode;
+}
+
+/*
+ * Word-packed variant of usbotghs_send_data(): the payload is a constant image
+ * of USBOTGHS_WORDS_LEN(size) little-endian words, written as is into the Core
+ * TxFIFO.
+ */
+/*@
+ @ requires \separated(GHOST_in_eps+(0 .. USBOTGHS_MAX_IN_EP - 1),&GHOST_opaque_drv_privates,&usbotghs_ctx, (uint32_t *) (USB_BACKEND_MEMORY_BASE .. USB_BACKEND_MEMORY_END));
+ @ assigns *((uint32_t *) (USB_BACKEND_MEMORY_BASE .. USB_BACKEND_MEMORY_END)), usbotghs_ctx.in_eps[ep_id], GHOST_in_eps[ep_id].state, GHOST_opaque_drv_privates;
+ */
+mbed_error_t usbotghs_send_words(const uint32_t *src, uint32_t size, uint8_t ep_id)
+{
+    /* no public (exported) variable is set. This GHOST var is used as countermeasure to public assignment
+     * specification for functions that assign private global content */
+    //@ ghost GHOST_opaque_drv_privates = 1;
+
+    mbed_error_t errcode = MBED_ERROR_NONE;
+    usbotghs_context_t *ctx = usbotghs_get_context();
+    usbotghs_ep_t *ep = NULL;
+    bool queued = false;
+    uint32_t iepm = 0;
+    usbotghs_xmit_req_t req = { 0 };
+
 #if CONFIG_USR_DRV_USBOTGHS_MODE_DEVICE
-    //@ ghost GHOST_in_eps[ep_id].state = usbotghs_ctx.in_eps[ep_id].state;
+    if (ep_id >= USBOTGHS_MAX_IN_EP) {
+        errcode = MBED_ERROR_INVPARAM;
+        goto err_init;
+    }
+    ep = &ctx->in_eps[ep_id];
 #else
 # error "not yet supported!"
 #endif
-err_init:
+    if (src == NULL || size == 0) {
+        errcode = MBED_ERROR_INVPARAM;
+        goto err_init;
+    }
+    if (ep->configured != true || ep->mpsize == 0) {
+        log_printf("[USBOTG][HS] ep %d not configured\n", ep->id);
+        errcode = MBED_ERROR_INVSTATE;
+        goto err_init;
+    }
+    /* Hold off this EP IN events while its transfer is set */
+    iepm = usbotghs_in_ep_mask(ep_id);
+    /* EP busy ? queue the transfer */
+    req.src = (uint8_t*)src;
+    req.size = size;
+    req.words = true;
+    if ((errcode = usbotghs_xmit_queue_if_busy(&req, ep_id, &queued)) != MBED_ERROR_NONE || queued) {
+        goto err_unmask;
+    }
+    if ((errcode = usbotghs_set_xmit_fifo_words(src, size, ep_id)) != MBED_ERROR_NONE) {
+        log_printf("[USBOTG][HS] failed to set EP%d TxFIFO!\n", ep_id);
+        goto err_unmask;
+    }
+    errcode = usbotghs_start_xmit(ep, ep_id);
+err_unmask:
+    usbotghs_in_ep_unmask(iepm);
     return errcode;
-err_fragment:
-    set_u8_with_membarrier(&ep->state, USBOTG_HS_EP_STATE_DATA_IN);
+err_init:
     return errcode;
 }
 
-
 /*
- * Send a Zero-length packet into EP 'ep'
+ * Send a Zero-length packet into EP 'ep'. As other transfers, a ZLP requested
+ * while a data IN EP is busy is queued behind the current transfer.
  */
 
 /*@
   @ requires \separated(&GHOST_opaque_drv_privates, ((uint32_t *) (USB_BACKEND_MEMORY_BASE .. USB_BACKEND_MEMORY_END)), &usbotghs_ctx);
-   @ assigns *((uint32_t *) (USB_BACKEND_MEMORY_BASE .. USB_BACKEND_MEMORY_END)) ;
+   @ assigns *((uint32_t *) (USB_BACKEND_MEMORY_BASE .. USB_BACKEND_MEMORY_END)), usbotghs_ctx.in_eps[ep_id], GHOST_in_eps[ep_id].state, GHOST_opaque_drv_privates;
 
 
    // private, more precise, behaviors
@@ -782,6 +1017,9 @@ mbed_error_t usbotghs_send_zlp(uint8_t ep_id)
     mbed_error_t errcode = MBED_ERROR_NONE;
     usbotghs_context_t *ctx = usbotghs_get_context();
     usbotghs_ep_t *ep = NULL;
+    bool queued = false;
+    uint32_t iepm = 0;
+    usbotghs_xmit_req_t req = { 0 };
 
     /* no public (exported) variable is set. This GHOST var is used as countermeasure to public assignment
      * specification for functions that assign private global content */
@@ -805,6 +1043,15 @@ mbed_error_t usbotghs_send_zlp(uint8_t ep_id)
         goto err;
     }
 
+    if (ep_id > 0) {
+        /* Hold off this EP IN events while its transfer is set */
+        iepm = usbotghs_in_ep_mask(ep_id);
+        /* EP busy ? queue the ZLP (zero-sized request) */
+        if ((errcode = usbotghs_xmit_queue_if_busy(&req, ep_id, &queued)) != MBED_ERROR_NONE || queued) {
+            goto err_unmask;
+        }
+    }
+
     /*
      * Be sure that previous transmission is finished before configuring another one
      */
@@ -818,27 +1065,114 @@ mbed_error_t usbotghs_send_zlp(uint8_t ep_id)
 
     for(uint8_t cpt=0; cpt<CPT_HARD; cpt++){
         if (get_reg(r_CORTEX_M_USBOTG_HS_DTXFSTS(ep_id), USBOTG_HS_DTXFSTS_INEPTFSAV) <
-                USBOTG_HS_TX_CORE_FIFO_SZ / 4) {
+                usbotghs_get_txfifo_depth(ep_id)) {
             // Are we suspended?
             if (get_reg(r_CORTEX_M_USBOTG_HS_DSTS, USBOTG_HS_DSTS_SUSPSTS)){
                 log_printf("[USBOTG][HS] Suspended!\n");
                 errcode = MBED_ERROR_BUSY;
-                goto err;
+                goto err_unmask;
             }
         }
     }
 
     log_printf("[USBOTG][HS] Sending ZLP on ep %d\n", ep_id);
     /* device mode ONLY */
-    /* EP is now in DATA_OUT state */
-    // XXX: needed for ZLP ? ep->state = USBOTG_HS_EP_STATE_DATA_OUT;
+    if (ep_id > 0) {
+        usbotghs_start_xmit_zlp(ep, ep_id);
+    } else {
+        usbotghs_xmit_zlp(ep_id);
+    }
+
+err_unmask:
+    usbotghs_in_ep_unmask(iepm);
+err:
+    return errcode;
+}
+
+/*
+ * Start a zero-length packet transfer on the given IN EP. The caller is
+ * responsible for the EP state checks.
+ */
+/*@
+  @ requires ep_id < USBOTGHS_MAX_IN_EP;
+  @ assigns *((uint32_t *) (USB_BACKEND_MEMORY_BASE .. USB_BACKEND_MEMORY_END));
+  */
+void usbotghs_xmit_zlp(uint8_t ep_id)
+{
     /* 1. Program the OTG_HS_DIEPTSIZx register for the transfer size
      * and the corresponding packet count. */
     set_reg_value(r_CORTEX_M_USBOTG_HS_DIEPTSIZ(ep_id),1,USBOTG_HS_DIEPTSIZ_PKTCNT_Msk(ep_id),USBOTG_HS_DIEPTSIZ_PKTCNT_Pos(ep_id));
     set_reg_value(r_CORTEX_M_USBOTG_HS_DIEPTSIZ(ep_id),0,USBOTG_HS_DIEPTSIZ_XFRSIZ_Msk(ep_id),USBOTG_HS_DIEPTSIZ_XFRSIZ_Pos(ep_id));
     /* 2. Enable endpoint for transmission. */
     set_reg_bits(r_CORTEX_M_USBOTG_HS_DIEPCTL(ep_id),USBOTG_HS_DIEPCTL_CNAK_Msk | USBOTG_HS_DIEPCTL_EPENA_Msk);
+}
+
+/*
+ * Set the ZLP termination policy of the given IN EP. When enabled, a transfer
+ * which size is a multiple of the EP mpsize is terminated by a ZLP sent by
+ * the driver, and the upper layer is informed of the transfer completion once
+ * the ZLP is sent.
+ */
+/*@
+  @ requires \separated(&GHOST_opaque_drv_privates, &usbotghs_ctx);
+  @ assigns GHOST_opaque_drv_privates, usbotghs_ctx.in_eps[ep_id].auto_zlp;
+  */
+mbed_error_t usbotghs_endpoint_set_auto_zlp(uint8_t ep_id, bool enable)
+{
+    mbed_error_t errcode = MBED_ERROR_NONE;
+    usbotghs_context_t *ctx = usbotghs_get_context();
 
+    /* no public (exported) variable is set. This GHOST var is used as countermeasure to public assignment
+     * specification for functions that assign private global content */
+    //@ ghost GHOST_opaque_drv_privates = 1;
+
+    if (ep_id >= USBOTGHS_MAX_IN_EP) {
+        errcode = MBED_ERROR_INVPARAM;
+        goto err;
+    }
+    if (ctx->in_eps[ep_id].configured == false) {
+        errcode = MBED_ERROR_INVSTATE;
+        goto err;
+    }
+    /* the policy is applied from the next transfer on */
+    set_bool_with_membarrier(&(ctx->in_eps[ep_id].auto_zlp), enable);
+err:
+    return errcode;
+}
+
+/*
+ * Set the completion policy of the given data OUT EP (see
+ * usbotghs_ep_completion_t). The policy is read when a transfer is armed and
+ * when it completes: it can't be changed while the EP is receiving.
+ */
+/*@
+  @ requires \separated(&GHOST_opaque_drv_privates, &usbotghs_ctx, ((uint32_t *) (USB_BACKEND_MEMORY_BASE .. USB_BACKEND_MEMORY_END)));
+  @ assigns GHOST_opaque_drv_privates, usbotghs_ctx.out_eps[ep_id].completion;
+  */
+mbed_error_t usbotghs_endpoint_set_completion(uint8_t ep_id, usbotghs_ep_completion_t completion)
+{
+    mbed_error_t errcode = MBED_ERROR_NONE;
+    usbotghs_context_t *ctx = usbotghs_get_context();
+
+    /* no public (exported) variable is set. This GHOST var is used as countermeasure to public assignment
+     * specification for functions that assign private global content */
+    //@ ghost GHOST_opaque_drv_privates = 1;
+
+    /* EP0 always completes on short packet */
+    if (ep_id == 0 || ep_id >= USBOTGHS_MAX_OUT_EP ||
+        completion > USBOTG_HS_EP_COMPLETE_EVERY_PKT) {
+        errcode = MBED_ERROR_INVPARAM;
+        goto err;
+    }
+    if (ctx->out_eps[ep_id].configured == false) {
+        errcode = MBED_ERROR_INVSTATE;
+        goto err;
+    }
+    if (get_reg(r_CORTEX_M_USBOTG_HS_DOEPCTL(ep_id), USBOTG_HS_DOEPCTL_EPENA)) {
+        errcode = MBED_ERROR_BUSY;
+        goto err;
+    }
+    set_u8_with_membarrier(&(ctx->out_eps[ep_id].completion), (uint8_t)completion);
 err:
     return errcode;
 }
@@ -1168,6 +1502,7 @@ mbed_error_t usbotghs_configure_endpoint(uint8_t                 ep,
             ctx->in_eps[ep].state = USBOTG_HS_EP_STATE_IDLE;
             //@ ghost GHOST_in_eps[ep].state = usbotghs_ctx.in_eps[ep].state;
             ctx->in_eps[ep].handler = handler;
+            ctx->in_eps[ep].auto_zlp = false;
             if (ep < USBOTGHS_MAX_OUT_EP) {
                 ctx->out_eps[ep].configured = false;
             }
@@ -1207,6 +1542,7 @@ mbed_error_t usbotghs_configure_endpoint(uint8_t                 ep,
             ctx->out_eps[ep].state = USBOTG_HS_EP_STATE_IDLE;
             //@ ghost GHOST_out_eps[ep].state = usbotghs_ctx.out_eps[ep].state;
             ctx->out_eps[ep].handler = handler;
+            ctx->out_eps[ep].completion = USBOTG_HS_EP_COMPLETE_SHORT_PKT;
             if (ep < USBOTGHS_MAX_IN_EP) {
                 ctx->in_eps[ep].configured = false;
             }
@@ -1247,6 +1583,7 @@ mbed_error_t usbotghs_configure_endpoint(uint8_t                 ep,
             ctx->out_eps[ep].state = USBOTG_HS_EP_STATE_IDLE;
             //@ ghost GHOST_out_eps[ep].state = usbotghs_ctx.out_eps[ep].state;
             ctx->out_eps[ep].handler = handler;
+            ctx->out_eps[ep].completion = USBOTG_HS_EP_COMPLETE_SHORT_PKT;
 
             ctx->in_eps[ep].id = ep;
             ctx->in_eps[ep].dir =  USBOTG_HS_EP_DIR_IN;
@@ -1256,6 +1593,7 @@ mbed_error_t usbotghs_configure_endpoint(uint8_t                 ep,
             ctx->in_eps[ep].state = USBOTG_HS_EP_STATE_IDLE;
             //@ ghost GHOST_in_eps[ep].state = usbotghs_ctx.in_eps[ep].state;
             ctx->in_eps[ep].handler = handler;
+            ctx->in_eps[ep].auto_zlp = false;
 
             /* Maximum packet size */
             set_reg_value(r_CORTEX_M_USBOTG_HS_DOEPCTL(ep),mpsize, USBOTG_HS_DOEPCTL_MPSIZ_Msk(ep),USBOTG_HS_DOEPCTL_MPSIZ_Pos(ep));
@@ -1337,8 +1675,8 @@ mbed_error_t usbotghs_deconfigure_endpoint(uint8_t ep)
 
     if(ep < USBOTGHS_MAX_OUT_EP) {
         if (ctx->out_eps[ep].configured == true) {
-            /* FIX: flushing fifo for each EP */
-            usbotghs_rxfifo_flush(ep);
+            /* the RxFIFO is shared by all the OUT EPs and is not flushed here: packets
+             * still queued for this EP are dropped one by one by the RXFLVL handler */
 
             clear_reg_bits(r_CORTEX_M_USBOTG_HS_DOEPCTL(ep),
                     USBOTG_HS_DOEPCTL_EPENA_Msk);
@@ -1347,7 +1685,11 @@ mbed_error_t usbotghs_deconfigure_endpoint(uint8_t ep)
         }
     }
 
-    set_reg_bits(r_CORTEX_M_USBOTG_HS_GINTMSK, USBOTG_HS_GINTMSK_NPTXFEM_Msk | USBOTG_HS_GINTMSK_RXFLVLM_Msk);
+    set_reg_bits(r_CORTEX_M_USBOTG_HS_GINTMSK, USBOTG_HS_GINTMSK_NPTXFEM_Msk);
+#if !CONFIG_USR_DEV_USBOTGHS_DMA
+    /* no RXFLVL in DMA mode: the core DMA writes the received packets */
+    set_reg_bits(r_CORTEX_M_USBOTG_HS_GINTMSK, USBOTG_HS_GINTMSK_RXFLVLM_Msk);
+#endif
 
     /*@ assert (errcode == MBED_ERROR_NONE || errcode == MBED_ERROR_INVPARAM); */
     return errcode;
@@ -1444,7 +1786,11 @@ mbed_error_t usbotghs_deactivate_endpoint(uint8_t ep_id,
             break;
 
     }
-    set_reg_bits(r_CORTEX_M_USBOTG_HS_GINTMSK, USBOTG_HS_GINTMSK_NPTXFEM_Msk | USBOTG_HS_GINTMSK_RXFLVLM_Msk);
+    set_reg_bits(r_CORTEX_M_USBOTG_HS_GINTMSK, USBOTG_HS_GINTMSK_NPTXFEM_Msk);
+#if !CONFIG_USR_DEV_USBOTGHS_DMA
+    /* no RXFLVL in DMA mode: the core DMA writes the received packets */
+    set_reg_bits(r_CORTEX_M_USBOTG_HS_GINTMSK, USBOTG_HS_GINTMSK_RXFLVLM_Msk);
+#endif
 
     /*@ assert errcode == MBED_ERROR_NONE; */
 err:
@@ -1644,8 +1990,14 @@ usb_backend_drv_ep_state_t  usb_backend_drv_get_ep_state(uint8_t epnum, usb_back
     __attribute__ ((alias("usbotghs_get_ep_state")));
 mbed_error_t usb_backend_drv_send_data(uint8_t *src, uint32_t size, uint8_t ep)
     __attribute__ ((alias("usbotghs_send_data")));
+mbed_error_t usb_backend_drv_send_datav(const usbotghs_iovec_t *iov, uint8_t iovcnt, uint8_t ep)
+    __attribute__ ((alias("usbotghs_send_datav")));
+mbed_error_t usb_backend_drv_send_words(const uint32_t *src, uint32_t size, uint8_t ep)
+    __attribute__ ((alias("usbotghs_send_words")));
 mbed_error_t usb_backend_drv_send_zlp(uint8_t ep)
     __attribute__ ((alias("usbotghs_send_zlp")));
+mbed_error_t usb_backend_drv_set_auto_zlp(uint8_t ep, bool enable)
+    __attribute__ ((alias("usbotghs_endpoint_set_auto_zlp")));
 void         usb_backend_drv_set_address(uint16_t addr)
     __attribute__ ((alias("usbotghs_set_address")));
     /* USB protocol standard handshaking */
@@ -88,6 +88,54 @@ typedef enum {
     USBOTG_HS_SPEED_HS = 2, /* aka High speed (USB 2.0) */
 } usbotghs_speed_t;
 
+/*
+ * RAM FIFO ownership. The RAM FIFO is handed over, with a memory barrier, from
+ * the upper layer to the driver when it is set (usbotghs_set_recv_fifo(),
+ * usbotghs_set_xmit_fifo() and friends) and back from the driver to the upper
+ * layer when the transfer completes (before calling the upper layer handler).
+ * Between these two ownership changes, the driver moves each packet from/to
+ * the RAM FIFO with plain accesses: the packet copy is only marked in flight,
+ * so that a reentrant call (e.g. an upper layer handler executed in ISR
+ * context while the main thread is copying a packet) is detected, without any
+ * per-packet memory barrier. The ISR runs on the same core and never is
+ * preempted by the main thread, a compiler barrier is enough for that.
+ */
+typedef enum {
+    USBOTG_HS_FIFO_DRIVER_OWNED = 0, /* the driver moves packets from/to the RAM FIFO */
+    USBOTG_HS_FIFO_APP_OWNED    = 1, /* the upper layer is (re)setting the RAM FIFO */
+    USBOTG_HS_FIFO_INFLIGHT     = 2, /* a packet is being copied from/to the Core FIFO */
+} usbotghs_fifo_owner_t;
+
+#ifdef __FRAMAC__
+# define usbotghs_compiler_barrier()
+#else
+# define usbotghs_compiler_barrier() __asm__ volatile("" ::: "memory")
+#endif
+
+/*
+ * OUT EPs receive modes
+ */
+typedef enum {
+    USBOTG_HS_RECV_MODE_FIFO   = 0, /* one RAM FIFO per transfer, set by usbotghs_set_recv_fifo() */
+    USBOTG_HS_RECV_MODE_RING   = 1, /* pre-posted receive buffers ring */
+    USBOTG_HS_RECV_MODE_STREAM = 2, /* continuous circular buffer */
+} usbotghs_recv_mode_t;
+
+#ifndef CONFIG_USR_DEV_USBOTGHS_XMIT_QUEUE_DEPTH
+# define CONFIG_USR_DEV_USBOTGHS_XMIT_QUEUE_DEPTH 4
+#endif
+
+/*
+ * pending IN transfer, queued while the EP is busy
+ */
+typedef struct {
+    uint8_t                *src;      /* contiguous RAM FIFO (if iov is NULL) */
+    uint32_t                size;     /* transfer size, in bytes */
+    const usbotghs_iovec_t *iov;      /* segments (vectored transfer) */
+    uint8_t                 iov_cnt;  /* number of segments */
+    bool                    words;    /* src is a word-packed image */
+} usbotghs_xmit_req_t;
+
 /*
  * local context hold by the driver
  */
@@ -103,19 +151,43 @@ typedef struct {
     uint8_t            *fifo;         /* associated RAM FIFO (recv) */
     uint32_t            fifo_idx;     /* current FIFO index  (recv) */
     uint32_t            fifo_size;    /* associated RAM FIFO max size (recv) */
-    bool                fifo_lck;     /* DMA, locking mechanism (recv) */
+    uint8_t            *split_payload; /* payload RAM FIFO, NULL if not split (recv) */
+    uint32_t            split_hdr_size; /* header part size of a split RAM FIFO (recv) */
+    uint8_t             fifo_owner;   /* usbotghs_fifo_owner_t, RAM FIFO ownership */
     bool                core_txfifo_empty; /* core TxFIFO (Half) empty */
+    const usbotghs_iovec_t *iov;      /* xmit segments, NULL if fifo is contiguous (xmit) */
+    uint8_t             iov_cnt;      /* number of xmit segments (xmit) */
+    uint8_t             iov_idx;      /* current xmit segment (xmit) */
+    uint32_t            iov_off;      /* offset in current xmit segment (xmit) */
+    bool                fifo_words;   /* fifo is a word-packed image (xmit) */
+    bool                auto_zlp;     /* terminate mpsize multiple transfers with a ZLP (xmit) */
+    bool                zlp_pending;  /* current transfer still requires its ZLP (xmit) */
+    uint8_t             recv_mode;    /* usbotghs_recv_mode_t (recv) */
+    uint8_t             completion;   /* usbotghs_ep_completion_t (recv) */
+    bool                dma_bounce;   /* current transfer copied through the EP bounce buffer (DMA) */
 } usbotghs_ep_t;
 
+/* EP0 SETUP packet size */
+#define USBOTGHS_SETUP_PKT_SZ   8
+/*
+ * EP0 SETUP packet slots: up to 3 back-to-back SETUP packets accepted by the core
+ * (DOEPTSIZ0.STUPCNT), plus the one being handled by the upper layer
+ */
+#define USBOTGHS_SETUP_SLOTS    4
+
 typedef struct {
     device_t            dev;             /* associated device_t structure */
     int                 dev_desc;        /* device descriptor */
     usbotghs_dev_mode_t mode;            /* current OTG mode (host or device) */
     bool                gonak_req;       /* global OUT NAK requested */
     bool                gonak_active;    /* global OUT NAK effective */
-    uint16_t            fifo_idx;        /* consumed Core FIFO */
+    uint16_t            fifo_idx;        /* consumed Core FIFO (32bits words) */
     usbotghs_ep_t       in_eps[USBOTGHS_MAX_IN_EP];       /* list of HW supported IN EPs */
     usbotghs_ep_t       out_eps[USBOTGHS_MAX_OUT_EP];      /* list of HW supported OUT EPs */
+    uint8_t             setup_pkts[USBOTGHS_SETUP_SLOTS][USBOTGHS_SETUP_PKT_SZ]; /* received SETUP packets */
+    uint8_t             setup_head;      /* committed SETUP packets (free-running) */
+    uint8_t             setup_tail;      /* SETUP packets handed to the upper layer (free-running) */
+    bool                setup_wip;       /* slot setup_head holds a not yet committed SETUP packet */
     uint8_t             speed;        /* device enumerated speed, default HS */
 } usbotghs_context_t;
 
@@ -127,5 +199,12 @@ usbotghs_context_t usbotghs_ctx = { 0 };
 
 usbotghs_context_t *usbotghs_get_context(void);
 
+/* start the next queued IN transfer of the given EP, if any, counting the
+ * queued transfers dropped on the way */
+mbed_error_t usbotghs_xmit_next(uint8_t ep_id, uint8_t *dropped);
+
+/* start a zero-length packet transfer on the given IN EP */
+void usbotghs_xmit_zlp(uint8_t ep_id);
+
 
 #endif /*!USBOTGHS_H_ */
@@ -31,6 +31,7 @@
 #include "usbotghs_fifos.h"
 #include "usbotghs.h"
 #include "usbotghs_handler.h"
+#include "usbotghs_pool.h"
 #include "generated/usb_otg_hs.h"
 
 #if defined(__FRAMAC__)
@@ -40,8 +41,23 @@
 #endif/*!__FRAMAC__*/
 
 
-/* Hardware IP FIFO size */
+/* Hardware IP FIFO size, in bytes */
 #define CORE_FIFO_LENGTH 4096
+/* Hardware IP FIFO size, in 32bits words (FIFO registers unit) */
+#define CORE_FIFO_WORDS  (CORE_FIFO_LENGTH / 4)
+/* minimum depth of a TxFIFO, in 32bits words */
+#define TX_CORE_FIFO_MIN_DEPTH 16
+
+#ifndef CONFIG_USR_DEV_USBOTGHS_BULK_IN_FIFO_PACKETS
+# define CONFIG_USR_DEV_USBOTGHS_BULK_IN_FIFO_PACKETS 4
+#endif
+
+#ifndef CONFIG_USR_DEV_USBOTGHS_DMA_BOUNCE_SIZE
+# define CONFIG_USR_DEV_USBOTGHS_DMA_BOUNCE_SIZE 128
+#endif
+#ifndef CONFIG_USR_DEV_USBOTGHS_RECV_RING_DEPTH
+# define CONFIG_USR_DEV_USBOTGHS_RECV_RING_DEPTH 4
+#endif
 
 /*@
   @ requires ep < USBOTGHS_MAX_OUT_EP;
@@ -72,9 +88,12 @@ mbed_error_t usbotghs_read_core_fifo(uint8_t * const dest, const uint32_t size,
     mbed_error_t errcode = MBED_ERROR_NONE;
 #if CONFIG_USR_DEV_USBOTGHS_DMA
     /*
-     * In DMA mode, the copy is done using DMA
+     * In DMA mode, the copy is done by the core DMA, RXFLVL being masked:
+     * nothing to pop here (see usbotghs_recv_dma_complete())
      */
-
+    (void)dest;
+    (void)size;
+    (void)ep;
 #else
     /*
      * With DMA mode deactivated, the copy is done manually
@@ -84,6 +103,34 @@ mbed_error_t usbotghs_read_core_fifo(uint8_t * const dest, const uint32_t size,
 
     /* 4 bytes aligned copy from EP FIFO */
     uint32_t offset = 0;
+    uint32_t i = 0;
+
+#if !defined(__FRAMAC__)
+    /*
+     * word-aligned destination buffer: pop whole words, by bursts of 8 words,
+     * from consecutive addresses of the 4KB EP FIFO window (any address of
+     * the window pops from the RxFIFO).
+     */
+    if (((physaddr_t)dest & 3) == 0) {
+        uint32_t *dest_w = (uint32_t*)dest;
+        volatile uint32_t *fifo_w = USBOTG_HS_DEVICE_FIFO(ep);
+
+        for (; (i + 8) <= size_4bytes; i += 8, dest_w += 8) {
+            dest_w[0] = fifo_w[0];
+            dest_w[1] = fifo_w[1];
+            dest_w[2] = fifo_w[2];
+            dest_w[3] = fifo_w[3];
+            dest_w[4] = fifo_w[4];
+            dest_w[5] = fifo_w[5];
+            dest_w[6] = fifo_w[6];
+            dest_w[7] = fifo_w[7];
+        }
+        for (; i < size_4bytes; i++, dest_w++) {
+            dest_w[0] = fifo_w[0];
+        }
+        offset = 4 * size_4bytes;
+    }
+#endif
 
     /*@
       @ loop invariant 0 <= i <= size_4bytes;
@@ -95,7 +142,7 @@ mbed_error_t usbotghs_read_core_fifo(uint8_t * const dest, const uint32_t size,
       @ loop assigns *(dest+(0..4*size_4bytes -1));
       @ loop variant (size_4bytes - i);
       */
-    for (uint32_t i = 0; i < size_4bytes; i++) {
+    for (; i < size_4bytes; i++) {
         tmp = *(USBOTG_HS_DEVICE_FIFO(ep));
         /*@ assert size_4bytes >=1 ==> size >=4*size_4bytes; */
         dest[offset + 0] = tmp & 0xff;
@@ -113,8 +160,7 @@ mbed_error_t usbotghs_read_core_fifo(uint8_t * const dest, const uint32_t size,
     /*@ assert offset == 4*size_4bytes; */
     /*@ assert size == (size_4bytes * 4) + (size%4); */
     /*@ assert offset == size - (size%4); */
-        request_data_membarrier();
-        /* read the residue */
+    /* read the residue (last 1 to 3 bytes) */
     switch (size % 4) {
     case 0:
       /*@ assert offset == size ; */
@@ -141,7 +187,6 @@ mbed_error_t usbotghs_read_core_fifo(uint8_t * const dest, const uint32_t size,
       /* should be dead code */
       break;
     }
-    request_data_membarrier();
 #endif
     return errcode;
 }
@@ -157,30 +202,63 @@ mbed_error_t usbotghs_read_core_fifo(uint8_t * const dest, const uint32_t size,
     @ requires size > 0;
     @ requires \valid_read(src + (0 .. size-1));
     @ requires (uint32_t *)USB_BACKEND_MEMORY_BASE <= USBOTG_HS_DEVICE_FIFO(ep) <= (uint32_t *)USB_BACKEND_MEMORY_END ;
-    @ requires \separated(((uint32_t *)((int)(0x40040000 + (int)(0x1000 * (int)((int)ep + 1))))), ((uint32_t *) r_CORTEX_M_USBOTG_HS_GINTMSK),src) ;
-    @ assigns *((uint32_t *)((int)(0x40040000 + (int)(0x1000 * (int)((int)ep + 1))))), *((uint32_t *) r_CORTEX_M_USBOTG_HS_GINTMSK),*src;
+    @ requires \separated(((uint32_t *)((int)(0x40040000 + (int)(0x1000 * (int)((int)ep + 1))))), src) ;
+    @ assigns *((uint32_t *)((int)(0x40040000 + (int)(0x1000 * (int)((int)ep + 1)))));
 */
-static inline void usbotghs_write_core_fifo(uint8_t *src, const uint32_t size, uint8_t ep)
+static inline void usbotghs_write_core_fifo(const uint8_t *src, const uint32_t size, uint8_t ep)
 {
 #if CONFIG_USR_DEV_USBOTGHS_DMA
-    /* configuring DMA for this FIFO */
-    /* set EP0 FIFO using local buffer */
-    /* 3. lock FIFO (while DMA is running) */
-    /* 4. set Endpoint enabled (start the DMA transfer) */
-    /* 5. unlock FIFO now that DMA transfer is finished */
+    /* the RAM FIFO is read by the core DMA from DIEPDMA, set by
+     * usbotghs_set_xmit_fifo(): no Core TxFIFO write */
+    (void)src;
+    (void)size;
+    (void)ep;
 #else
 	uint32_t size_4bytes = size / 4;
     uint32_t tmp = 0;
+    uint32_t i = 0;
     log_printf("[USBOTG][HS] writing %d bytes to EP %d core TxFIFO\n", size, ep);
-    // IP should has its own interrupts disable during ISR execution
-    uint32_t oldmask = read_reg_value(r_CORTEX_M_USBOTG_HS_GINTMSK);
-    /* mask interrupts while writting Core FIFO */
-    set_reg_value(r_CORTEX_M_USBOTG_HS_GINTMSK, 0, 0xffffffff, 0);
+    /*
+     * The core interrupts are not masked here: the EP TxFIFO is only written by
+     * the owner of the EP current transfer. The main thread masks the EP IN
+     * interrupt (DAINTMSK) while starting a transfer, so that iepint_handler()
+     * can't write into the same TxFIFO, while RxFIFO and other EPs events are
+     * still serviced.
+     */
 
     /* manual copy to Core FIFO */
     /* there is no overflow on src here, as the C divisor is natural integer
      * divisor, truncating the divised size value to the first integer below
      */
+#if !defined(__FRAMAC__)
+    /*
+     * word-aligned source buffer: push whole words, by bursts of 8 words.
+     * Any address of the 4KB EP FIFO window pushes to the EP TxFIFO, so
+     * the burst is written on consecutive addresses of the window, letting
+     * the compiler use multiple load/store instructions. The byte path
+     * below handles unaligned sources, and the tail is still written by
+     * the residue switch.
+     */
+    if (((physaddr_t)src & 3) == 0) {
+        const uint32_t *src_w = (const uint32_t*)src;
+        volatile uint32_t *fifo_w = USBOTG_HS_DEVICE_FIFO(ep);
+
+        for (; (i + 8) <= size_4bytes; i += 8, src_w += 8) {
+            fifo_w[0] = src_w[0];
+            fifo_w[1] = src_w[1];
+            fifo_w[2] = src_w[2];
+            fifo_w[3] = src_w[3];
+            fifo_w[4] = src_w[4];
+            fifo_w[5] = src_w[5];
+            fifo_w[6] = src_w[6];
+            fifo_w[7] = src_w[7];
+        }
+        for (; i < size_4bytes; i++, src_w++) {
+            fifo_w[0] = src_w[0];
+        }
+        src = (const uint8_t*)src_w;
+    }
+#endif
 
     /*@
         @ loop invariant 0 <= i <= size_4bytes;
@@ -191,7 +269,7 @@ static inline void usbotghs_write_core_fifo(uint8_t *src, const uint32_t size, u
         @ loop variant (size_4bytes - i) ;
     */
 
-    for (uint32_t i = 0; i < size_4bytes; i++, src += 4){
+    for (; i < size_4bytes; i++, src += 4){
         tmp = src[0];
         tmp |= (uint32_t)(src[1] & 0xff) << 8;
         tmp |= (uint32_t)(src[2] & 0xff) << 16;
@@ -219,108 +297,359 @@ static inline void usbotghs_write_core_fifo(uint8_t *src, const uint32_t size, u
             /* should never happend, complete switch */
             break;
     }
+#endif
+}
+
+/*
+ * Word-packed variant of usbotghs_write_core_fifo(): src is a little-endian
+ * word image, written as is. The last word may be partially used: the core
+ * only sends the XFRSIZ bytes of the transfer.
+ */
+/*@
+    @ requires ep < USBOTGHS_MAX_IN_EP ;
+    @ requires size > 0;
+    @ requires \valid_read(src + (0 .. ((size + 3) / 4) - 1));
+    @ assigns *((uint32_t *)((int)(0x40040000 + (int)(0x1000 * (int)((int)ep + 1)))));
+*/
+static inline void usbotghs_write_core_fifo_words(const uint32_t *src, const uint32_t size, uint8_t ep)
+{
+#if CONFIG_USR_DEV_USBOTGHS_DMA
+    /* the RAM FIFO is read by the core DMA */
+    (void)src;
+    (void)size;
+    (void)ep;
+#else
+    uint32_t words = (size + 3) / 4;
+    uint32_t i = 0;
+    volatile uint32_t *fifo_w = USBOTG_HS_DEVICE_FIFO(ep);
 
-    /* IP should has its own interrupts disable during ISR execution */
-    set_reg_value(r_CORTEX_M_USBOTG_HS_GINTMSK, oldmask, 0xffffffff, 0);
+    log_printf("[USBOTG][HS] writing %d bytes (words) to EP %d core TxFIFO\n", size, ep);
+    /*@
+      @ loop invariant 0 <= i <= words;
+      @ loop assigns i, src, *((uint32_t *)((int)(0x40040000 + (int)(0x1000 * (int)((int)ep + 1)))));
+      @ loop variant words - i;
+      */
+    for (; (i + 8) <= words; i += 8, src += 8) {
+        fifo_w[0] = src[0];
+        fifo_w[1] = src[1];
+        fifo_w[2] = src[2];
+        fifo_w[3] = src[3];
+        fifo_w[4] = src[4];
+        fifo_w[5] = src[5];
+        fifo_w[6] = src[6];
+        fifo_w[7] = src[7];
+    }
+    /*@
+      @ loop invariant 0 <= i <= words;
+      @ loop assigns i, src, *((uint32_t *)((int)(0x40040000 + (int)(0x1000 * (int)((int)ep + 1)))));
+      @ loop variant words - i;
+      */
+    for (; i < words; i++, src++) {
+        fifo_w[0] = src[0];
+    }
 #endif
 }
 
+/*
+ * Vectored variant of usbotghs_write_core_fifo(): write size bytes of the EP
+ * xmit segments to the Core FIFO, starting at the current segment offset.
+ * A Core FIFO word may straddle two (or more) segments: its bytes are
+ * accumulated in a carry word, which is written once complete, or at the end
+ * of the (short) packet.
+ */
+/*@
+  @ requires \valid(ep);
+  @ requires ep->id < USBOTGHS_MAX_IN_EP;
+  @ assigns *((uint32_t *) (USB_BACKEND_MEMORY_BASE .. USB_BACKEND_MEMORY_END)), ep->iov_idx, ep->iov_off;
+  */
+static void usbotghs_write_core_fifo_iov(usbotghs_ep_t *ep, uint32_t size)
+{
+    const usbotghs_iovec_t *seg;
+    const uint8_t *src;
+    uint32_t len;
+    uint32_t carry = 0;
+    uint8_t carry_len = 0;
+
+    while (size > 0 && ep->iov_idx < ep->iov_cnt) {
+        seg = &(ep->iov[ep->iov_idx]);
+        len = seg->len - ep->iov_off;
+        if (len > size) {
+            len = size;
+        }
+        src = &(seg->base[ep->iov_off]);
+        ep->iov_off += len;
+        size -= len;
+        /* complete the word started in the previous segment */
+        while (carry_len != 0 && len > 0) {
+            carry |= (uint32_t)(*src) << (8 * carry_len);
+            src++;
+            len--;
+            carry_len++;
+            if (carry_len == 4) {
+                write_reg_value(USBOTG_HS_DEVICE_FIFO(ep->id), carry);
+                carry = 0;
+                carry_len = 0;
+            }
+        }
+        /* whole words of the current segment */
+        if (len >= 4) {
+            usbotghs_write_core_fifo(src, len & ~(uint32_t)3, ep->id);
+            src += len & ~(uint32_t)3;
+            len &= 3;
+        }
+        /* keep the segment residue, to be completed by the next segment */
+        while (len > 0) {
+            carry |= (uint32_t)(*src) << (8 * carry_len);
+            src++;
+            len--;
+            carry_len++;
+        }
+        if (ep->iov_off == seg->len) {
+            ep->iov_idx++;
+            ep->iov_off = 0;
+        }
+    }
+    if (carry_len != 0) {
+        /* last word of a short packet */
+        write_reg_value(USBOTG_HS_DEVICE_FIFO(ep->id), carry);
+    }
+}
+
+/* size of a packet, in 32bits words */
+#define PKT_WORDS(mpsize) (((uint32_t)(mpsize) + 3) / 4)
+
+/*
+ * Core FIFO RAM planner.
+ *
+ * Compute the whole Core FIFO RAM layout (in 32bits words, the unit of the
+ * GRXFSIZ, DIEPTXF0 and DIEPTXFx registers) from the set of configured EPs:
+ *
+ * 0                                                          CORE_FIFO_WORDS
+ * +-------------+-------------+-------------+-----+--------------+
+ * |   RX FIFO   | TX1 (EP 1)  | TX2 (EP 2)  | ... |  TX0 (EP 0)  |
+ * +-------------+-------------+-------------+-----+--------------+
+ *
+ * - the RxFIFO is shared by all the OUT EPs and is sized as required by the
+ *   reference manual (RM0090, 35.11.3), for two packets of the biggest
+ *   configured OUT EP: (5 * nb control EPs + 8) + 2 * (largest packet + 1)
+ *   + (2 * nb OUT EPs) + 1
+ * - EP0 TxFIFO holds a whole EP0 transfer (DIEPTSIZ0 limit, 127 bytes). It is
+ *   set at the top of the Core FIFO RAM, and doesn't move when the other EPs
+ *   are (re)configured, while control transfers are running.
+ * - each configured IN EP gets at least one packet (and at least 16 words).
+ *   The remaining space is then given, one packet at a time and in turn, to
+ *   bulk IN EPs (upto CONFIG_USR_DEV_USBOTGHS_BULK_IN_FIFO_PACKETS packets)
+ *   and isochronous IN EPs (two packets), so that the core can send
+ *   back-to-back packets while the next ones are written.
+ *
+ * This function does not access the core registers.
+ *
+ * @return MBED_ERROR_NONE, or MBED_ERROR_NOSTORAGE if the configured EPs don't
+ * fit in the Core FIFO RAM
+ */
+/*@
+  @ requires \valid_read(in_eps + (0 .. USBOTGHS_MAX_IN_EP-1));
+  @ requires \valid_read(out_eps + (0 .. USBOTGHS_MAX_OUT_EP-1));
+  @ requires \valid(layout);
+  @ assigns *layout;
+  @ ensures \result == MBED_ERROR_NONE || \result == MBED_ERROR_NOSTORAGE;
+  */
+mbed_error_t usbotghs_fifo_plan(const usbotghs_ep_t *in_eps,
+                                const usbotghs_ep_t *out_eps,
+                                usbotghs_fifo_layout_t *layout)
+{
+    mbed_error_t errcode = MBED_ERROR_NONE;
+    uint32_t ep0_mpsize = out_eps[0].mpsize;
+    uint32_t max_pkt = 0;
+    uint32_t nb_ctrl = 1;
+    uint32_t nb_out = 1;
+    uint32_t wanted[USBOTGHS_MAX_IN_EP] = { 0 };
+    uint32_t max_wanted = 1;
+    uint32_t used = 0;
+    uint32_t start = 0;
+    uint8_t i;
+
+    /* EP0 is always there, even before being configured */
+    if (ep0_mpsize == 0) {
+        ep0_mpsize = usbotghs_get_ep_mpsize(USBOTG_HS_EP_TYPE_CONTROL);
+    }
+    max_pkt = PKT_WORDS(ep0_mpsize);
+    for (i = 1; i < USBOTGHS_MAX_OUT_EP; ++i) {
+        if (out_eps[i].configured == false) {
+            continue;
+        }
+        nb_out++;
+        if (out_eps[i].type == USBOTG_HS_EP_TYPE_CONTROL) {
+            nb_ctrl++;
+        }
+        if (PKT_WORDS(out_eps[i].mpsize) > max_pkt) {
+            max_pkt = PKT_WORDS(out_eps[i].mpsize);
+        }
+    }
+    layout->rx_depth = (uint16_t)((5 * nb_ctrl + 8) + 2 * (max_pkt + 1) + (2 * nb_out) + 1);
+
+    layout->tx_depth[0] = (uint16_t)PKT_WORDS(USBOTG_HS_DIEPTSIZ0_XFRSIZ_MAX);
+    if (layout->tx_depth[0] < TX_CORE_FIFO_MIN_DEPTH) {
+        layout->tx_depth[0] = TX_CORE_FIFO_MIN_DEPTH;
+    }
+    used = layout->rx_depth + layout->tx_depth[0];
+
+    /* first pass: one packet per configured IN EP */
+    for (i = 1; i < USBOTGHS_MAX_IN_EP; ++i) {
+        layout->tx_depth[i] = 0;
+        if (in_eps[i].configured == false || in_eps[i].mpsize == 0) {
+            continue;
+        }
+        layout->tx_depth[i] = (uint16_t)PKT_WORDS(in_eps[i].mpsize);
+        if (layout->tx_depth[i] < TX_CORE_FIFO_MIN_DEPTH) {
+            layout->tx_depth[i] = TX_CORE_FIFO_MIN_DEPTH;
+        }
+        used += layout->tx_depth[i];
+        switch (in_eps[i].type) {
+            case USBOTG_HS_EP_TYPE_BULK:
+                wanted[i] = CONFIG_USR_DEV_USBOTGHS_BULK_IN_FIFO_PACKETS;
+                break;
+            case USBOTG_HS_EP_TYPE_ISOCHRONOUS:
+                wanted[i] = 2;
+                break;
+            default:
+                wanted[i] = 1;
+                break;
+        }
+        if (wanted[i] > max_wanted) {
+            max_wanted = wanted[i];
+        }
+    }
+    if (used > CORE_FIFO_WORDS) {
+        log_printf("[USBOTG][HS] FIFO plan: %d words needed, only %d available\n", used, CORE_FIFO_WORDS);
+        errcode = MBED_ERROR_NOSTORAGE;
+        goto err;
+    }
+    /* next passes: one more packet per bulk/isochronous IN EP, in turn */
+    for (uint32_t pkts = 2; pkts <= max_wanted; ++pkts) {
+        for (i = 1; i < USBOTGHS_MAX_IN_EP; ++i) {
+            uint32_t depth = pkts * PKT_WORDS(in_eps[i].mpsize);
+            if (wanted[i] < pkts || depth <= layout->tx_depth[i]) {
+                continue;
+            }
+            if (used + (depth - layout->tx_depth[i]) > CORE_FIFO_WORDS) {
+                continue;
+            }
+            used += depth - layout->tx_depth[i];
+            layout->tx_depth[i] = (uint16_t)depth;
+        }
+    }
+    /* placement */
+    start = layout->rx_depth;
+    for (i = 1; i < USBOTGHS_MAX_IN_EP; ++i) {
+        layout->tx_start[i] = (uint16_t)start;
+        start += layout->tx_depth[i];
+    }
+    layout->tx_start[0] = (uint16_t)(CORE_FIFO_WORDS - layout->tx_depth[0]);
+    layout->used = (uint16_t)used;
+err:
+    return errcode;
+}
+
+/*
+ * Compute the Core FIFO RAM layout of the currently configured EPs and program
+ * it into the core. The TxFIFOs of the EPs (other than EP0) which have been
+ * moved or resized are flushed: this is done at configuration time, when these
+ * EPs are idle.
+ */
 /*@
+  @ requires \separated(((uint32_t *) (USB_BACKEND_MEMORY_BASE .. USB_BACKEND_MEMORY_END)), &usbotghs_ctx) ;
   @ assigns *((uint32_t *) (USB_BACKEND_MEMORY_BASE .. USB_BACKEND_MEMORY_END)), usbotghs_ctx.fifo_idx;
-  @ ensures \result == MBED_ERROR_NONE;
+  @ ensures \result == MBED_ERROR_NONE || \result == MBED_ERROR_NOSTORAGE;
   */
-mbed_error_t usbotghs_init_global_fifo(void)
+static mbed_error_t usbotghs_fifo_apply_plan(void)
 {
     mbed_error_t errcode = MBED_ERROR_NONE;
     usbotghs_context_t *ctx = usbotghs_get_context();
+    usbotghs_fifo_layout_t layout = { 0 };
+
+    if ((errcode = usbotghs_fifo_plan(ctx->in_eps, ctx->out_eps, &layout)) != MBED_ERROR_NONE) {
+        goto err;
+    }
+    set_reg(r_CORTEX_M_USBOTG_HS_GRXFSIZ, layout.rx_depth, USBOTG_HS_GRXFSIZ_RXFD);
+    set_reg(r_CORTEX_M_USBOTG_HS_DIEPTXF0, layout.tx_start[0], USBOTG_HS_DIEPTXF_INEPTXSA);
+    set_reg(r_CORTEX_M_USBOTG_HS_DIEPTXF0, layout.tx_depth[0], USBOTG_HS_DIEPTXF_INEPTXFD);
+    /*@
+      @ loop invariant 1 <= i <= USBOTGHS_MAX_IN_EP;
+      @ loop assigns i, *((uint32_t *) (USB_BACKEND_MEMORY_BASE .. USB_BACKEND_MEMORY_END));
+      @ loop variant USBOTGHS_MAX_IN_EP - i;
+      */
+    for (uint8_t i = 1; i < USBOTGHS_MAX_IN_EP; ++i) {
+        if (layout.tx_depth[i] == 0) {
+            continue;
+        }
+        if (get_reg(r_CORTEX_M_USBOTG_HS_DIEPTXF(i), USBOTG_HS_DIEPTXF_INEPTXSA) == layout.tx_start[i] &&
+            get_reg(r_CORTEX_M_USBOTG_HS_DIEPTXF(i), USBOTG_HS_DIEPTXF_INEPTXFD) == layout.tx_depth[i]) {
+            continue;
+        }
+        set_reg(r_CORTEX_M_USBOTG_HS_DIEPTXF(i), layout.tx_start[i], USBOTG_HS_DIEPTXF_INEPTXSA);
+        set_reg(r_CORTEX_M_USBOTG_HS_DIEPTXF(i), layout.tx_depth[i], USBOTG_HS_DIEPTXF_INEPTXFD);
+        usbotghs_txfifo_flush(i);
+    }
+    log_printf("[USBOTG][HS] FIFO plan: RX %d words, TX0 %d words, %d/%d words used\n",
+            layout.rx_depth, layout.tx_depth[0], layout.used, CORE_FIFO_WORDS);
+    set_u16_with_membarrier(&ctx->fifo_idx, layout.used);
+err:
+    return errcode;
+}
+
+/*
+ * Depth of the given IN EP Core TxFIFO, in 32bits words, as programmed in the core.
+ */
+/*@
+  @ requires ep_id < USBOTGHS_MAX_IN_EP;
+  @ assigns \nothing;
+  */
+uint32_t usbotghs_get_txfifo_depth(uint8_t ep_id)
+{
+    if (ep_id == 0) {
+        return get_reg(r_CORTEX_M_USBOTG_HS_DIEPTXF0, USBOTG_HS_DIEPTXF_INEPTXFD);
+    }
+    return get_reg(r_CORTEX_M_USBOTG_HS_DIEPTXF(ep_id), USBOTG_HS_DIEPTXF_INEPTXFD);
+}
+
+/*@
+  @ assigns *((uint32_t *) (USB_BACKEND_MEMORY_BASE .. USB_BACKEND_MEMORY_END)), usbotghs_ctx.fifo_idx;
+  @ ensures \result == MBED_ERROR_NONE || \result == MBED_ERROR_NOSTORAGE;
+  */
+mbed_error_t usbotghs_init_global_fifo(void)
+{
     /*
      * 	  Set up the Data FIFO RAM for each of the FIFOs
 	 *      – Program the OTG_HS_GRXFSIZ register, to be able to receive control OUT data
 	 *        and setup data. If thresholding is not enabled, at a minimum, this must be equal to
 	 *        1 max packet size of control endpoint 0 + 2 Words (for the status of the control
 	 *        OUT data packet) + 10 Words (for setup packets).
-     *        for  e.g. giving 64 bytes for max EP0 Pkt size, this means 64 + 2*wz + 10*wz
+	 *      – Program the OTG_HS_TX0FSIZ register to be able to transmit control IN data.
 	 *
 	 * See reference manual section 34.11 for peripheral FIFO architecture.
-	 * XXX: The sizes of TX FIFOs seems to be the size of TX FIFO #0 for
-	 * all FIFOs. We don't know if it is really the case or if the DTXFSTS
-	 * register does not give the free space for the right FIFO.
-	 *
-	 * 0                512                1024             1536
-	 * +-----------------+------------------+-----------------+-----------
-	 * |     RX FIFO     |     TX0 FIFO     | TXi FIFO (EP i) |
-	 * |    128 Words    |    128 Words     |    128 Words    |...
-	 * +-----------------+------------------+-----------------+------------
-     * Settings FIFOs for Endpoint 0
-     * RXFD (RxFIFO depth, in 32bits DWORD)
+	 * The layout is computed by usbotghs_fifo_plan(), from the configured EPs.
+	 * It is computed again at each EP (re)configuration.
      */
-	set_reg(r_CORTEX_M_USBOTG_HS_GRXFSIZ, USBOTG_HS_RX_CORE_FIFO_SZ, USBOTG_HS_GRXFSIZ_RXFD);
-    /* PTH: to check: executed at reset handling time: here we set back fifo_idx from
-     * 0 as the device is reset. previously configured FIFO slots are purged and
-     * must be reconfigured using usbotghs_reset_epx_fifo() */
-    set_u16_with_membarrier(&ctx->fifo_idx, USBOTG_HS_RX_CORE_FIFO_SZ);
-    /* setting TX0FSIZ to */
-
-    return errcode;
+    return usbotghs_fifo_apply_plan();
 }
 
 /*@
     @ requires \valid(ep);
     @ requires \separated(((uint32_t *) (USB_BACKEND_MEMORY_BASE .. USB_BACKEND_MEMORY_END)), &usbotghs_ctx) ;
     @ assigns *((uint32_t *) (USB_BACKEND_MEMORY_BASE .. USB_BACKEND_MEMORY_END)),usbotghs_ctx.fifo_idx, *ep , usbotghs_ctx.in_eps[0 .. USBOTGHS_MAX_IN_EP-1], usbotghs_ctx.out_eps[0 .. USBOTGHS_MAX_OUT_EP-1];
-    @ behavior epid_null_NOSTORAGE:
-    @   assumes &usbotghs_ctx != \null;
-    @   assumes (ep->id == 0) ;
-    @   assumes usbotghs_ctx.fifo_idx + (uint16_t)USBOTG_HS_TX_CORE_FIFO_SZ >= (uint16_t)CORE_FIFO_LENGTH ;
-    @   ensures \result == MBED_ERROR_NOSTORAGE ;
-    @   ensures ep->mpsize == \old(ep->mpsize) ;
-
-    @ behavior epid_null_STORAGE_OK:
-    @   assumes &usbotghs_ctx != \null;
-    @   assumes (ep->id == 0) ;
-    @   assumes !(usbotghs_ctx.fifo_idx + (uint16_t)USBOTG_HS_TX_CORE_FIFO_SZ >= (uint16_t)CORE_FIFO_LENGTH) ;
-    @   ensures \result == MBED_ERROR_NONE ;
-
-    @ behavior epid_not_null :
-    @   assumes &usbotghs_ctx != \null;
-    @   assumes !(ep->id == 0) ;
-    @   ensures \result == MBED_ERROR_NONE || \result == MBED_ERROR_NOSTORAGE ;
-
-    @ complete behaviors;
-    @ disjoint behaviors ;
-*/
-
-/*
-    TODO : be more precise for behavior epid_not_null : problem proving \result == MBED_ERROR_NOSTORAGE, problably
-            du to some assume about ep->mpsize
+    @ ensures \result == MBED_ERROR_NONE || \result == MBED_ERROR_NOSTORAGE ;
 */
 
 mbed_error_t usbotghs_reset_epx_fifo(usbotghs_ep_t *ep)
 {
     mbed_error_t errcode = MBED_ERROR_NONE;
-    usbotghs_context_t *ctx = usbotghs_get_context();
-    /*@ assert ctx != NULL; */
+    /* the Core FIFO RAM layout (RxFIFO, EP0 and EPx TxFIFOs) depends on the whole
+     * set of configured EPs: compute it again */
+    if ((errcode = usbotghs_fifo_apply_plan()) != MBED_ERROR_NONE) {
+        goto err;
+    }
     if (ep->id == 0) {
-        /*
-         * EndPoint 0 TX FIFO configuration (should store a least 4 64byte paquets)
-         */
-        /*  – Program the OTG_HS_TX0FSIZ register (depending on the FIFO number
-         *  chosen) to be able to transmit control IN data. At a minimum, this must be equal to
-         *  1 max packet size of control endpoint 0.
-         *
-         *  FIXME: this work is not made in the previous driver... Maybe we should correct this here.
-         */
-
-        if (ctx->fifo_idx + USBOTG_HS_TX_CORE_FIFO_SZ >= CORE_FIFO_LENGTH) {
-            errcode = MBED_ERROR_NOSTORAGE;
-            goto err;
-        }
-
-        /*
-         */
-        /* FIXME: DIEPTXF fifo size is in word unit, shouldn't it be fifo_idx/4 ? see USBOTGFS driver */
-        set_reg(r_CORTEX_M_USBOTG_HS_DIEPTXF0, USBOTG_HS_RX_CORE_FIFO_SZ, USBOTG_HS_DIEPTXF_INEPTXSA);
-        set_reg(r_CORTEX_M_USBOTG_HS_DIEPTXF0, USBOTG_HS_TX_CORE_FIFO_SZ, USBOTG_HS_DIEPTXF_INEPTXFD);
         /*
          * 4. Program STUPCNT in the endpoint-specific registers for control OUT endpoint 0 to receive a SETUP packet
          *      – STUPCNT = 3 in OTG_HS_DOEPTSIZ0 (to receive up to 3 back-to-back SETUP packets)
@@ -330,124 +659,423 @@ mbed_error_t usbotghs_reset_epx_fifo(usbotghs_ep_t *ep)
         set_reg(r_CORTEX_M_USBOTG_HS_DOEPCTL(0),
                 1, USBOTG_HS_DOEPCTL_CNAK);
         usbotghs_txfifo_flush(0);
-        set_u16_with_membarrier(&ctx->fifo_idx, ctx->fifo_idx + USBOTG_HS_TX_CORE_FIFO_SZ);
-    } else {
-        /* all other EPs have their DIEPTXF registers accesible through a single macro */
-        if (ep->dir == USBOTG_HS_EP_DIR_OUT) {
-            /* using global RX fifo... GRXFIFOSZ set as global RX FIFO */
-        } else {
-            set_reg(r_CORTEX_M_USBOTG_HS_DIEPTXF(ep->id), ctx->fifo_idx, USBOTG_HS_DIEPTXF_INEPTXSA);
-            /* this field is in 32bits words unit */
-            /* for very small mpsize EP (e.g. keyboards, we must support at list
-             * URB size + mpsize */
-
-            uint32_t fifosize;
-            if (ep->mpsize <= 64) {
-                fifosize = 128;
-            } else {
-                fifosize = ep->mpsize;
-            }
-
-
-            if (ctx->fifo_idx + fifosize >= CORE_FIFO_LENGTH) {
-                errcode = MBED_ERROR_NOSTORAGE;
-                goto err;
-            }
-
-            /* FIXME: DIEPTXF fifo size is in word unit, shouldn't it be fifosize/4 ? */
-            set_reg(r_CORTEX_M_USBOTG_HS_DIEPTXF(ep->id), fifosize, USBOTG_HS_DIEPTXF_INEPTXFD);
-            set_u16_with_membarrier(&ctx->fifo_idx, ctx->fifo_idx + fifosize);
-        }
     }
 
-    set_bool_with_membarrier(&(ep->fifo_lck), true);
+    set_u8_with_membarrier(&(ep->fifo_owner), USBOTG_HS_FIFO_APP_OWNED);
     ep->fifo_idx = 0;
     ep->fifo = NULL;
     ep->fifo_size = 0;
+    ep->split_payload = NULL;
+    ep->split_hdr_size = 0;
+    ep->iov = NULL;
+    ep->fifo_words = false;
+    ep->zlp_pending = false;
     ep->core_txfifo_empty = true;
-    set_bool_with_membarrier(&(ep->fifo_lck), false);
+    set_u8_with_membarrier(&(ep->fifo_owner), USBOTG_HS_FIFO_DRIVER_OWNED);
+    if (ep->dir != USBOTG_HS_EP_DIR_OUT) {
+        clear_reg_bits(r_CORTEX_M_USBOTG_HS_DIEPEMPMSK, USBOTG_HS_DIEPEMPMSK_INEPTXFEM(ep->id));
+        /* pending transfers are dropped */
+        usbotghs_xmit_queue_flush(ep->id);
+    } else {
+        /* posted receive buffers are dropped, back to usbotghs_set_recv_fifo() mode */
+        set_u8_with_membarrier(&(ep->recv_mode), USBOTG_HS_RECV_MODE_FIFO);
+        usbotghs_recv_ring_flush(ep->id);
+        usbotghs_recv_stream_flush(ep->id);
+        if (ep->id == 0) {
+            /* pending SETUP packets are dropped */
+            usbotghs_context_t *ctx = usbotghs_get_context();
+            ctx->setup_head = 0;
+            ctx->setup_tail = 0;
+            ctx->setup_wip = false;
+        }
+    }
 err:
     return errcode;
 }
 
 
 /*
- * read from Core EPx FIFO to associated RAM FIFO for given EP.
- * The EP must be a receiver EP (IN in host mode, OUT in device mode)
+ * OUT data EPs streaming receive mode. The EP continuously receives into a
+ * power of two circular buffer given by usbotghs_set_recv_stream():
+ * usbotghs_read_epx_fifo() writes at the head, the upper layer consumes at
+ * the tail with usbotghs_recv_stream_peek() and usbotghs_recv_stream_release().
  *
- * There is two ways to copy from Core FIFO to RAM FIFO:
- * 1. Manual recopy
- * 2. DMA recopy
+ * The EP is armed with a multi-packet transfer covering the free space (in
+ * mpsize units), bounded to the watermark while it is not reached. The core
+ * then rises XFRC, and the upper layer handler is called, when the watermark
+ * is reached, on short packets, or when the buffer is full. The EP only NAKs
+ * the host when less than mpsize bytes are free, until the upper layer
+ * releases some data.
+ *
+ * 'head' is only written by the RXFLVL handler and 'tail' by the upper layer.
+ * Both only grow: the buffer size being a power of two, the offset is the
+ * counter modulo the size, even on counter wrap.
  */
-/*@
-  @ requires 0 <= ep_id < USBOTGHS_MAX_OUT_EP;
-  @ requires size > 0;
-  @ requires \separated(&usbotghs_ctx, ((uint32_t *) (USB_BACKEND_MEMORY_BASE .. USB_BACKEND_MEMORY_END)));
-  @ assigns usbotghs_ctx.out_eps[ep_id],  *(usbotghs_ctx.out_eps[ep_id].fifo+(usbotghs_ctx.out_eps[ep_id].fifo_idx..(usbotghs_ctx.out_eps[ep_id].fifo_idx + (size-1))));
+typedef struct {
+    uint8_t  *buf;        /* circular buffer */
+    uint32_t  size;       /* buffer size, power of two, in bytes */
+    uint32_t  watermark;  /* pending data level triggering the upper layer handler */
+    uint32_t  head;       /* received bytes */
+    uint32_t  tail;       /* consumed bytes */
+    bool      armed;      /* the EP is currently enabled on the buffer */
+} usbotghs_recv_stream_t;
 
-  @ behavior notconfigured:
-  @    assumes usbotghs_ctx.out_eps[ep_id].configured == \false;
-  @    ensures \result == MBED_ERROR_INVPARAM;
+static usbotghs_recv_stream_t recv_streams[USBOTGHS_MAX_OUT_EP] = { 0 };
 
+/*
+ * Enable the EP for the next transfer, on the circular buffer free space.
+ * Return false (the EP stays NAKing) if less than mpsize bytes are free.
+ */
+/*@
+  @ requires 0 < ep_id < USBOTGHS_MAX_OUT_EP;
+  @ assigns *((uint32_t *) (USB_BACKEND_MEMORY_BASE .. USB_BACKEND_MEMORY_END)), usbotghs_ctx.out_eps[ep_id].fifo_idx, recv_streams[ep_id].armed;
+  */
+static bool usbotghs_recv_stream_arm(uint8_t ep_id)
+{
+    usbotghs_context_t *ctx = usbotghs_get_context();
+    usbotghs_recv_stream_t *s = &recv_streams[ep_id];
+    usbotghs_ep_t *ep = &ctx->out_eps[ep_id];
+    uint32_t level = s->head - s->tail;
+    uint32_t pktcount = (s->size - level) / ep->mpsize;
+
+    if (pktcount == 0) {
+        log_printf("[USBOTG][HS] ep %d: recv stream full\n", ep_id);
+        set_bool_with_membarrier(&s->armed, false);
+        return false;
+    }
+    if (level < s->watermark) {
+        /* complete the transfer (and call the upper layer) on watermark */
+        uint32_t wm_pkts = (s->watermark - level + ep->mpsize - 1) / ep->mpsize;
+        if (wm_pkts < pktcount) {
+            pktcount = wm_pkts;
+        }
+    }
+    if (pktcount > USBOTG_HS_DOEPTSIZ_PKTCNT_MAX) {
+        pktcount = USBOTG_HS_DOEPTSIZ_PKTCNT_MAX;
+    }
+    if (pktcount * ep->mpsize > USBOTG_HS_DOEPTSIZ_XFRSIZ_MAX) {
+        pktcount = USBOTG_HS_DOEPTSIZ_XFRSIZ_MAX / ep->mpsize;
+    }
+    ep->fifo_idx = 0;
+    set_reg_value(r_CORTEX_M_USBOTG_HS_DOEPTSIZ(ep_id), pktcount, USBOTG_HS_DOEPTSIZ_PKTCNT_Msk(ep_id), USBOTG_HS_DOEPTSIZ_PKTCNT_Pos(ep_id));
+    set_reg_value(r_CORTEX_M_USBOTG_HS_DOEPTSIZ(ep_id), pktcount * ep->mpsize, USBOTG_HS_DOEPTSIZ_XFRSIZ_Msk(ep_id), USBOTG_HS_DOEPTSIZ_XFRSIZ_Pos(ep_id));
+    set_bool_with_membarrier(&s->armed, true);
+    set_reg_bits(r_CORTEX_M_USBOTG_HS_DOEPCTL(ep_id),
+                 USBOTG_HS_DOEPCTL_CNAK_Msk | USBOTG_HS_DOEPCTL_EPENA_Msk);
+    return true;
+}
 
-  @ behavior nofifo:
-  @    assumes usbotghs_ctx.out_eps[ep_id].configured != \false;
-  @    assumes usbotghs_ctx.out_eps[ep_id].fifo == NULL;
-  @    ensures \result == MBED_ERROR_INVPARAM;
+/*
+ * Pop a received packet of len1 + len2 bytes from the Core RxFIFO, the first
+ * len1 bytes to dst1 and the next ones to dst2. The Core FIFO word holding the
+ * boundary between the two buffers, if any, is split between them.
+ */
+/*@
+  @ requires \valid(dst1 + (0 .. len1 - 1));
+  @ requires \valid(dst2 + (0 .. len2 - 1));
+  @ assigns dst1[0 .. len1 - 1], dst2[0 .. len2 - 1];
+  */
+static void usbotghs_read_core_fifo_split(uint8_t *dst1, uint32_t len1,
+                                          uint8_t *dst2, uint32_t len2,
+                                          uint8_t ep_id)
+{
+    /* whole words of the first buffer */
+    uint32_t done = len1 & ~(uint32_t)3;
+    uint32_t done2 = 0;
 
-  @ behavior invalididx:
-  @    assumes usbotghs_ctx.out_eps[ep_id].configured == \true;
-  @    assumes usbotghs_ctx.out_eps[ep_id].fifo != NULL;
-  @    assumes usbotghs_ctx.out_eps[ep_id].fifo_idx > usbotghs_ctx.out_eps[ep_id].fifo_size;
-  @    ensures \result == MBED_ERROR_UNKNOWN;
+    if (done > 0) {
+        usbotghs_read_core_fifo(dst1, done, ep_id);
+    }
+    if (done < len1) {
+        /* the Core FIFO word straddles the two buffers */
+        uint32_t tmp = *(USBOTG_HS_DEVICE_FIFO(ep_id));
+        for (uint8_t i = 0; i < 4; ++i) {
+            if (done < len1) {
+                dst1[done++] = (tmp >> (8 * i)) & 0xff;
+            } else if (done2 < len2) {
+                dst2[done2++] = (tmp >> (8 * i)) & 0xff;
+            }
+        }
+    }
+    if (done2 < len2) {
+        usbotghs_read_core_fifo(&dst2[done2], len2 - done2, ep_id);
+    }
+}
 
-  @ behavior sizetoobig:
-  @    assumes usbotghs_ctx.out_eps[ep_id].configured == \true;
-  @    assumes usbotghs_ctx.out_eps[ep_id].fifo != NULL;
-  @    assumes usbotghs_ctx.out_eps[ep_id].fifo_idx <= usbotghs_ctx.out_eps[ep_id].fifo_size;
-  @    assumes size > (usbotghs_ctx.out_eps[ep_id].fifo_size - usbotghs_ctx.out_eps[ep_id].fifo_idx);
-  @    ensures \result == MBED_ERROR_INVPARAM;
+/*
+ * Pop a received packet from the Core RxFIFO to the head of the EP circular
+ * buffer. The packet may wrap at the end of the buffer, including in the
+ * middle of a Core FIFO word.
+ */
+/*@
+  @ requires 0 < ep_id < USBOTGHS_MAX_OUT_EP;
+  @ requires size > 0;
+  @ assigns recv_streams[ep_id].buf[0 .. recv_streams[ep_id].size - 1], recv_streams[ep_id].head, usbotghs_ctx.out_eps[ep_id].fifo_idx;
+  @ ensures \result == MBED_ERROR_NONE || \result == MBED_ERROR_NOMEM;
+  */
+static mbed_error_t usbotghs_recv_stream_write(uint32_t size, uint8_t ep_id)
+{
+    mbed_error_t errcode = MBED_ERROR_NONE;
+    usbotghs_context_t *ctx = usbotghs_get_context();
+    usbotghs_recv_stream_t *s = &recv_streams[ep_id];
+    uint32_t off = s->head & (s->size - 1);
+    uint32_t contig = s->size - off;
 
-  @ behavior fifolocked:
-  @    assumes usbotghs_ctx.out_eps[ep_id].configured == \true;
-  @    assumes usbotghs_ctx.out_eps[ep_id].fifo != NULL;
-  @    assumes usbotghs_ctx.out_eps[ep_id].fifo_idx <= usbotghs_ctx.out_eps[ep_id].fifo_size;
-  @    assumes 0 < size <= (usbotghs_ctx.out_eps[ep_id].fifo_size - usbotghs_ctx.out_eps[ep_id].fifo_idx);
-  @    assumes usbotghs_ctx.out_eps[ep_id].fifo_lck == \true;
-  @    ensures \result == MBED_ERROR_INVSTATE;
+    if (size > s->size - (s->head - s->tail)) {
+        /* the EP is never armed on more than the free space */
+        log_printf("[USBOTG][HS] ep %d: recv stream overflow (%d bytes)\n", ep_id, size);
+        errcode = MBED_ERROR_NOMEM;
+        goto err;
+    }
+    if (contig > size) {
+        contig = size;
+    }
+    usbotghs_read_core_fifo_split(&s->buf[off], contig, &s->buf[0], size - contig, ep_id);
+    ctx->out_eps[ep_id].fifo_idx += size;
+    /* the received bytes are given to the upper layer */
+    request_data_membarrier();
+    s->head += size;
+err:
+    return errcode;
+}
 
-  @ behavior ok:
-  @    assumes usbotghs_ctx.out_eps[ep_id].configured == \true;
-  @    assumes usbotghs_ctx.out_eps[ep_id].fifo != NULL;
-  @    assumes usbotghs_ctx.out_eps[ep_id].fifo_idx <= usbotghs_ctx.out_eps[ep_id].fifo_size;
-  @    assumes 0 < size <= (usbotghs_ctx.out_eps[ep_id].fifo_size - usbotghs_ctx.out_eps[ep_id].fifo_idx);
-  @    assumes usbotghs_ctx.out_eps[ep_id].fifo_lck != \true;
-  @    ensures \result == MBED_ERROR_NONE;
+/*@
+  @ requires 0 < ep_id < USBOTGHS_MAX_OUT_EP;
+  @ assigns *((uint32_t *) (USB_BACKEND_MEMORY_BASE .. USB_BACKEND_MEMORY_END)), usbotghs_ctx.out_eps[ep_id].fifo_idx, recv_streams[ep_id].armed;
+  */
+uint32_t usbotghs_recv_stream_complete(uint8_t ep_id)
+{
+    usbotghs_recv_stream_t *s = &recv_streams[ep_id];
 
+    /* the core has disabled the EP on XFRC */
+    set_bool_with_membarrier(&s->armed, false);
+    usbotghs_recv_stream_arm(ep_id);
+    return s->head - s->tail;
+}
 
-  @ complete behaviors;
-  @ disjoint behaviors;
+/*@
+  @ requires ep_id < USBOTGHS_MAX_OUT_EP;
+  @ assigns recv_streams[ep_id];
+  */
+void usbotghs_recv_stream_flush(uint8_t ep_id)
+{
+    recv_streams[ep_id].buf = NULL;
+    recv_streams[ep_id].size = 0;
+    recv_streams[ep_id].head = 0;
+    recv_streams[ep_id].tail = 0;
+    set_bool_with_membarrier(&recv_streams[ep_id].armed, false);
+}
 
+/*@
+  @ requires \separated(&GHOST_opaque_drv_privates, &usbotghs_ctx, ((uint32_t *) (USB_BACKEND_MEMORY_BASE .. USB_BACKEND_MEMORY_END)), recv_streams);
+  @ assigns GHOST_opaque_drv_privates, *((uint32_t *) (USB_BACKEND_MEMORY_BASE .. USB_BACKEND_MEMORY_END)), usbotghs_ctx.out_eps[ep_id], recv_streams[ep_id];
+  @ ensures (buf == NULL || ep_id == 0 || ep_id >= USBOTGHS_MAX_OUT_EP) ==> \result == MBED_ERROR_INVPARAM;
   */
-mbed_error_t usbotghs_read_epx_fifo(uint32_t size, uint8_t ep_id)
+mbed_error_t usbotghs_set_recv_stream(uint8_t *buf, uint32_t size, uint32_t watermark, uint8_t ep_id)
 {
-    mbed_error_t errcode = MBED_ERROR_NONE;
     usbotghs_context_t *ctx = usbotghs_get_context();
-    usbotghs_ep_t*      ep = NULL;
+    mbed_error_t errcode = MBED_ERROR_NONE;
+    usbotghs_recv_stream_t *s;
+    usbotghs_ep_t *ep;
 
-    ep = &(ctx->out_eps[ep_id]);
+    /* no public (exported) variable is set. This GHOST var is used as countermeasure to public assignment
+     * specification for functions that assign private global content */
+    //@ ghost GHOST_opaque_drv_privates = 1;
 
-    /* sanitation */
-    if (ep->configured == false) {
-        log_printf("[USBOTG][HS] EPx %d not configured\n", ep->id);
+    if (buf == NULL || ep_id == 0 || ep_id >= USBOTGHS_MAX_OUT_EP) {
         errcode = MBED_ERROR_INVPARAM;
         goto err;
     }
-    if (ep->fifo == NULL) {
-        log_printf("[USBOTG][HS] EPx %d FIFO not set\n", ep->id);
+#if CONFIG_USR_DEV_USBOTGHS_DMA
+    /* the circular buffer is filled by the RXFLVL handler */
+    errcode = MBED_ERROR_UNSUPORTED_CMD;
+    goto err;
+#endif
+    ep = &ctx->out_eps[ep_id];
+    s = &recv_streams[ep_id];
+    if (!ep->configured || !ep->mpsize) {
+        errcode = MBED_ERROR_INVSTATE;
+        goto err;
+    }
+    if (size < ep->mpsize || (size & (size - 1)) != 0 ||
+        watermark == 0 || watermark > size) {
         errcode = MBED_ERROR_INVPARAM;
         goto err;
     }
+    if (ep->recv_mode != USBOTG_HS_RECV_MODE_FIFO ||
+        get_reg(r_CORTEX_M_USBOTG_HS_DOEPCTL(ep_id), USBOTG_HS_DOEPCTL_EPENA)) {
+        /* a transfer is in progress, or the EP is already in another receive mode */
+        errcode = MBED_ERROR_INVSTATE;
+        goto err;
+    }
+    set_u8_with_membarrier(&(ep->fifo_owner), USBOTG_HS_FIFO_APP_OWNED);
+    ep->fifo = buf;
+    ep->fifo_idx = 0;
+    ep->fifo_size = size;
+    set_u8_with_membarrier(&(ep->fifo_owner), USBOTG_HS_FIFO_DRIVER_OWNED);
+    s->buf = buf;
+    s->size = size;
+    s->watermark = watermark;
+    s->head = 0;
+    s->tail = 0;
+    set_u8_with_membarrier(&ep->recv_mode, USBOTG_HS_RECV_MODE_STREAM);
+    usbotghs_recv_stream_arm(ep_id);
+err:
+    return errcode;
+}
+
+/*@
+  @ requires \separated(&GHOST_opaque_drv_privates, recv_streams, data, len);
+  @ assigns GHOST_opaque_drv_privates, *data, *len;
+  @ ensures (data == NULL || len == NULL || ep_id == 0 || ep_id >= USBOTGHS_MAX_OUT_EP) ==> \result == MBED_ERROR_INVPARAM;
+  */
+mbed_error_t usbotghs_recv_stream_peek(uint8_t **data, uint32_t *len, uint8_t ep_id)
+{
+    usbotghs_context_t *ctx = usbotghs_get_context();
+    mbed_error_t errcode = MBED_ERROR_NONE;
+    usbotghs_recv_stream_t *s;
+    uint32_t off;
+    uint32_t level;
+
+    //@ ghost GHOST_opaque_drv_privates = 1;
+
+    if (data == NULL || len == NULL || ep_id == 0 || ep_id >= USBOTGHS_MAX_OUT_EP) {
+        errcode = MBED_ERROR_INVPARAM;
+        goto err;
+    }
+    if (ctx->out_eps[ep_id].recv_mode != USBOTG_HS_RECV_MODE_STREAM) {
+        errcode = MBED_ERROR_INVSTATE;
+        goto err;
+    }
+    s = &recv_streams[ep_id];
+    level = s->head - s->tail;
+    off = s->tail & (s->size - 1);
+    /* contiguous part only, the remaining is at the buffer start */
+    *data = &s->buf[off];
+    *len = (level < s->size - off) ? level : s->size - off;
+err:
+    return errcode;
+}
+
+/*@
+  @ requires \separated(&GHOST_opaque_drv_privates, &usbotghs_ctx, ((uint32_t *) (USB_BACKEND_MEMORY_BASE .. USB_BACKEND_MEMORY_END)), recv_streams);
+  @ assigns GHOST_opaque_drv_privates, *((uint32_t *) (USB_BACKEND_MEMORY_BASE .. USB_BACKEND_MEMORY_END)), usbotghs_ctx.out_eps[ep_id], recv_streams[ep_id];
+  @ ensures (ep_id == 0 || ep_id >= USBOTGHS_MAX_OUT_EP) ==> \result == MBED_ERROR_INVPARAM;
+  */
+mbed_error_t usbotghs_recv_stream_release(uint32_t len, uint8_t ep_id)
+{
+    usbotghs_context_t *ctx = usbotghs_get_context();
+    mbed_error_t errcode = MBED_ERROR_NONE;
+    usbotghs_recv_stream_t *s;
+
+    //@ ghost GHOST_opaque_drv_privates = 1;
+
+    if (ep_id == 0 || ep_id >= USBOTGHS_MAX_OUT_EP) {
+        errcode = MBED_ERROR_INVPARAM;
+        goto err;
+    }
+    if (ctx->out_eps[ep_id].recv_mode != USBOTG_HS_RECV_MODE_STREAM) {
+        errcode = MBED_ERROR_INVSTATE;
+        goto err;
+    }
+    s = &recv_streams[ep_id];
+    if (len > s->head - s->tail) {
+        errcode = MBED_ERROR_INVPARAM;
+        goto err;
+    }
+    request_data_membarrier();
+    s->tail += len;
+    request_data_membarrier();
+    /* 'armed' is only cleared by the OUT EP handler on XFRC, the EP being
+     * then disabled: it can't be set again behind our back */
+    if (s->armed == false) {
+        usbotghs_recv_stream_arm(ep_id);
+    }
+err:
+    return errcode;
+}
+
+/*
+ * read from Core EPx FIFO to associated RAM FIFO for given EP.
+ * The EP must be a receiver EP (IN in host mode, OUT in device mode)
+ *
+ * There is two ways to copy from Core FIFO to RAM FIFO:
+ * 1. Manual recopy
+ * 2. DMA recopy
+ */
+/*@
+  @ requires 0 <= ep_id < USBOTGHS_MAX_OUT_EP;
+  @ requires size > 0;
+  @ requires \separated(&usbotghs_ctx, ((uint32_t *) (USB_BACKEND_MEMORY_BASE .. USB_BACKEND_MEMORY_END)));
+  @ assigns usbotghs_ctx.out_eps[ep_id],  *(usbotghs_ctx.out_eps[ep_id].fifo+(usbotghs_ctx.out_eps[ep_id].fifo_idx..(usbotghs_ctx.out_eps[ep_id].fifo_idx + (size-1))));
+
+  @ behavior notconfigured:
+  @    assumes usbotghs_ctx.out_eps[ep_id].configured == \false;
+  @    ensures \result == MBED_ERROR_INVPARAM;
+
+
+  @ behavior nofifo:
+  @    assumes usbotghs_ctx.out_eps[ep_id].configured != \false;
+  @    assumes usbotghs_ctx.out_eps[ep_id].fifo == NULL;
+  @    ensures \result == MBED_ERROR_INVPARAM;
+
+  @ behavior invalididx:
+  @    assumes usbotghs_ctx.out_eps[ep_id].configured == \true;
+  @    assumes usbotghs_ctx.out_eps[ep_id].fifo != NULL;
+  @    assumes usbotghs_ctx.out_eps[ep_id].fifo_idx > usbotghs_ctx.out_eps[ep_id].fifo_size;
+  @    ensures \result == MBED_ERROR_UNKNOWN;
+
+  @ behavior sizetoobig:
+  @    assumes usbotghs_ctx.out_eps[ep_id].configured == \true;
+  @    assumes usbotghs_ctx.out_eps[ep_id].fifo != NULL;
+  @    assumes usbotghs_ctx.out_eps[ep_id].fifo_idx <= usbotghs_ctx.out_eps[ep_id].fifo_size;
+  @    assumes size > (usbotghs_ctx.out_eps[ep_id].fifo_size - usbotghs_ctx.out_eps[ep_id].fifo_idx);
+  @    ensures \result == MBED_ERROR_INVPARAM;
+
+  @ behavior fifolocked:
+  @    assumes usbotghs_ctx.out_eps[ep_id].configured == \true;
+  @    assumes usbotghs_ctx.out_eps[ep_id].fifo != NULL;
+  @    assumes usbotghs_ctx.out_eps[ep_id].fifo_idx <= usbotghs_ctx.out_eps[ep_id].fifo_size;
+  @    assumes 0 < size <= (usbotghs_ctx.out_eps[ep_id].fifo_size - usbotghs_ctx.out_eps[ep_id].fifo_idx);
+  @    assumes usbotghs_ctx.out_eps[ep_id].fifo_owner != USBOTG_HS_FIFO_DRIVER_OWNED;
+  @    ensures \result == MBED_ERROR_INVSTATE;
+
+  @ behavior ok:
+  @    assumes usbotghs_ctx.out_eps[ep_id].configured == \true;
+  @    assumes usbotghs_ctx.out_eps[ep_id].fifo != NULL;
+  @    assumes usbotghs_ctx.out_eps[ep_id].fifo_idx <= usbotghs_ctx.out_eps[ep_id].fifo_size;
+  @    assumes 0 < size <= (usbotghs_ctx.out_eps[ep_id].fifo_size - usbotghs_ctx.out_eps[ep_id].fifo_idx);
+  @    assumes usbotghs_ctx.out_eps[ep_id].fifo_owner == USBOTG_HS_FIFO_DRIVER_OWNED;
+  @    ensures \result == MBED_ERROR_NONE;
+
+
+  @ complete behaviors;
+  @ disjoint behaviors;
+
+  */
+mbed_error_t usbotghs_read_epx_fifo(uint32_t size, uint8_t ep_id)
+{
+    mbed_error_t errcode = MBED_ERROR_NONE;
+    usbotghs_context_t *ctx = usbotghs_get_context();
+    usbotghs_ep_t*      ep = NULL;
+
+    ep = &(ctx->out_eps[ep_id]);
+
+    /* sanitation */
+    if (ep->configured == false) {
+        log_printf("[USBOTG][HS] EPx %d not configured\n", ep->id);
+        errcode = MBED_ERROR_INVPARAM;
+        goto err;
+    }
+    if (ep->fifo == NULL) {
+        log_printf("[USBOTG][HS] EPx %d FIFO not set\n", ep->id);
+        errcode = MBED_ERROR_INVPARAM;
+        goto err;
+    }
+    if (ep->recv_mode == USBOTG_HS_RECV_MODE_STREAM) {
+        errcode = usbotghs_recv_stream_write(size, ep_id);
+        goto err;
+    }
 
     /*@ assert \valid(ep); */
     /* @assert \valid(ep->fifo); */
@@ -470,18 +1098,34 @@ mbed_error_t usbotghs_read_epx_fifo(uint32_t size, uint8_t ep_id)
         goto err;
     }
     /* Let's now do the read transaction itself... */
-    if (ep->fifo_lck != false) {
-        log_printf("[USBOTG][HS] invalid state! fifo already locked\n");
+    if (ep->fifo_owner != USBOTG_HS_FIFO_DRIVER_OWNED) {
+        log_printf("[USBOTG][HS] invalid state! fifo not owned by the driver\n");
         errcode = MBED_ERROR_INVSTATE;
         /*@ assert \at(usbotghs_ctx.out_eps[0 .. USBOTGHS_MAX_IN_EP-1],Here) == \at(usbotghs_ctx.out_eps[0 .. USBOTGHS_MAX_IN_EP-1],Pre);*/
         goto err;
     }
-    set_bool_with_membarrier(&(ep->fifo_lck), true);
+    /* no ownership change here: the packet copy is only marked in flight, the RAM FIFO
+     * being handed back to the upper layer (with a barrier) at the end of the transfer */
+    ep->fifo_owner = USBOTG_HS_FIFO_INFLIGHT;
+    usbotghs_compiler_barrier();
     /* @ assert \valid(ep->fifo + (0 .. (ep->fifo_idx+size-1))); */
-    usbotghs_read_core_fifo(&(ep->fifo[ep->fifo_idx]), size, ep->id);
+    if (ep->split_payload == NULL) {
+        usbotghs_read_core_fifo(&(ep->fifo[ep->fifo_idx]), size, ep->id);
+    } else if (ep->fifo_idx >= ep->split_hdr_size) {
+        /* header already received */
+        usbotghs_read_core_fifo(&(ep->split_payload[ep->fifo_idx - ep->split_hdr_size]), size, ep->id);
+    } else {
+        /* end of the header, followed by the begining of the payload */
+        uint32_t hdr_len = ep->split_hdr_size - ep->fifo_idx;
+        if (hdr_len > size) {
+            hdr_len = size;
+        }
+        usbotghs_read_core_fifo_split(&(ep->fifo[ep->fifo_idx]), hdr_len,
+                                      ep->split_payload, size - hdr_len, ep->id);
+    }
     ep->fifo_idx += size;
-    request_data_membarrier();
-    set_bool_with_membarrier(&(ep->fifo_lck), false);
+    usbotghs_compiler_barrier();
+    ep->fifo_owner = USBOTG_HS_FIFO_DRIVER_OWNED;
     /*@ assert errcode == MBED_ERROR_NONE; */
 err:
     /* INVSTATE patch */
@@ -505,29 +1149,29 @@ err:
 /*@
     @ requires ep_id < USBOTGHS_MAX_IN_EP;
     @ requires 0 < size <= USBOTG_HS_TX_CORE_FIFO_SZ;
-    @ requires \valid(&usbotghs_ctx.in_eps[ep_id].fifo_lck);
+    @ requires \valid(&usbotghs_ctx.in_eps[ep_id].fifo_owner);
     @ requires \valid(&usbotghs_ctx.in_eps[ep_id].fifo_idx);
     @ requires \valid(&usbotghs_ctx.in_eps[ep_id].fifo_size);
     @ requires \valid(usbotghs_ctx.in_eps[ep_id].fifo+(0..usbotghs_ctx.in_eps[ep_id].fifo_size-1));
-    @ requires \separated( ((uint32_t *)((int)(0x40040000 + (int)(0x1000 * (int)((int)usbotghs_ctx.in_eps[ep_id].id + 1))))),(uint32_t *) r_CORTEX_M_USBOTG_HS_GINTMSK,&usbotghs_ctx.in_eps[ep_id].fifo[\at(usbotghs_ctx.in_eps[ep_id].fifo_idx,Pre)],&usbotghs_ctx.in_eps[ep_id]+(0..sizeof(usbotghs_context_t)));
+    @ requires \separated( ((uint32_t *)((int)(0x40040000 + (int)(0x1000 * (int)((int)usbotghs_ctx.in_eps[ep_id].id + 1))))),&usbotghs_ctx.in_eps[ep_id].fifo[\at(usbotghs_ctx.in_eps[ep_id].fifo_idx,Pre)],&usbotghs_ctx.in_eps[ep_id]+(0..sizeof(usbotghs_context_t)));
 
 
     @ behavior fifolocked:
-    @    assumes usbotghs_ctx.in_eps[ep_id].fifo_lck == \true;
-    @    ensures \result == MBED_ERROR_INVSTATE && usbotghs_ctx.in_eps[ep_id].fifo_lck == \false;
-    @   assigns usbotghs_ctx.in_eps[ep_id].fifo_lck;
+    @    assumes usbotghs_ctx.in_eps[ep_id].fifo_owner != USBOTG_HS_FIFO_DRIVER_OWNED;
+    @    ensures \result == MBED_ERROR_INVSTATE;
+    @   assigns \nothing;
 
     @ behavior fifotoosmall:
-    @    assumes usbotghs_ctx.in_eps[ep_id].fifo_lck == \false;
+    @    assumes usbotghs_ctx.in_eps[ep_id].fifo_owner == USBOTG_HS_FIFO_DRIVER_OWNED;
     @    assumes (size > usbotghs_ctx.in_eps[ep_id].fifo_size || usbotghs_ctx.in_eps[ep_id].fifo_idx  > (usbotghs_ctx.in_eps[ep_id].fifo_size - size));
     @    ensures \result == MBED_ERROR_NOMEM;
-    @    assigns  usbotghs_ctx.in_eps[ep_id].fifo_lck;
+    @    assigns \nothing;
 
     @ behavior ok:
-    @    assumes usbotghs_ctx.in_eps[ep_id].fifo_lck == \false;
+    @    assumes usbotghs_ctx.in_eps[ep_id].fifo_owner == USBOTG_HS_FIFO_DRIVER_OWNED;
     @    assumes (size <= usbotghs_ctx.in_eps[ep_id].fifo_size && usbotghs_ctx.in_eps[ep_id].fifo_idx  <= (usbotghs_ctx.in_eps[ep_id].fifo_size - size));
     @    ensures \result == MBED_ERROR_NONE;
-    @   assigns *((uint32_t *)((int)(0x40040000 + (int)(0x1000 * (int)((int)usbotghs_ctx.in_eps[ep_id].id + 1))))), *((uint32_t *) r_CORTEX_M_USBOTG_HS_GINTMSK), usbotghs_ctx.in_eps[ep_id].fifo_idx, usbotghs_ctx.in_eps[ep_id].fifo_lck, usbotghs_ctx.in_eps[ep_id].fifo[\at(usbotghs_ctx.in_eps[ep_id].fifo_idx,Pre)];
+    @   assigns *((uint32_t *)((int)(0x40040000 + (int)(0x1000 * (int)((int)usbotghs_ctx.in_eps[ep_id].id + 1))))), usbotghs_ctx.in_eps[ep_id].fifo_idx, usbotghs_ctx.in_eps[ep_id].fifo_owner, usbotghs_ctx.in_eps[ep_id].fifo[\at(usbotghs_ctx.in_eps[ep_id].fifo_idx,Pre)];
 
     @ complete behaviors;
     @ disjoint behaviors;
@@ -543,16 +1187,16 @@ mbed_error_t usbotghs_write_epx_fifo(const uint32_t size, uint8_t ep_id)
     /* fixme: size > (USBOTG_HS_TX_CORE_FIFO_SZ - ep->fifo_idx) */
     ep = &(ctx->in_eps[ep_id]);
     /* Let's now do the read transaction itself... */
-    if (ep->fifo_lck == true) {
+    if (ep->fifo_owner != USBOTG_HS_FIFO_DRIVER_OWNED) {
         /* Tgus is not exactly dead code, but this check is a protection against reentrancy between the end of the
          * set_xmit_fifo() done by the caller (send_data()) and the current statement.
          * Here, we do not emulate this reentrancy behavior as framaC is not well-made for this */
         /*@ assert \false; */
-        log_printf("[USBOTG][HS] invalid state! fifo already locked\n");
+        log_printf("[USBOTG][HS] invalid state! fifo not owned by the driver\n");
         errcode = MBED_ERROR_INVSTATE;
-        goto err;
+        return errcode;
     }
-    /*@ assert \at(usbotghs_ctx.in_eps[ep_id].fifo_lck,Pre)!=\true; */
+    /*@ assert \at(usbotghs_ctx.in_eps[ep_id].fifo_owner,Pre) == USBOTG_HS_FIFO_DRIVER_OWNED; */
     if (size > ep->fifo_size) {
         /* this should be unreachable code, as fifo_size, fifo_idx and size are correlated and controled by the caller */
         /* Again, we may imagine a concurrent thread upgrading the FIFO somewhere during the caller's execution. Thus
@@ -567,17 +1211,531 @@ mbed_error_t usbotghs_write_epx_fifo(const uint32_t size, uint8_t ep_id)
         errcode = MBED_ERROR_NOMEM;
         goto err;
     }
-    set_bool_with_membarrier(&(ep->fifo_lck), true);
+    /* packet copy in flight, no ownership change (see usbotghs_read_epx_fifo()) */
+    ep->fifo_owner = USBOTG_HS_FIFO_INFLIGHT;
+    usbotghs_compiler_barrier();
     /* FIFO should have been set with set_xmit_fifo, accordingly with its size */
-    usbotghs_write_core_fifo(&(ep->fifo[ep->fifo_idx]), size, ep->id);
+    if (ep->iov != NULL) {
+        usbotghs_write_core_fifo_iov(ep, size);
+    } else if (ep->fifo_words && (ep->fifo_idx & 3) == 0) {
+        usbotghs_write_core_fifo_words((const uint32_t*)&(ep->fifo[ep->fifo_idx]), size, ep->id);
+    } else {
+        usbotghs_write_core_fifo(&(ep->fifo[ep->fifo_idx]), size, ep->id);
+    }
     /* buffer overflow check */
     ep->fifo_idx += size;
-    request_data_membarrier();
+    usbotghs_compiler_barrier();
+    ep->fifo_owner = USBOTG_HS_FIFO_DRIVER_OWNED;
+err:
+    return errcode;
+}
+
+
+/*
+ * EP0 can't transmit more than 3 packets and 127 bytes per transfer. Bigger
+ * EP0 IN transfers are fragmented by the driver: returns the size of the next
+ * fragment, which holds as many full packets as DIEPTSIZ0 allows, or the
+ * whole residual size when it fits in a single EP0 transfer.
+ */
+/*@
+  @ requires mpsize > 0;
+  @ assigns \nothing;
+  @ ensures \result <= residual_size;
+  */
+uint32_t usbotghs_ep0_fragment_size(uint32_t residual_size, uint16_t mpsize)
+{
+    uint32_t max_size = USBOTG_HS_DIEPTSIZ0_PKTCNT_MAX * (uint32_t)mpsize;
+
+    if (max_size > USBOTG_HS_DIEPTSIZ0_XFRSIZ_MAX) {
+        max_size = USBOTG_HS_DIEPTSIZ0_XFRSIZ_MAX;
+    }
+    if (residual_size <= max_size) {
+        return residual_size;
+    }
+    /* only full packets, the fragment must not end with a short packet */
+    return (max_size / mpsize) * mpsize;
+}
+
+/*
+ * Push into the EP Core TxFIFO as many packets of the current transfer as the
+ * Core TxFIFO can hold *now*, without waiting for free space.
+ * If some data is still pending, the EP TxFIFO empty interrupt is unmasked
+ * (DIEPEMPMSK) so that iepint_handler() continues the transfer on the next
+ * TXFE event. Once the whole transfer is pushed, this interrupt is masked back.
+ *
+ * When CONFIG_USR_DEV_USBOTGHS_TRIGER_XMIT_ON_HALF is set, TXFE rises as soon as
+ * the EP Core TxFIFO is half empty, and each call pushes at most half of the
+ * Core TxFIFO (and at least one packet): the CPU fills one half of the Core
+ * TxFIFO while the core transmits the packets of the other half.
+ */
+/*@
+  @ requires ep_id < USBOTGHS_MAX_IN_EP;
+  @ requires \separated(&usbotghs_ctx, ((uint32_t *) (USB_BACKEND_MEMORY_BASE .. USB_BACKEND_MEMORY_END)));
+  @ assigns *((uint32_t *) (USB_BACKEND_MEMORY_BASE .. USB_BACKEND_MEMORY_END)), usbotghs_ctx.in_eps[ep_id], GHOST_in_eps[ep_id].state;
+  */
+mbed_error_t usbotghs_fill_epx_txfifo(uint8_t ep_id)
+{
+    usbotghs_context_t *ctx = usbotghs_get_context();
+    usbotghs_ep_t*      ep = &(ctx->in_eps[ep_id]);
+    mbed_error_t errcode = MBED_ERROR_NONE;
+    uint32_t len = 0;
+#ifdef CONFIG_USR_DEV_USBOTGHS_TRIGER_XMIT_ON_HALF
+    uint32_t pushed = 0;
+    uint32_t half_size = 0;
+#endif
+
+    if (ep->fifo == NULL || ep->mpsize == 0) {
+        log_printf("[USBOTG][HS] EPx %d TxFIFO not set\n", ep_id);
+        errcode = MBED_ERROR_INVSTATE;
+        goto err;
+    }
+#ifdef CONFIG_USR_DEV_USBOTGHS_TRIGER_XMIT_ON_HALF
+    /* half of the EP Core TxFIFO depth: words to bytes, divided by two */
+    half_size = usbotghs_get_txfifo_depth(ep_id) * 2;
+#endif
+    /*@
+      @ loop assigns len, errcode, *((uint32_t *) (USB_BACKEND_MEMORY_BASE .. USB_BACKEND_MEMORY_END)), ep->fifo_idx, ep->fifo_owner, ep->state, GHOST_in_eps[ep_id].state;
+      @ loop variant ep->fifo_size - ep->fifo_idx;
+      */
+    while (ep->fifo_idx < ep->fifo_size) {
+        len = ep->fifo_size - ep->fifo_idx;
+        if (len > ep->mpsize) {
+            len = ep->mpsize;
+        }
+#ifdef CONFIG_USR_DEV_USBOTGHS_TRIGER_XMIT_ON_HALF
+        if (pushed > 0 && (pushed + len) > half_size) {
+            /* this half is full, the next half-empty TXFE event continues */
+            break;
+        }
+#endif
+        /* INEPTFSAV is in 32bits words unit */
+        if (get_reg(r_CORTEX_M_USBOTG_HS_DTXFSTS(ep_id), USBOTG_HS_DTXFSTS_INEPTFSAV) < ((len / 4) + ((len & 3) ? 1 : 0))) {
+            /* Core TxFIFO full, the next TXFE event will continue */
+            break;
+        }
+        if (len == (ep->fifo_size - ep->fifo_idx)) {
+            /* last packet, no more WIP. This must be set before writing the
+             * packet, as XFRC may rise as soon as it is in the Core TxFIFO */
+            set_u8_with_membarrier(&ep->state, USBOTG_HS_EP_STATE_DATA_IN);
+            //@ ghost GHOST_in_eps[ep_id].state = usbotghs_ctx.in_eps[ep_id].state;
+        }
+        if ((errcode = usbotghs_write_epx_fifo(len, ep_id)) != MBED_ERROR_NONE) {
+            goto err;
+        }
+#ifdef CONFIG_USR_DEV_USBOTGHS_TRIGER_XMIT_ON_HALF
+        pushed += len;
+#endif
+    }
+    if (ep->fifo_idx < ep->fifo_size) {
+        set_reg_bits(r_CORTEX_M_USBOTG_HS_DIEPEMPMSK, USBOTG_HS_DIEPEMPMSK_INEPTXFEM(ep_id));
+        return errcode;
+    }
 err:
-    set_bool_with_membarrier(&(ep->fifo_lck), false);
+    clear_reg_bits(r_CORTEX_M_USBOTG_HS_DIEPEMPMSK, USBOTG_HS_DIEPEMPMSK_INEPTXFEM(ep_id));
     return errcode;
 }
 
+#if CONFIG_USR_DEV_USBOTGHS_DMA
+/*
+ * DMA mode transfer policy.
+ *
+ * The core DMA works in place in the upper layer RAM FIFOs, with no CPU copy,
+ * whenever it can: this is what large bulk transfers need. Small control and
+ * interrupt transfers, for which the copy is cheaper than constraining the
+ * upper layer buffers, may use RAM FIFOs the core DMA can't (unaligned, in CCM
+ * RAM, not mpsize-multiple): they are copied by the CPU through the EP bounce
+ * buffer, the core DMA working in the bounce buffer. EP0 transfers always
+ * qualify (IN transfers are bounced fragment by fragment), interrupt EPs
+ * transfers up to the bounce threshold (see usbotghs_set_dma_bounce_threshold()).
+ */
+#if (CONFIG_USR_DEV_USBOTGHS_DMA_BOUNCE_SIZE % 4) != 0 || CONFIG_USR_DEV_USBOTGHS_DMA_BOUNCE_SIZE < 128
+# error "DMA bounce buffers must be a multiple of 4 bytes, and hold an EP0 IN fragment"
+#endif
+static uint32_t in_bounce[USBOTGHS_MAX_IN_EP][CONFIG_USR_DEV_USBOTGHS_DMA_BOUNCE_SIZE / 4];
+static uint32_t out_bounce[USBOTGHS_MAX_OUT_EP][CONFIG_USR_DEV_USBOTGHS_DMA_BOUNCE_SIZE / 4];
+static uint32_t dma_bounce_threshold = CONFIG_USR_DEV_USBOTGHS_DMA_BOUNCE_SIZE;
+
+/*@
+  @ requires \valid_read(ep);
+  @ requires ep->mpsize > 0;
+  @ assigns \nothing;
+  */
+usbotghs_dma_xfer_t usbotghs_dma_xfer_policy(const usbotghs_ep_t *ep, uint8_t ep_id,
+                                             const uint8_t *buf, uint32_t size, bool recv)
+{
+    uint32_t bounce_size = size;
+    bool buf_ok = usbotghs_dma_buf_ok(buf, size);
+    /* why the transfer is refused if it can't be bounced */
+    usbotghs_dma_xfer_t reject = buf_ok ? USBOTGHS_DMA_XFER_REJECT_SIZE : USBOTGHS_DMA_XFER_REJECT_BUF;
+
+    if (buf_ok == true && (recv == false || (size % ep->mpsize) == 0)) {
+        return USBOTGHS_DMA_XFER_IN_PLACE;
+    }
+    if (ep->type == USBOTG_HS_EP_TYPE_CONTROL) {
+        /* EP0 IN bounces a fragment at a time, EP0 OUT always receives
+         * in the driver EP0 DMA buffer */
+        return USBOTGHS_DMA_XFER_BOUNCE;
+    }
+    if (ep->type != USBOTG_HS_EP_TYPE_INT) {
+        return reject;
+    }
+    if (recv == true) {
+        /* the core DMA may write up to the programmed transfer size */
+        bounce_size = (size / ep->mpsize + ((size % ep->mpsize) ? 1 : 0)) * ep->mpsize;
+        if (ep_id > 0 && ep->completion == USBOTG_HS_EP_COMPLETE_EVERY_PKT) {
+            bounce_size = ep->mpsize;
+        }
+    }
+    if (size > dma_bounce_threshold || bounce_size > CONFIG_USR_DEV_USBOTGHS_DMA_BOUNCE_SIZE) {
+        return reject;
+    }
+    return USBOTGHS_DMA_XFER_BOUNCE;
+}
+
+/*
+ * Check that a transfer can be handled in DMA mode (see usbotghs_dma_xfer_policy()).
+ * This is the only place where refused transfers are logged and accounted.
+ */
+/*@
+  @ requires \valid_read(ep);
+  @ requires ep->mpsize > 0;
+  @ ensures \result == MBED_ERROR_NONE || \result == MBED_ERROR_INVPARAM;
+  */
+mbed_error_t usbotghs_dma_xfer_check(const usbotghs_ep_t *ep, uint8_t ep_id,
+                                     const uint8_t *buf, uint32_t size, bool recv)
+{
+    mbed_error_t errcode = MBED_ERROR_NONE;
+
+    switch (usbotghs_dma_xfer_policy(ep, ep_id, buf, size, recv)) {
+        case USBOTGHS_DMA_XFER_REJECT_BUF:
+            log_printf("[USBOTG][HS] ep %d: buffer %p not usable by the core DMA\n", ep_id, buf);
+            usbotghs_dma_count_reject(true);
+            errcode = MBED_ERROR_INVPARAM;
+            break;
+        case USBOTGHS_DMA_XFER_REJECT_SIZE:
+            log_printf("[USBOTG][HS] ep %d: transfer of %d bytes not handled by the core DMA\n", ep_id, size);
+            usbotghs_dma_count_reject(false);
+            errcode = MBED_ERROR_INVPARAM;
+            break;
+        default:
+            break;
+    }
+    return errcode;
+}
+
+/*
+ * Program the IN EP DMA address for the next size bytes of the current
+ * transfer (starting at fifo_idx), copying them to the EP bounce buffer
+ * if needed
+ */
+/*@
+  @ requires ep_id < USBOTGHS_MAX_IN_EP;
+  @ assigns *((uint32_t *) (USB_BACKEND_MEMORY_BASE .. USB_BACKEND_MEMORY_END)), in_bounce[ep_id][0 .. CONFIG_USR_DEV_USBOTGHS_DMA_BOUNCE_SIZE / 4 - 1];
+  */
+void usbotghs_xmit_dma_prepare(uint8_t ep_id, uint32_t size)
+{
+    usbotghs_context_t *ctx = usbotghs_get_context();
+    usbotghs_ep_t *ep = &ctx->in_eps[ep_id];
+    const uint8_t *src = &ep->fifo[ep->fifo_idx];
+
+    if (ep->dma_bounce == true) {
+        uint8_t *bounce = (uint8_t*)in_bounce[ep_id];
+        if (size > CONFIG_USR_DEV_USBOTGHS_DMA_BOUNCE_SIZE) {
+            /* checked by the transfer policy */
+            size = CONFIG_USR_DEV_USBOTGHS_DMA_BOUNCE_SIZE;
+        }
+        for (uint32_t i = 0; i < size; ++i) {
+            bounce[i] = src[i];
+        }
+        src = bounce;
+    }
+	write_reg_value(r_CORTEX_M_USBOTG_HS_DIEPDMA(ep_id), (uint32_t)src);
+}
+
+/*@
+  @ assigns dma_bounce_threshold;
+  @ ensures \result == MBED_ERROR_NONE || \result == MBED_ERROR_INVPARAM;
+  */
+mbed_error_t usbotghs_set_dma_bounce_threshold(uint32_t size)
+{
+    mbed_error_t errcode = MBED_ERROR_NONE;
+    if (size > CONFIG_USR_DEV_USBOTGHS_DMA_BOUNCE_SIZE) {
+        errcode = MBED_ERROR_INVPARAM;
+        goto err;
+    }
+    dma_bounce_threshold = size;
+err:
+    return errcode;
+}
+#else
+mbed_error_t usbotghs_set_dma_bounce_threshold(uint32_t size)
+{
+    /* PIO mode: every transfer is copied by the CPU */
+    (void)size;
+    return MBED_ERROR_UNSUPORTED_CMD;
+}
+#endif
+
+/*
+ * Check that a receive RAM FIFO of size bytes can be received on the given
+ * EP in a single transfer: for data EPs, the whole transfer must fit in the
+ * OUT EP transfer size register.
+ * In DMA mode, the core DMA writes whole words, up to the programmed transfer
+ * size, directly in the RAM FIFO: it must be DMA reachable, word-aligned, and
+ * hold a multiple of mpsize bytes, unless the transfer can go through the EP
+ * bounce buffer (see usbotghs_dma_xfer_policy()). EP0 is received through the
+ * driver EP0 DMA buffer.
+ */
+/*@
+  @ requires \valid_read(ep);
+  @ requires ep->mpsize > 0;
+  @ assigns \nothing;
+  @ ensures \result == MBED_ERROR_NONE || \result == MBED_ERROR_INVPARAM;
+  */
+static mbed_error_t usbotghs_recv_fifo_check(const usbotghs_ep_t *ep, const uint8_t *dst, uint32_t size, uint8_t epid)
+{
+    mbed_error_t errcode = MBED_ERROR_NONE;
+#if CONFIG_USR_DEV_USBOTGHS_DMA
+    if ((errcode = usbotghs_dma_xfer_check(ep, epid, dst, size, true)) != MBED_ERROR_NONE) {
+        goto err;
+    }
+#else
+    (void)dst;
+#endif
+    if (epid > 0 && ep->completion != USBOTG_HS_EP_COMPLETE_EVERY_PKT) {
+        uint32_t pktcount = size / ep->mpsize + ((size % ep->mpsize) ? 1: 0);
+        if (pktcount > USBOTG_HS_DOEPTSIZ_PKTCNT_MAX ||
+            pktcount * ep->mpsize > USBOTG_HS_DOEPTSIZ_XFRSIZ_MAX) {
+            log_printf("[USBOTG][HS] recv fifo of %d bytes too big for ep %d\n", size, epid);
+            errcode = MBED_ERROR_INVPARAM;
+            goto err;
+        }
+    }
+err:
+    return errcode;
+}
+
+/*
+ * Transfer size programmed in DOEPTSIZ for a receive RAM FIFO of size bytes
+ */
+/*@
+  @ requires \valid_read(ep);
+  @ requires ep->mpsize > 0;
+  @ assigns \nothing;
+  */
+static uint32_t usbotghs_recv_xfr_size(const usbotghs_ep_t *ep, uint32_t size, uint8_t epid)
+{
+    if (epid == 0 || ep->completion == USBOTG_HS_EP_COMPLETE_EVERY_PKT) {
+        /* a single packet per transfer */
+        return ep->mpsize;
+    }
+    return (size / ep->mpsize + ((size % ep->mpsize) ? 1: 0)) * ep->mpsize;
+}
+
+/*
+ * Set the given RAM FIFO as the current receive FIFO of the EP and program
+ * the EP transfer size accordingly. The size must have been checked with
+ * usbotghs_recv_fifo_check(). The EP is not enabled here.
+ */
+/*@
+  @ requires \valid(ep);
+  @ requires ep->mpsize > 0;
+  @ requires 0 <= epid < USBOTGHS_MAX_OUT_EP;
+  @ assigns *((uint32_t *) (USB_BACKEND_MEMORY_BASE .. USB_BACKEND_MEMORY_END)), ep->fifo, ep->fifo_size, ep->fifo_idx, ep->fifo_owner;
+  */
+static void usbotghs_arm_recv_fifo(usbotghs_ep_t *ep, uint8_t *dst, uint32_t size, uint8_t epid)
+{
+    /* set RAM FIFO for current EP. */
+
+    /* Lock FIFO handling here */
+    set_u8_with_membarrier(&(ep->fifo_owner), USBOTG_HS_FIFO_APP_OWNED);
+    ep->fifo = dst;
+    ep->fifo_idx = 0;
+    ep->fifo_size = size;
+    ep->split_payload = NULL;
+    ep->split_hdr_size = 0;
+    /* the following membarrier does push the previous fifo_* variables
+     * to the memory, even if they were not using memory barrier at each
+     * state. The lock being true, this section is concurrency safe  */
+    set_u8_with_membarrier(&(ep->fifo_owner), USBOTG_HS_FIFO_DRIVER_OWNED);
+
+#if CONFIG_USR_DEV_USBOTGHS_DMA
+    /* configuring DMA for this FIFO. EP0 always receives in the driver EP0
+     * DMA buffer (see usbotghs_ep0_dma_arm()) */
+    if (epid > 0) {
+        ep->dma_bounce = (usbotghs_dma_xfer_policy(ep, epid, dst, size, true) != USBOTGHS_DMA_XFER_IN_PLACE);
+    /*@ assert  r_CORTEX_M_USBOTG_HS_DOEPDMA(epid) \in ((uint32_t *) (USB_BACKEND_MEMORY_BASE .. USB_BACKEND_MEMORY_END)); */
+	//pmo pour les assigns
+	write_reg_value(r_CORTEX_M_USBOTG_HS_DOEPDMA(epid),
+                    ep->dma_bounce ? (uint32_t)out_bounce[epid] : (uint32_t)dst);
+    }
+#endif
+
+    if (epid > 0) {
+        /* configure EP for receiving size amount of data in a single
+         * multi-packet transfer: the core only rises XFRC (and the upper
+         * layer handler is only called) when all the packets have been
+         * received or on a short packet. The transfer size must be a
+         * multiple of mpsize (RM0090 DOEPTSIZx), the last packet being
+         * checked against the RAM FIFO size by the RXFLVL handler */
+        uint32_t xfr_size = usbotghs_recv_xfr_size(ep, size, epid);
+        /* with EVERY_PKT, each packet is a transfer on its own */
+        uint32_t pktcount = xfr_size / ep->mpsize;
+	/*@ assert  r_CORTEX_M_USBOTG_HS_DOEPTSIZ(epid) \in ((uint32_t *) (USB_BACKEND_MEMORY_BASE .. USB_BACKEND_MEMORY_END)); */
+	//pmo pour les assigns
+	set_reg_value(r_CORTEX_M_USBOTG_HS_DOEPTSIZ(epid), pktcount, USBOTG_HS_DOEPTSIZ_PKTCNT_Msk(epid), USBOTG_HS_DOEPTSIZ_PKTCNT_Pos(epid));
+	/*@ assert  r_CORTEX_M_USBOTG_HS_DOEPTSIZ(epid) \in ((uint32_t *) (USB_BACKEND_MEMORY_BASE .. USB_BACKEND_MEMORY_END)); */
+	//pmo pour les assigns
+        set_reg_value(r_CORTEX_M_USBOTG_HS_DOEPTSIZ(epid), xfr_size, USBOTG_HS_DOEPTSIZ_XFRSIZ_Msk(epid), USBOTG_HS_DOEPTSIZ_XFRSIZ_Pos(epid));
+    } else {
+        /* for EP0, the IP is not able to handle more than 64 bytes per
+         * transfer. As a consequence, even for bigger transfers (e.g. 4K)
+         * a fragmentation step is needed. This is done by:
+         * 1. settting pktcunt and pktsize so that oepint is executed for each
+         * 64 bytes packet
+         * 2. oepint (in DATA_OUT mode ) check that fifo_idx == fifo_size.
+         * If not, oepting does NOT call the upper class handler, silently
+         * acknowledge. */
+        set_reg_value(r_CORTEX_M_USBOTG_HS_DOEPTSIZ(epid), 1, USBOTG_HS_DOEPTSIZ_PKTCNT_Msk(epid), USBOTG_HS_DOEPTSIZ_PKTCNT_Pos(epid));
+        set_reg_value(r_CORTEX_M_USBOTG_HS_DOEPTSIZ(epid), ep->mpsize, USBOTG_HS_DOEPTSIZ_XFRSIZ_Msk(epid), USBOTG_HS_DOEPTSIZ_XFRSIZ_Pos(epid));
+    }
+}
+
+/*
+ * Re-enable a data OUT EP on the free space of its current RAM FIFO, after a
+ * transfer ended on a short packet while the EP completion policy requires
+ * the RAM FIFO to be full. Received data (fifo_idx) are kept.
+ */
+/*@
+  @ requires 0 < ep_id < USBOTGHS_MAX_OUT_EP;
+  @ assigns *((uint32_t *) (USB_BACKEND_MEMORY_BASE .. USB_BACKEND_MEMORY_END));
+  */
+void usbotghs_recv_fifo_continue(uint8_t ep_id)
+{
+    usbotghs_context_t *ctx = usbotghs_get_context();
+    usbotghs_ep_t *ep = &ctx->out_eps[ep_id];
+    uint32_t left = ep->fifo_size - ep->fifo_idx;
+    uint32_t pktcount = left / ep->mpsize + ((left % ep->mpsize) ? 1: 0);
+
+    log_printf("[USBOTG][HS] ep %d: short packet, %d bytes left to receive\n", ep_id, left);
+#if CONFIG_USR_DEV_USBOTGHS_DMA
+    write_reg_value(r_CORTEX_M_USBOTG_HS_DOEPDMA(ep_id), (uint32_t)&ep->fifo[ep->fifo_idx]);
+#endif
+    set_reg_value(r_CORTEX_M_USBOTG_HS_DOEPTSIZ(ep_id), pktcount, USBOTG_HS_DOEPTSIZ_PKTCNT_Msk(ep_id), USBOTG_HS_DOEPTSIZ_PKTCNT_Pos(ep_id));
+    set_reg_value(r_CORTEX_M_USBOTG_HS_DOEPTSIZ(ep_id), pktcount * ep->mpsize, USBOTG_HS_DOEPTSIZ_XFRSIZ_Msk(ep_id), USBOTG_HS_DOEPTSIZ_XFRSIZ_Pos(ep_id));
+    set_reg_bits(r_CORTEX_M_USBOTG_HS_DOEPCTL(ep_id),
+                 USBOTG_HS_DOEPCTL_CNAK_Msk | USBOTG_HS_DOEPCTL_EPENA_Msk);
+}
+
+#if CONFIG_USR_DEV_USBOTGHS_DMA
+/*
+ * EP0 OUT DMA buffer. In DMA mode, the core writes the received packets of
+ * the control EP by itself, SETUP packets included, even when the upper layer
+ * has not set its EP0 RAM FIFO yet: EP0 always receives in this driver owned
+ * buffer, which holds up to 3 back-to-back SETUP packets and a data packet.
+ * EP0 packets are then copied to the slots or to the EP0 RAM FIFO by the OUT
+ * EP handler. Data EPs receive directly in their RAM FIFOs.
+ */
+#define USBOTGHS_EP0_DMA_BUF_SZ (3 * USBOTGHS_SETUP_PKT_SZ + 64)
+static uint32_t ep0_dma_buf[USBOTGHS_EP0_DMA_BUF_SZ / 4] = { 0 };
+
+/*
+ * (Re)enable EP0 OUT on the EP0 DMA buffer. The core disables the EP on each
+ * transfer completion and SETUP stage: it must be enabled again for the next
+ * SETUP or data packet to be written in memory. The NAK state is untouched.
+ */
+/*@
+  @ assigns *((uint32_t *) (USB_BACKEND_MEMORY_BASE .. USB_BACKEND_MEMORY_END));
+  */
+void usbotghs_ep0_dma_arm(void)
+{
+    usbotghs_context_t *ctx = usbotghs_get_context();
+    uint16_t mpsize = ctx->out_eps[USBOTG_HS_EP0].mpsize;
+
+    if (mpsize == 0 || mpsize > 64) {
+        mpsize = 64;
+    }
+    write_reg_value(r_CORTEX_M_USBOTG_HS_DOEPDMA(USBOTG_HS_EP0), (uint32_t)ep0_dma_buf);
+    set_reg(r_CORTEX_M_USBOTG_HS_DOEPTSIZ(USBOTG_HS_EP0), 3, USBOTG_HS_DOEPTSIZ_STUPCNT);
+    set_reg_value(r_CORTEX_M_USBOTG_HS_DOEPTSIZ(USBOTG_HS_EP0), 1, USBOTG_HS_DOEPTSIZ_PKTCNT_Msk(USBOTG_HS_EP0), USBOTG_HS_DOEPTSIZ_PKTCNT_Pos(USBOTG_HS_EP0));
+    set_reg_value(r_CORTEX_M_USBOTG_HS_DOEPTSIZ(USBOTG_HS_EP0), mpsize, USBOTG_HS_DOEPTSIZ_XFRSIZ_Msk(USBOTG_HS_EP0), USBOTG_HS_DOEPTSIZ_XFRSIZ_Pos(USBOTG_HS_EP0));
+    set_reg_bits(r_CORTEX_M_USBOTG_HS_DOEPCTL(USBOTG_HS_EP0), USBOTG_HS_DOEPCTL_EPENA_Msk);
+}
+
+/*
+ * Return the last len bytes written by the core DMA in the EP0 DMA buffer
+ * (whole words being written, DOEPDMA is incremented by a multiple of 4)
+ */
+/*@
+  @ requires len <= USBOTGHS_EP0_DMA_BUF_SZ;
+  @ assigns \nothing;
+  */
+static const uint8_t *usbotghs_ep0_dma_last(uint32_t len)
+{
+    physaddr_t start = (physaddr_t)ep0_dma_buf;
+    physaddr_t cur = (physaddr_t)read_reg_value(r_CORTEX_M_USBOTG_HS_DOEPDMA(USBOTG_HS_EP0));
+    uint32_t words_len = (len + 3) & ~3U;
+
+    if (cur < start + words_len || cur > start + USBOTGHS_EP0_DMA_BUF_SZ) {
+        /* not consistent with the buffer: fault injection ? */
+        return (const uint8_t*)ep0_dma_buf;
+    }
+    return (const uint8_t*)(cur - words_len);
+}
+
+/*
+ * Return the last SETUP packet written by the core DMA (STUP event)
+ */
+const uint8_t *usbotghs_ep0_dma_setup_pkt(void)
+{
+    return usbotghs_ep0_dma_last(USBOTGHS_SETUP_PKT_SZ);
+}
+
+/*
+ * Account a transfer completed (XFRC) by the core DMA on an OUT EP, in place
+ * of the RXFLVL handler: the received size is the programmed transfer size
+ * minus the residual one. Data EPs have been written in their RAM FIFO, EP0
+ * and bounced transfers are copied from the DMA buffer to the RAM FIFO.
+ * Return the size received by this transfer.
+ */
+/*@
+  @ requires ep_id < USBOTGHS_MAX_OUT_EP;
+  @ assigns usbotghs_ctx.out_eps[ep_id];
+  */
+uint32_t usbotghs_recv_dma_complete(uint8_t ep_id)
+{
+    usbotghs_context_t *ctx = usbotghs_get_context();
+    usbotghs_ep_t *ep = &ctx->out_eps[ep_id];
+    uint32_t xfr_size;
+    uint32_t left;
+    uint32_t size;
+
+    if (ep->mpsize == 0) {
+        return 0;
+    }
+    xfr_size = usbotghs_recv_xfr_size(ep, ep->fifo_size, ep_id);
+    left = get_reg_value(r_CORTEX_M_USBOTG_HS_DOEPTSIZ(ep_id), USBOTG_HS_DOEPTSIZ_XFRSIZ_Msk(ep_id), USBOTG_HS_DOEPTSIZ_XFRSIZ_Pos(ep_id));
+    size = (left < xfr_size) ? (xfr_size - left) : 0;
+    if (ep->fifo == NULL || size > ep->fifo_size - ep->fifo_idx) {
+        /* data EPs transfers are bounded by their RAM FIFO (see
+         * usbotghs_recv_fifo_check()): EP0 packet not fitting, dropped */
+        log_printf("[USBOTG][HS] ep %d: %d bytes DMA transfer dropped\n", ep_id, size);
+        return 0;
+    }
+    if (ep_id == USBOTG_HS_EP0 || ep->dma_bounce == true) {
+        const uint8_t *pkt = (ep_id == USBOTG_HS_EP0) ? usbotghs_ep0_dma_last(size) : (const uint8_t*)out_bounce[ep_id];
+        for (uint32_t i = 0; i < size; ++i) {
+            ep->fifo[ep->fifo_idx + i] = pkt[i];
+        }
+    }
+    if (ep_id == USBOTG_HS_EP0 && size < ep->mpsize) {
+        /* short packet: last packet of the data stage */
+        set_u8_with_membarrier(&ep->state, USBOTG_HS_EP_STATE_DATA_OUT);
+    }
+    ep->fifo_idx += size;
+    return size;
+}
+#endif
 
 /*
  * Configure for receiving data. Receiving data is a triggering event, not a direct call.
@@ -601,16 +1759,16 @@ err:
 /*@
 
   @ requires \separated(&GHOST_opaque_drv_privates, &usbotghs_ctx, ((uint32_t *) (USB_BACKEND_MEMORY_BASE .. USB_BACKEND_MEMORY_END)), dst + (0..size-1));
-  @ assigns *((uint32_t *) (USB_BACKEND_MEMORY_BASE .. USB_BACKEND_MEMORY_END)), usbotghs_ctx.out_eps[epid].fifo, usbotghs_ctx.out_eps[epid].fifo_size, usbotghs_ctx.out_eps[epid].fifo_idx, usbotghs_ctx.out_eps[epid].fifo_lck;
+  @ assigns *((uint32_t *) (USB_BACKEND_MEMORY_BASE .. USB_BACKEND_MEMORY_END)), usbotghs_ctx.out_eps[epid].fifo, usbotghs_ctx.out_eps[epid].fifo_size, usbotghs_ctx.out_eps[epid].fifo_idx, usbotghs_ctx.out_eps[epid].fifo_owner;
 
   // private function contract, depend on private globals state
   @ ensures (\valid(dst) && epid < USBOTGHS_MAX_OUT_EP && (usbotghs_ctx.out_eps[epid].configured == \false || usbotghs_ctx.out_eps[epid].mpsize == 0)) ==> \result == MBED_ERROR_INVPARAM;
 
   @ ensures (\valid(dst) && epid < USBOTGHS_MAX_OUT_EP && (usbotghs_ctx.out_eps[epid].configured == \true && usbotghs_ctx.out_eps[epid].mpsize > 0) && size == 0) ==> \result == MBED_ERROR_INVPARAM;
 
-  @ ensures(\valid(dst) && epid < USBOTGHS_MAX_OUT_EP && (usbotghs_ctx.out_eps[epid].configured == \true && usbotghs_ctx.out_eps[epid].mpsize > 0) && size > 0 && usbotghs_ctx.out_eps[epid].fifo_lck == \true) ==> \result == MBED_ERROR_INVSTATE;
+  @ ensures(\valid(dst) && epid < USBOTGHS_MAX_OUT_EP && (usbotghs_ctx.out_eps[epid].configured == \true && usbotghs_ctx.out_eps[epid].mpsize > 0) && size > 0 && usbotghs_ctx.out_eps[epid].fifo_owner != USBOTG_HS_FIFO_DRIVER_OWNED) ==> \result == MBED_ERROR_INVSTATE;
 
-  @ ensures (\valid(dst) && epid < USBOTGHS_MAX_OUT_EP && (usbotghs_ctx.out_eps[epid].configured == \true && usbotghs_ctx.out_eps[epid].mpsize > 0) && size > 0 && usbotghs_ctx.out_eps[epid].fifo_lck == \false) ==> \result == MBED_ERROR_NONE;
+  @ ensures (\valid(dst) && epid < USBOTGHS_MAX_OUT_EP && (usbotghs_ctx.out_eps[epid].configured == \true && usbotghs_ctx.out_eps[epid].mpsize > 0) && size > 0 && usbotghs_ctx.out_eps[epid].fifo_owner == USBOTG_HS_FIFO_DRIVER_OWNED) ==> \result == MBED_ERROR_NONE;
 
   @ ensures \result == MBED_ERROR_NONE ==> (
      usbotghs_ctx.out_eps[epid].fifo == dst &&
@@ -656,81 +1814,172 @@ mbed_error_t usbotghs_set_recv_fifo(uint8_t *dst, uint32_t size, uint8_t epid)
         goto err;
     }
 #if CONFIG_USR_DEV_USBOTGHS_DMA
-    if (ep->recv_fifo_dma_lck) {
+    if (epid > 0 && get_reg(r_CORTEX_M_USBOTG_HS_DOEPCTL(epid), USBOTG_HS_DOEPCTL_EPENA)) {
         /* a DMA transaction is currently being executed toward the recv FIFO.
          * Wait for it to finish before resetting it */
         errcode = MBED_ERROR_INVSTATE;
         goto err;
     }
 #endif
-    if (ep->fifo_lck == true) {
+    if (ep->fifo_owner != USBOTG_HS_FIFO_DRIVER_OWNED) {
         /* Recv FIFO is currently being proceeded ! */
         errcode = MBED_ERROR_INVSTATE;
         goto err;
     }
 
-    /* set RAM FIFO for current EP. */
+    if (ep->recv_mode != USBOTG_HS_RECV_MODE_FIFO) {
+        /* RAM FIFOs of this EP are handled by its receive ring or stream */
+        errcode = MBED_ERROR_INVSTATE;
+        goto err;
+    }
+    if (usbotghs_recv_fifo_check(ep, dst, size, epid) != MBED_ERROR_NONE) {
+        errcode = MBED_ERROR_INVPARAM;
+        goto err;
+    }
 
-    /* Lock FIFO handling here */
-    set_bool_with_membarrier(&(ep->fifo_lck), true);
-    ep->fifo = dst;
-    ep->fifo_idx = 0;
-    ep->fifo_size = size;
-    /* the following membarrier does push the previous fifo_* variables
-     * to the memory, even if they were not using memory barrier at each
-     * state. The lock being true, this section is concurrency safe  */
-    set_bool_with_membarrier(&(ep->fifo_lck), false);
+    usbotghs_arm_recv_fifo(ep, dst, size, epid);
+    /* FIFO is now configured */
+    /* CNAK is done by endpoint activation */
+    /*@ assert errcode == MBED_ERROR_NONE; */
+err:
+    return errcode;
+}
+
+/*
+ * Configure for receiving a transfer made of a header followed by a payload
+ * (e.g. a command block followed by its data), in two distinct RAM FIFOs.
+ * This is a single transfer, as with usbotghs_set_recv_fifo() on a RAM FIFO of
+ * hdr_size + payload_size bytes: the first hdr_size bytes are stored in hdr,
+ * the next ones in payload. The upper layer handler is called with the header
+ * size once it is received, then with the payload size at the end of the
+ * transfer (see usbotghs_recv_split_hdr_done() and usbotghs_recv_split_complete()).
+ */
+/*@
+  @ requires \separated(&GHOST_opaque_drv_privates, &usbotghs_ctx, ((uint32_t *) (USB_BACKEND_MEMORY_BASE .. USB_BACKEND_MEMORY_END)), hdr + (0..hdr_size-1), payload + (0..payload_size-1));
+  @ assigns GHOST_opaque_drv_privates, *((uint32_t *) (USB_BACKEND_MEMORY_BASE .. USB_BACKEND_MEMORY_END)), usbotghs_ctx.out_eps[epid];
+  @ ensures (hdr == NULL || payload == NULL || hdr_size == 0 || payload_size == 0 || epid >= USBOTGHS_MAX_OUT_EP) ==> \result == MBED_ERROR_INVPARAM;
+  */
+mbed_error_t usbotghs_set_recv_fifo_split(uint8_t *hdr, uint32_t hdr_size,
+                                          uint8_t *payload, uint32_t payload_size,
+                                          uint8_t epid)
+{
+    usbotghs_context_t *ctx = usbotghs_get_context();
+    usbotghs_ep_t*      ep;
+    mbed_error_t        errcode = MBED_ERROR_NONE;
+
+    /* no public (exported) variable is set. This GHOST var is used as countermeasure to public assignment
+     * specification for functions that assign private global content */
+    //@ ghost GHOST_opaque_drv_privates = 1;
 
+    if (hdr == NULL || payload == NULL || hdr_size == 0 || payload_size == 0) {
+        errcode = MBED_ERROR_INVPARAM;
+        goto err;
+    }
+    if (epid >= USBOTGHS_MAX_OUT_EP || payload_size > (0xffffffff - hdr_size)) {
+        errcode = MBED_ERROR_INVPARAM;
+        goto err;
+    }
 #if CONFIG_USR_DEV_USBOTGHS_DMA
-    /* configuring DMA for this FIFO */
-    /* set EP0 FIFO using local buffer */
-    /*@ assert  r_CORTEX_M_USBOTG_HS_DOEPDMA(epid) \in ((uint32_t *) (USB_BACKEND_MEMORY_BASE .. USB_BACKEND_MEMORY_END)); */
-	//pmo pour les assigns
-	write_reg_value(r_CORTEX_M_USBOTG_HS_DOEPDMA(epid),
-                    dst);
+    /* the core DMA writes the transfer in a single contiguous buffer */
+    errcode = MBED_ERROR_UNSUPORTED_CMD;
+    goto err;
 #endif
-
-    if (epid > 0) {
-        /* configure EP for receiving size amount of data */
-        uint32_t pktcount = size / ep->mpsize + (size & (ep->mpsize - 1) ? 1: 0);
-	/*@ assert  r_CORTEX_M_USBOTG_HS_DOEPTSIZ(epid) \in ((uint32_t *) (USB_BACKEND_MEMORY_BASE .. USB_BACKEND_MEMORY_END)); */
-	//pmo pour les assigns
-	set_reg_value(r_CORTEX_M_USBOTG_HS_DOEPTSIZ(epid), pktcount, USBOTG_HS_DOEPTSIZ_PKTCNT_Msk(epid), USBOTG_HS_DOEPTSIZ_PKTCNT_Pos(epid));
-	/*@ assert  r_CORTEX_M_USBOTG_HS_DOEPTSIZ(epid) \in ((uint32_t *) (USB_BACKEND_MEMORY_BASE .. USB_BACKEND_MEMORY_END)); */
-	//pmo pour les assigns
-        set_reg_value(r_CORTEX_M_USBOTG_HS_DOEPTSIZ(epid), size, USBOTG_HS_DOEPTSIZ_XFRSIZ_Msk(epid), USBOTG_HS_DOEPTSIZ_XFRSIZ_Pos(ep));
-    } else {
-        /* for EP0, the IP is not able to handle more than 64 bytes per
-         * transfer. As a consequence, even for bigger transfers (e.g. 4K)
-         * a fragmentation step is needed. This is done by:
-         * 1. settting pktcunt and pktsize so that oepint is executed for each
-         * 64 bytes packet
-         * 2. oepint (in DATA_OUT mode ) check that fifo_idx == fifo_size.
-         * If not, oepting does NOT call the upper class handler, silently
-         * acknowledge. */
-        set_reg_value(r_CORTEX_M_USBOTG_HS_DOEPTSIZ(epid), 1, USBOTG_HS_DOEPTSIZ_PKTCNT_Msk(epid), USBOTG_HS_DOEPTSIZ_PKTCNT_Pos(epid));
-        set_reg_value(r_CORTEX_M_USBOTG_HS_DOEPTSIZ(epid), ep->mpsize, USBOTG_HS_DOEPTSIZ_XFRSIZ_Msk(epid), USBOTG_HS_DOEPTSIZ_XFRSIZ_Pos(epid));
+    ep = &(ctx->out_eps[epid]);
+    if (!ep->configured || !ep->mpsize) {
+        errcode = MBED_ERROR_INVPARAM;
+        goto err;
     }
-    /* FIFO is now configured */
-    /* CNAK is done by endpoint activation */
-    /*@ assert errcode == MBED_ERROR_NONE; */
+    if (ep->fifo_owner != USBOTG_HS_FIFO_DRIVER_OWNED ||
+        ep->recv_mode != USBOTG_HS_RECV_MODE_FIFO) {
+        errcode = MBED_ERROR_INVSTATE;
+        goto err;
+    }
+    if (usbotghs_recv_fifo_check(ep, hdr, hdr_size + payload_size, epid) != MBED_ERROR_NONE) {
+        errcode = MBED_ERROR_INVPARAM;
+        goto err;
+    }
+
+    usbotghs_arm_recv_fifo(ep, hdr, hdr_size + payload_size, epid);
+    /* the EP is not enabled yet, no packet can be received in between */
+    set_u8_with_membarrier(&(ep->fifo_owner), USBOTG_HS_FIFO_APP_OWNED);
+    ep->split_payload = payload;
+    ep->split_hdr_size = hdr_size;
+    set_u8_with_membarrier(&(ep->fifo_owner), USBOTG_HS_FIFO_DRIVER_OWNED);
 err:
     return errcode;
 }
 
+/*
+ * Tell if the packet of size bytes just read in the split RAM FIFO of the given
+ * OUT EP completed the header, the transfer going on in the payload. A transfer
+ * ending with the header (short packet) is reported on XFRC instead, once the
+ * EP is re-armed on the payload (see usbotghs_recv_split_complete()).
+ */
+/*@
+  @ requires 0 < ep_id < USBOTGHS_MAX_OUT_EP;
+  @ assigns \nothing;
+  */
+bool usbotghs_recv_split_hdr_done(uint8_t ep_id, uint32_t size)
+{
+    usbotghs_context_t *ctx = usbotghs_get_context();
+    usbotghs_ep_t *ep = &ctx->out_eps[ep_id];
+
+    if (ep->split_payload == NULL || size > ep->fifo_idx) {
+        return false;
+    }
+    if (ep->fifo_idx - size >= ep->split_hdr_size || ep->fifo_idx < ep->split_hdr_size) {
+        /* header already received, or not yet */
+        return false;
+    }
+    if (ep->fifo_idx > ep->split_hdr_size) {
+        /* the packet holds the begining of the payload */
+        return true;
+    }
+    /* the packet ends on the header: is it the last one of the transfer ? */
+    return (size == ep->mpsize && ep->completion != USBOTG_HS_EP_COMPLETE_EVERY_PKT);
+}
+
+/*
+ * Handle the end of a transfer on a split RAM FIFO (XFRC). If a short packet
+ * ended the transfer within the header, the EP is re-armed on the payload
+ * before the upper layer parses the header. Return the size to hand to the
+ * upper layer: the received header size in that case, the payload size
+ * otherwise (the header having already been reported on reception).
+ */
+/*@
+  @ requires 0 < ep_id < USBOTGHS_MAX_OUT_EP;
+  @ assigns *((uint32_t *) (USB_BACKEND_MEMORY_BASE .. USB_BACKEND_MEMORY_END)), usbotghs_ctx.out_eps[ep_id];
+  */
+uint32_t usbotghs_recv_split_complete(uint8_t ep_id)
+{
+    usbotghs_context_t *ctx = usbotghs_get_context();
+    usbotghs_ep_t *ep = &ctx->out_eps[ep_id];
+    uint32_t size = ep->fifo_idx;
+
+    if (size > ep->split_hdr_size) {
+        return size - ep->split_hdr_size;
+    }
+    /* as in ring mode, no NAK/re-arm cycle for the upper layer between the
+     * header and the payload */
+    usbotghs_arm_recv_fifo(ep, ep->split_payload, ep->fifo_size - ep->split_hdr_size, ep_id);
+    set_reg_bits(r_CORTEX_M_USBOTG_HS_DOEPCTL(ep_id),
+                 USBOTG_HS_DOEPCTL_CNAK_Msk | USBOTG_HS_DOEPCTL_EPENA_Msk);
+    return size;
+}
+
 
 
 /* epid check done by calling function, usbotghs_send_data
-    TODO : add !CONFIG_USR_DRV_USBOTGHS_MODE_DEVICE behavior and CONFIG_USR_DEV_USBOTGHS_DMA behavior
+    TODO : add !CONFIG_USR_DRV_USBOTGHS_MODE_DEVICE behavior
 */
 /*@
     @ requires \valid_read(&usbotghs_ctx.in_eps[epid]);
-    @ requires \valid_read(&usbotghs_ctx.in_eps[epid].fifo_lck);
+    @ requires \valid_read(&usbotghs_ctx.in_eps[epid].fifo_owner);
     @ requires 0 <= epid < USBOTGHS_MAX_IN_EP;
     @ requires size > 0;
     @ requires \valid_read(src+(0..size-1));
     @ requires usbotghs_ctx.in_eps[epid].configured == \true;
-    @ requires \separated(src+(0..size-1),&usbotghs_ctx.in_eps[epid].fifo_lck, &usbotghs_ctx.in_eps[epid].fifo_size,&usbotghs_ctx.in_eps[epid].fifo_idx,&usbotghs_ctx.in_eps[epid].fifo);
+    @ requires \separated(src+(0..size-1),&usbotghs_ctx.in_eps[epid].fifo_owner, &usbotghs_ctx.in_eps[epid].fifo_size,&usbotghs_ctx.in_eps[epid].fifo_idx,&usbotghs_ctx.in_eps[epid].fifo);
     @ ensures \result == MBED_ERROR_NONE ==> (
        usbotghs_ctx.in_eps[epid].fifo == src &&
        usbotghs_ctx.in_eps[epid].fifo_size == size &&
@@ -738,18 +1987,18 @@ err:
       );
 
     @ behavior fifo_lock:
-    @   assumes (usbotghs_ctx.in_eps[epid].fifo_lck == \true)  ;
+    @   assumes (usbotghs_ctx.in_eps[epid].fifo_owner != USBOTG_HS_FIFO_DRIVER_OWNED)  ;
     @   ensures \result == MBED_ERROR_INVSTATE ;
     @   assigns \nothing;
 
     @ behavior fifo_not_lck:
-    @   assumes !(usbotghs_ctx.in_eps[epid].fifo_lck == \true)  ;
-    @   assumes \valid(&usbotghs_ctx.in_eps[epid].fifo_lck);
+    @   assumes !(usbotghs_ctx.in_eps[epid].fifo_owner != USBOTG_HS_FIFO_DRIVER_OWNED)  ;
+    @   assumes \valid(&usbotghs_ctx.in_eps[epid].fifo_owner);
     @   assumes \valid(&usbotghs_ctx.in_eps[epid].fifo);
     @   assumes \valid(&usbotghs_ctx.in_eps[epid].fifo_idx);
     @   assumes \valid(&usbotghs_ctx.in_eps[epid].fifo_size);
-    @   ensures \result == MBED_ERROR_NONE && usbotghs_ctx.in_eps[epid].fifo == src && usbotghs_ctx.in_eps[epid].fifo_lck == \false && usbotghs_ctx.in_eps[epid].fifo_idx == 0 && usbotghs_ctx.in_eps[epid].fifo_size == size ;
-    @   assigns usbotghs_ctx.in_eps[epid].fifo, usbotghs_ctx.in_eps[epid].fifo_lck, usbotghs_ctx.in_eps[epid].fifo_idx,usbotghs_ctx.in_eps[epid].fifo_size ;
+    @   ensures \result == MBED_ERROR_NONE && usbotghs_ctx.in_eps[epid].fifo == src && usbotghs_ctx.in_eps[epid].fifo_owner == USBOTG_HS_FIFO_DRIVER_OWNED && usbotghs_ctx.in_eps[epid].fifo_idx == 0 && usbotghs_ctx.in_eps[epid].fifo_size == size ;
+    @   assigns usbotghs_ctx.in_eps[epid].fifo, usbotghs_ctx.in_eps[epid].fifo_owner, usbotghs_ctx.in_eps[epid].fifo_idx,usbotghs_ctx.in_eps[epid].fifo_size ;
 
     @ complete behaviors;
     @ disjoint behaviors ;
@@ -767,26 +2016,30 @@ mbed_error_t usbotghs_set_xmit_fifo(uint8_t *src, uint32_t size, uint8_t epid)
         /* transmition is done using out_eps in device mode */
         ep = &(ctx->out_eps[epid]);
 #endif
-    if (ep->fifo_lck == true) {
+    if (ep->fifo_owner != USBOTG_HS_FIFO_DRIVER_OWNED) {
       /* a DMA transaction is currently being executed toward the recv FIFO.
        * Wait for it to finish before resetting it */
       errcode = MBED_ERROR_INVSTATE;
-      /*@ assert (\at(usbotghs_ctx.in_eps[epid].fifo_lck, Pre)==\true) ==> errcode==MBED_ERROR_INVSTATE; */
+      /*@ assert (\at(usbotghs_ctx.in_eps[epid].fifo_owner,Pre) != USBOTG_HS_FIFO_DRIVER_OWNED) ==> errcode==MBED_ERROR_INVSTATE; */
       goto err;
     }
-    /*@ assert errcode != MBED_ERROR_INVSTATE && \at(usbotghs_ctx.in_eps[epid].fifo_lck,Pre)!= \true; */
+    /*@ assert errcode != MBED_ERROR_INVSTATE && \at(usbotghs_ctx.in_eps[epid].fifo_owner,Pre) == USBOTG_HS_FIFO_DRIVER_OWNED; */
     log_printf("[USBOTG][HS] set ep %d TxFIFO to %p (size %d)\n", ep->id, src, size);
 
-    set_bool_with_membarrier(&(ep->fifo_lck), true);
+    set_u8_with_membarrier(&(ep->fifo_owner), USBOTG_HS_FIFO_APP_OWNED);
     /* set RAM FIFO for current EP. */
     ep->fifo = src;
     ep->fifo_idx = 0;
     ep->fifo_size = size;
-    set_bool_with_membarrier(&(ep->fifo_lck), false);
+    ep->iov = NULL;
+    ep->fifo_words = false;
+    set_u8_with_membarrier(&(ep->fifo_owner), USBOTG_HS_FIFO_DRIVER_OWNED);
 
 #if CONFIG_USR_DEV_USBOTGHS_DMA
-    /* 1. set DMA src address*/
-	write_reg_value(r_CORTEX_M_USBOTG_HS_DOEPDMA(epid), src);
+    /* the DMA src address is set for each transfer (or EP0 fragment) by
+     * usbotghs_xmit_dma_prepare(): in the RAM FIFO, with no CPU copy, or in
+     * the EP bounce buffer */
+    ep->dma_bounce = (usbotghs_dma_xfer_policy(ep, epid, src, size, false) != USBOTGHS_DMA_XFER_IN_PLACE);
 #endif
 
     /* FIFO is now configured */
@@ -794,6 +2047,329 @@ err:
 	return errcode;
 }
 
+/*
+ * Vectored variant of usbotghs_set_xmit_fifo(). The segments are not copied:
+ * they are read by usbotghs_write_epx_fifo() during the whole transfer.
+ * size is the total size of the segments, checked by the caller.
+ */
+/*@
+  @ requires epid < USBOTGHS_MAX_IN_EP;
+  @ requires \valid_read(iov + (0 .. iovcnt-1));
+  @ requires iovcnt > 0;
+  @ assigns usbotghs_ctx.in_eps[epid];
+  @ ensures \result == MBED_ERROR_NONE || \result == MBED_ERROR_INVSTATE;
+  */
+mbed_error_t usbotghs_set_xmit_fifov(const usbotghs_iovec_t *iov, uint8_t iovcnt, uint32_t size, uint8_t epid)
+{
+    usbotghs_context_t *ctx = usbotghs_get_context();
+    usbotghs_ep_t*      ep;
+    mbed_error_t        errcode = MBED_ERROR_NONE;
+
+    ep = &(ctx->in_eps[epid]);
+    if (ep->fifo_owner != USBOTG_HS_FIFO_DRIVER_OWNED) {
+      errcode = MBED_ERROR_INVSTATE;
+      goto err;
+    }
+    log_printf("[USBOTG][HS] set ep %d TxFIFO to %d segments (size %d)\n", ep->id, iovcnt, size);
+
+    set_u8_with_membarrier(&(ep->fifo_owner), USBOTG_HS_FIFO_APP_OWNED);
+    /* fifo is only used as 'xmit fifo set' marker here, the content is read
+     * from the segments */
+    ep->fifo = (uint8_t*)iov[0].base;
+    ep->fifo_idx = 0;
+    ep->fifo_size = size;
+    ep->iov = iov;
+    ep->iov_cnt = iovcnt;
+    ep->iov_idx = 0;
+    ep->iov_off = 0;
+    ep->fifo_words = false;
+    set_u8_with_membarrier(&(ep->fifo_owner), USBOTG_HS_FIFO_DRIVER_OWNED);
+err:
+    return errcode;
+}
+
+/*
+ * Word-packed variant of usbotghs_set_xmit_fifo(): src holds the payload as
+ * little-endian Core FIFO words, written as is by usbotghs_write_epx_fifo().
+ * The payload is never written by the driver, fifo is only read for xmit.
+ */
+/*@
+  @ requires epid < USBOTGHS_MAX_IN_EP;
+  @ assigns usbotghs_ctx.in_eps[epid];
+  @ ensures \result == MBED_ERROR_NONE || \result == MBED_ERROR_INVSTATE;
+  */
+mbed_error_t usbotghs_set_xmit_fifo_words(const uint32_t *src, uint32_t size, uint8_t epid)
+{
+    usbotghs_context_t *ctx = usbotghs_get_context();
+    mbed_error_t        errcode = MBED_ERROR_NONE;
+
+    if ((errcode = usbotghs_set_xmit_fifo((uint8_t*)src, size, epid)) != MBED_ERROR_NONE) {
+        goto err;
+    }
+    ctx->in_eps[epid].fifo_words = true;
+err:
+    return errcode;
+}
+
+/*
+ * IN transfers queues. Each IN EP has its own statically allocated set of
+ * transfer descriptors, used as a ring: the producer (usbotghs_send_data() and
+ * usbotghs_send_datav()) only pushes at the tail with the EP interrupt masked,
+ * and the consumer (iepint_handler()) only pops at the head.
+ */
+typedef struct {
+    usbotghs_xmit_req_t reqs[CONFIG_USR_DEV_USBOTGHS_XMIT_QUEUE_DEPTH];
+    uint8_t             head;
+    uint8_t             count;
+} usbotghs_xmit_queue_t;
+
+static usbotghs_xmit_queue_t xmit_queues[USBOTGHS_MAX_IN_EP] = { 0 };
+
+/*@
+  @ requires ep_id < USBOTGHS_MAX_IN_EP;
+  @ requires \valid_read(req);
+  @ assigns xmit_queues[ep_id];
+  @ ensures \result == MBED_ERROR_NONE || \result == MBED_ERROR_NOSTORAGE;
+  */
+mbed_error_t usbotghs_xmit_enqueue(const usbotghs_xmit_req_t *req, uint8_t ep_id)
+{
+    mbed_error_t errcode = MBED_ERROR_NONE;
+    usbotghs_xmit_queue_t *q = &xmit_queues[ep_id];
+    uint8_t tail;
+
+    if (q->count >= CONFIG_USR_DEV_USBOTGHS_XMIT_QUEUE_DEPTH) {
+        log_printf("[USBOTG][HS] ep %d: xmit queue full\n", ep_id);
+        errcode = MBED_ERROR_NOSTORAGE;
+        goto err;
+    }
+    tail = (q->head + q->count) % CONFIG_USR_DEV_USBOTGHS_XMIT_QUEUE_DEPTH;
+    q->reqs[tail] = *req;
+    request_data_membarrier();
+    set_u8_with_membarrier(&q->count, q->count + 1);
+err:
+    return errcode;
+}
+
+/*@
+  @ requires ep_id < USBOTGHS_MAX_IN_EP;
+  @ requires \valid(req);
+  @ assigns xmit_queues[ep_id], *req;
+  @ ensures \result == MBED_ERROR_NONE || \result == MBED_ERROR_NOTFOUND;
+  */
+mbed_error_t usbotghs_xmit_dequeue(usbotghs_xmit_req_t *req, uint8_t ep_id)
+{
+    mbed_error_t errcode = MBED_ERROR_NONE;
+    usbotghs_xmit_queue_t *q = &xmit_queues[ep_id];
+
+    if (q->count == 0) {
+        errcode = MBED_ERROR_NOTFOUND;
+        goto err;
+    }
+    *req = q->reqs[q->head];
+    q->head = (q->head + 1) % CONFIG_USR_DEV_USBOTGHS_XMIT_QUEUE_DEPTH;
+    set_u8_with_membarrier(&q->count, q->count - 1);
+err:
+    return errcode;
+}
+
+/*@
+  @ requires ep_id < USBOTGHS_MAX_IN_EP;
+  @ assigns xmit_queues[ep_id];
+  */
+void usbotghs_xmit_queue_flush(uint8_t ep_id)
+{
+    xmit_queues[ep_id].head = 0;
+    set_u8_with_membarrier(&xmit_queues[ep_id].count, 0);
+}
+
+/*
+ * OUT data EPs receive buffers rings. The upper layer posts its receive
+ * buffers in advance with usbotghs_post_recv_buffer(). On each transfer
+ * completion, oepint_handler() marks the current buffer as filled and
+ * immediately re-arms the EP with the next posted buffer, before calling the
+ * upper layer handler, so that the EP doesn't NAK the host in the meantime.
+ * The upper layer then gets the filled buffers back, in reception order,
+ * with usbotghs_get_recv_buffer(), and posts them again once processed.
+ *
+ * Each counter only grows and has a single writer: 'posted' is written by
+ * usbotghs_post_recv_buffer(), 'done' by the OUT EP interrupt handler and
+ * 'taken' by usbotghs_get_recv_buffer(). The ring depth being a power of
+ * two, the slot index is the counter modulo the depth, even on counter
+ * wrap.
+ *    taken <= done <= posted, posted - taken <= depth
+ * Slots [taken, done) are filled, slot 'done' is the armed one if 'armed' is
+ * true, and the next slots up to 'posted' are the free posted buffers.
+ */
+#if (CONFIG_USR_DEV_USBOTGHS_RECV_RING_DEPTH & (CONFIG_USR_DEV_USBOTGHS_RECV_RING_DEPTH - 1)) != 0
+# error "CONFIG_USR_DEV_USBOTGHS_RECV_RING_DEPTH must be a power of two"
+#endif
+
+#define RECV_RING_SLOT(ctr) ((ctr) & (CONFIG_USR_DEV_USBOTGHS_RECV_RING_DEPTH - 1))
+
+typedef struct {
+    uint8_t  *buf;       /* upper layer RAM buffer */
+    uint32_t  size;      /* buffer size, in bytes */
+    uint32_t  len;       /* received data size, once filled */
+} usbotghs_recv_slot_t;
+
+typedef struct {
+    usbotghs_recv_slot_t slots[CONFIG_USR_DEV_USBOTGHS_RECV_RING_DEPTH];
+    uint8_t              posted;   /* number of posted buffers */
+    uint8_t              done;     /* number of filled buffers */
+    uint8_t              taken;    /* number of filled buffers given back to the upper layer */
+    bool                 armed;    /* slot 'done' is currently armed on the EP */
+} usbotghs_recv_ring_t;
+
+static usbotghs_recv_ring_t recv_rings[USBOTGHS_MAX_OUT_EP] = { 0 };
+
+/*@
+  @ requires 0 < ep_id < USBOTGHS_MAX_OUT_EP;
+  @ assigns *((uint32_t *) (USB_BACKEND_MEMORY_BASE .. USB_BACKEND_MEMORY_END)), usbotghs_ctx.out_eps[ep_id], recv_rings[ep_id];
+  */
+static void usbotghs_recv_ring_arm(uint8_t ep_id)
+{
+    usbotghs_context_t *ctx = usbotghs_get_context();
+    usbotghs_recv_ring_t *r = &recv_rings[ep_id];
+    usbotghs_recv_slot_t *slot = &r->slots[RECV_RING_SLOT(r->done)];
+
+    usbotghs_arm_recv_fifo(&ctx->out_eps[ep_id], slot->buf, slot->size, ep_id);
+    set_bool_with_membarrier(&r->armed, true);
+    set_reg_bits(r_CORTEX_M_USBOTG_HS_DOEPCTL(ep_id),
+                 USBOTG_HS_DOEPCTL_CNAK_Msk | USBOTG_HS_DOEPCTL_EPENA_Msk);
+}
+
+/*@
+  @ requires \separated(&GHOST_opaque_drv_privates, &usbotghs_ctx, ((uint32_t *) (USB_BACKEND_MEMORY_BASE .. USB_BACKEND_MEMORY_END)), recv_rings);
+  @ assigns GHOST_opaque_drv_privates, *((uint32_t *) (USB_BACKEND_MEMORY_BASE .. USB_BACKEND_MEMORY_END)), usbotghs_ctx.out_eps[ep_id], recv_rings[ep_id];
+  @ ensures (dst == NULL || ep_id == 0 || ep_id >= USBOTGHS_MAX_OUT_EP) ==> \result == MBED_ERROR_INVPARAM;
+  @ ensures \result == MBED_ERROR_NONE || \result == MBED_ERROR_INVPARAM || \result == MBED_ERROR_INVSTATE || \result == MBED_ERROR_NOSTORAGE;
+  */
+mbed_error_t usbotghs_post_recv_buffer(uint8_t *dst, uint32_t size, uint8_t ep_id)
+{
+    usbotghs_context_t *ctx = usbotghs_get_context();
+    mbed_error_t errcode = MBED_ERROR_NONE;
+    usbotghs_recv_ring_t *r;
+    usbotghs_ep_t *ep;
+
+    /* no public (exported) variable is set. This GHOST var is used as countermeasure to public assignment
+     * specification for functions that assign private global content */
+    //@ ghost GHOST_opaque_drv_privates = 1;
+
+    if (dst == NULL || ep_id == 0 || ep_id >= USBOTGHS_MAX_OUT_EP) {
+        errcode = MBED_ERROR_INVPARAM;
+        goto err;
+    }
+    ep = &ctx->out_eps[ep_id];
+    r = &recv_rings[ep_id];
+    if (!ep->configured || !ep->mpsize) {
+        errcode = MBED_ERROR_INVSTATE;
+        goto err;
+    }
+    if (size == 0 || usbotghs_recv_fifo_check(ep, dst, size, ep_id) != MBED_ERROR_NONE) {
+        errcode = MBED_ERROR_INVPARAM;
+        goto err;
+    }
+    if (ep->recv_mode == USBOTG_HS_RECV_MODE_STREAM) {
+        errcode = MBED_ERROR_INVSTATE;
+        goto err;
+    }
+    if (ep->recv_mode == USBOTG_HS_RECV_MODE_FIFO) {
+        /* switching the EP to ring mode: no usbotghs_set_recv_fifo() based
+         * transfer must be in progress */
+        if (get_reg(r_CORTEX_M_USBOTG_HS_DOEPCTL(ep_id), USBOTG_HS_DOEPCTL_EPENA)) {
+            errcode = MBED_ERROR_INVSTATE;
+            goto err;
+        }
+        set_u8_with_membarrier(&ep->recv_mode, USBOTG_HS_RECV_MODE_RING);
+    }
+    if ((uint8_t)(r->posted - r->taken) >= CONFIG_USR_DEV_USBOTGHS_RECV_RING_DEPTH) {
+        log_printf("[USBOTG][HS] ep %d: recv ring full\n", ep_id);
+        errcode = MBED_ERROR_NOSTORAGE;
+        goto err;
+    }
+    r->slots[RECV_RING_SLOT(r->posted)].buf = dst;
+    r->slots[RECV_RING_SLOT(r->posted)].size = size;
+    r->slots[RECV_RING_SLOT(r->posted)].len = 0;
+    request_data_membarrier();
+    set_u8_with_membarrier(&r->posted, r->posted + 1);
+    /* 'armed' is only cleared by the OUT EP handler when it completes the
+     * last posted buffer. The EP being then disabled, no completion can
+     * happen until it is armed again here */
+    if (r->armed == false) {
+        usbotghs_recv_ring_arm(ep_id);
+    }
+err:
+    return errcode;
+}
+
+/*@
+  @ requires \separated(&GHOST_opaque_drv_privates, &usbotghs_ctx, recv_rings, dst, size);
+  @ assigns GHOST_opaque_drv_privates, recv_rings[ep_id], *dst, *size;
+  @ ensures (dst == NULL || size == NULL || ep_id == 0 || ep_id >= USBOTGHS_MAX_OUT_EP) ==> \result == MBED_ERROR_INVPARAM;
+  @ ensures \result == MBED_ERROR_NONE || \result == MBED_ERROR_INVPARAM || \result == MBED_ERROR_NOTFOUND;
+  */
+mbed_error_t usbotghs_get_recv_buffer(uint8_t **dst, uint32_t *size, uint8_t ep_id)
+{
+    mbed_error_t errcode = MBED_ERROR_NONE;
+    usbotghs_recv_ring_t *r;
+
+    /* no public (exported) variable is set. This GHOST var is used as countermeasure to public assignment
+     * specification for functions that assign private global content */
+    //@ ghost GHOST_opaque_drv_privates = 1;
+
+    if (dst == NULL || size == NULL || ep_id == 0 || ep_id >= USBOTGHS_MAX_OUT_EP) {
+        errcode = MBED_ERROR_INVPARAM;
+        goto err;
+    }
+    r = &recv_rings[ep_id];
+    if (r->taken == r->done) {
+        errcode = MBED_ERROR_NOTFOUND;
+        goto err;
+    }
+    *dst = r->slots[RECV_RING_SLOT(r->taken)].buf;
+    *size = r->slots[RECV_RING_SLOT(r->taken)].len;
+    set_u8_with_membarrier(&r->taken, r->taken + 1);
+err:
+    return errcode;
+}
+
+/*@
+  @ requires 0 < ep_id < USBOTGHS_MAX_OUT_EP;
+  @ assigns *((uint32_t *) (USB_BACKEND_MEMORY_BASE .. USB_BACKEND_MEMORY_END)), usbotghs_ctx.out_eps[ep_id], recv_rings[ep_id];
+  */
+void usbotghs_recv_ring_complete(uint8_t ep_id)
+{
+    usbotghs_context_t *ctx = usbotghs_get_context();
+    usbotghs_recv_ring_t *r = &recv_rings[ep_id];
+
+    if (r->armed == false) {
+        return;
+    }
+    r->slots[RECV_RING_SLOT(r->done)].len = ctx->out_eps[ep_id].fifo_idx;
+    request_data_membarrier();
+    set_u8_with_membarrier(&r->done, r->done + 1);
+    if (r->done != r->posted) {
+        /* re-arm with the next posted buffer */
+        usbotghs_recv_ring_arm(ep_id);
+    } else {
+        /* no more buffer: the EP NAKs until the upper layer posts one */
+        log_printf("[USBOTG][HS] ep %d: recv ring starved\n", ep_id);
+        set_bool_with_membarrier(&r->armed, false);
+    }
+}
+
+/*@
+  @ requires ep_id < USBOTGHS_MAX_OUT_EP;
+  @ assigns recv_rings[ep_id];
+  */
+void usbotghs_recv_ring_flush(uint8_t ep_id)
+{
+    recv_rings[ep_id].posted = 0;
+    recv_rings[ep_id].done = 0;
+    recv_rings[ep_id].taken = 0;
+    set_bool_with_membarrier(&recv_rings[ep_id].armed, false);
+}
+
 /*@
     @ requires ep_id < USBOTGHS_MAX_IN_EP;
     @ assigns *((uint32_t *) (USB_BACKEND_MEMORY_BASE .. USB_BACKEND_MEMORY_END)) ;
@@ -925,6 +2501,32 @@ err:
     return errcode;
 }
 
+/*
+ * Pop a packet of size bytes from the Core RxFIFO and drop it. Contrary to
+ * usbotghs_rxfifo_flush(), the packets queued behind it in the RxFIFO (which is
+ * shared by all the OUT EPs) are kept. Must be called from the RXFLVL handler,
+ * once the packet status entry has been popped.
+ */
+/*@
+    @ requires ep_id < USBOTGHS_MAX_OUT_EP;
+    @ requires (uint32_t *)USB_BACKEND_MEMORY_BASE <= USBOTG_HS_DEVICE_FIFO(ep_id) <= (uint32_t *)USB_BACKEND_MEMORY_END ;
+    @ assigns *((uint32_t *)((int)(0x40040000 + (int)(0x1000 * (int)((int)ep_id + 1)))));
+*/
+void usbotghs_rxfifo_discard(uint32_t size, uint8_t ep_id)
+{
+    const uint32_t size_4bytes = (size + 3) / 4;
+
+    /*@
+      @ loop invariant 0 <= i <= size_4bytes;
+      @ loop assigns i, *((uint32_t *)((int)(0x40040000 + (int)(0x1000 * (int)((int)ep_id + 1)))));
+      @ loop variant (size_4bytes - i);
+      */
+    for (uint32_t i = 0; i < size_4bytes; ++i) {
+        /* each read pops a word (volatile access, not optimized out) */
+        (void)*(USBOTG_HS_DEVICE_FIFO(ep_id));
+    }
+}
+
 /*
  * About generic part:
  * This part translate libusbctrl forward-declaration symbols to local symbols.
@@ -937,4 +2539,16 @@ err:
 #ifndef __FRAMAC__
 mbed_error_t usb_backend_drv_set_recv_fifo(uint8_t *dst, uint32_t size, uint8_t ep)
     __attribute__ ((alias("usbotghs_set_recv_fifo")));
+mbed_error_t usb_backend_drv_set_recv_fifo_split(uint8_t *hdr, uint32_t hdr_size, uint8_t *payload, uint32_t payload_size, uint8_t ep)
+    __attribute__ ((alias("usbotghs_set_recv_fifo_split")));
+mbed_error_t usb_backend_drv_post_recv_buffer(uint8_t *dst, uint32_t size, uint8_t ep)
+    __attribute__ ((alias("usbotghs_post_recv_buffer")));
+mbed_error_t usb_backend_drv_get_recv_buffer(uint8_t **dst, uint32_t *size, uint8_t ep)
+    __attribute__ ((alias("usbotghs_get_recv_buffer")));
+mbed_error_t usb_backend_drv_set_recv_stream(uint8_t *buf, uint32_t size, uint32_t watermark, uint8_t ep)
+    __attribute__ ((alias("usbotghs_set_recv_stream")));
+mbed_error_t usb_backend_drv_recv_stream_peek(uint8_t **data, uint32_t *len, uint8_t ep)
+    __attribute__ ((alias("usbotghs_recv_stream_peek")));
+mbed_error_t usb_backend_drv_recv_stream_release(uint32_t len, uint8_t ep)
+    __attribute__ ((alias("usbotghs_recv_stream_release")));
 #endif/*__FRAMAC__*/
@@ -32,13 +32,29 @@
 
 #ifndef __FRAMAC__
 /*
- * Size of the USB OTG HS core internal FIFO (global config, not per EP)
+ * Biggest packet handled by the USB OTG HS core internal FIFOs, in bytes
  */
-#define USBOTG_HS_RX_CORE_FIFO_SZ 512 /* RX is shared */
-#define USBOTG_HS_TX_CORE_FIFO_SZ 512 /* 128 bytes, unit is 32bits DWORD here */
+#define USBOTG_HS_TX_CORE_FIFO_SZ 512
 
 #endif
 
+/*
+ * Core FIFO RAM layout, in 32bits words unit, as computed by usbotghs_fifo_plan()
+ */
+typedef struct {
+    uint16_t rx_depth;                      /* GRXFSIZ.RXFD */
+    uint16_t tx_start[USBOTGHS_MAX_IN_EP];  /* DIEPTXFx.INEPTXSA (TX0FSA for EP0) */
+    uint16_t tx_depth[USBOTGHS_MAX_IN_EP];  /* DIEPTXFx.INEPTXFD (TX0FD for EP0), 0 if unused */
+    uint16_t used;                          /* Core FIFO RAM used by the layout */
+} usbotghs_fifo_layout_t;
+
+/* compute the Core FIFO RAM layout for the configured EPs */
+mbed_error_t usbotghs_fifo_plan(const usbotghs_ep_t *in_eps,
+                                const usbotghs_ep_t *out_eps,
+                                usbotghs_fifo_layout_t *layout);
+
+/* depth of the given IN EP Core TxFIFO, in 32bits words */
+uint32_t usbotghs_get_txfifo_depth(uint8_t ep_id);
 
 mbed_error_t usbotghs_init_global_fifo(void);
 
@@ -52,12 +68,92 @@ mbed_error_t usbotghs_read_epx_fifo(uint32_t size, uint8_t ep_id);
  * parameters */
 mbed_error_t usbotghs_write_epx_fifo(uint32_t size, uint8_t ep_id);
 
+/* size of the next EP0 IN transfer fragment (DIEPTSIZ0 limits) */
+uint32_t usbotghs_ep0_fragment_size(uint32_t residual_size, uint16_t mpsize);
+
+/* push the current EP transfer into the Core TxFIFO, as long as there is room
+ * for it, without blocking. The remaining is pushed on TXFE events */
+mbed_error_t usbotghs_fill_epx_txfifo(uint8_t ep_id);
+
 mbed_error_t usbotghs_set_recv_fifo(uint8_t *dst, uint32_t size, uint8_t epid);
 
+mbed_error_t usbotghs_set_recv_fifo_split(uint8_t *hdr, uint32_t hdr_size,
+                                          uint8_t *payload, uint32_t payload_size,
+                                          uint8_t epid);
+
 mbed_error_t usbotghs_set_xmit_fifo(uint8_t *src, uint32_t size, uint8_t epid);
 
+mbed_error_t usbotghs_set_xmit_fifov(const usbotghs_iovec_t *iov, uint8_t iovcnt, uint32_t size, uint8_t epid);
+
+mbed_error_t usbotghs_set_xmit_fifo_words(const uint32_t *src, uint32_t size, uint8_t epid);
+
 mbed_error_t usbotghs_read_core_fifo(uint8_t *dest, uint32_t size, uint8_t ep);
 
+/* queue an IN transfer on a busy EP (contiguous if iov is NULL, vectored otherwise) */
+mbed_error_t usbotghs_xmit_enqueue(const usbotghs_xmit_req_t *req, uint8_t ep_id);
+
+/* pop the next queued IN transfer of the given EP */
+mbed_error_t usbotghs_xmit_dequeue(usbotghs_xmit_req_t *req, uint8_t ep_id);
+
+/* drop all the queued IN transfers of the given EP */
+void usbotghs_xmit_queue_flush(uint8_t ep_id);
+
+/* re-enable the given OUT EP on the free space of its current RAM FIFO,
+ * keeping the already received data */
+void usbotghs_recv_fifo_continue(uint8_t ep_id);
+
+#if CONFIG_USR_DEV_USBOTGHS_DMA
+/* how the core DMA handles a transfer (see usbotghs_dma_xfer_policy()) */
+typedef enum {
+    USBOTGHS_DMA_XFER_IN_PLACE = 0,  /* in the upper layer RAM FIFO, no CPU copy */
+    USBOTGHS_DMA_XFER_BOUNCE,        /* copied through the EP bounce buffer */
+    USBOTGHS_DMA_XFER_REJECT_BUF,    /* refused: RAM FIFO not reachable by the core DMA */
+    USBOTGHS_DMA_XFER_REJECT_SIZE,   /* refused: transfer size not handled by the core DMA */
+} usbotghs_dma_xfer_t;
+
+/* select the way a transfer of size bytes from/to buf is handled */
+usbotghs_dma_xfer_t usbotghs_dma_xfer_policy(const usbotghs_ep_t *ep, uint8_t ep_id,
+                                             const uint8_t *buf, uint32_t size, bool recv);
+
+/* check that a transfer can be handled, refused ones being accounted */
+mbed_error_t usbotghs_dma_xfer_check(const usbotghs_ep_t *ep, uint8_t ep_id,
+                                     const uint8_t *buf, uint32_t size, bool recv);
+
+/* set the IN EP DMA address for the next size bytes of the current transfer */
+void usbotghs_xmit_dma_prepare(uint8_t ep_id, uint32_t size);
+
+/* (re)enable EP0 OUT on the driver EP0 DMA buffer */
+void usbotghs_ep0_dma_arm(void);
+
+/* last SETUP packet written by the core DMA in the EP0 DMA buffer */
+const uint8_t *usbotghs_ep0_dma_setup_pkt(void);
+
+/* account an OUT transfer completed by the core DMA, return its size */
+uint32_t usbotghs_recv_dma_complete(uint8_t ep_id);
+#endif
+
+/* complete the current receive ring buffer of the given OUT EP and re-arm
+ * the EP with the next posted one, if any */
+void usbotghs_recv_ring_complete(uint8_t ep_id);
+
+/* tell if the packet of size bytes just read on the given OUT EP completed the
+ * header of its split RAM FIFO, the transfer going on in the payload */
+bool usbotghs_recv_split_hdr_done(uint8_t ep_id, uint32_t size);
+
+/* handle the end of a transfer on a split RAM FIFO, re-arming the EP on the
+ * payload if the transfer ended within the header. Return the size to report */
+uint32_t usbotghs_recv_split_complete(uint8_t ep_id);
+
+/* drop the posted and filled buffers of the given OUT EP receive ring */
+void usbotghs_recv_ring_flush(uint8_t ep_id);
+
+/* handle the end of a transfer on a streaming OUT EP, re-arming it if there
+ * is enough free space. Return the amount of pending data, in bytes */
+uint32_t usbotghs_recv_stream_complete(uint8_t ep_id);
+
+/* drop the circular buffer of the given streaming OUT EP */
+void usbotghs_recv_stream_flush(uint8_t ep_id);
+
 /* flush the Core TxFIFO of the given EP. This functions does *not* upate the
  * associated EP ctx (fifo_idx, fifo_size) */
 mbed_error_t usbotghs_txfifo_flush(uint8_t ep_id);
@@ -66,6 +162,11 @@ mbed_error_t usbotghs_txfifo_flush(uint8_t ep_id);
  * This functions does *not* upate the associated EP ctx (fifo_idx, fifo_size) */
 mbed_error_t usbotghs_txfifo_flush_all(void);
 
+/* flush the whole Core RxFIFO, shared by all the OUT EPs (ep_id is not used).
+ * This drops the packets of all the OUT EPs */
 mbed_error_t usbotghs_rxfifo_flush(uint8_t ep_id);
 
+/* pop and drop a single received packet from the Core RxFIFO (RXFLVL handler) */
+void usbotghs_rxfifo_discard(uint32_t size, uint8_t ep_id);
+
 #endif/*!USBOTGHS_FIFOS_H_*/
@@ -42,13 +42,6 @@
 #include "usbotghs_fifos.h"
 #include "usbotghs_handler.h"
 
-/************************************************
- * Buffers (FIFO storage in RAM
- */
-#if CONFIG_USR_DEV_USBOTGHS_DMA
-uint8_t ep0_fifo[512] = {0};
-#endif
-
 /************************************************
  * About ISR handlers
  */
@@ -117,6 +110,17 @@ static volatile uint32_t    usbotghs_int_cnt[32] = { 0 };
 
 
 #endif
+
+#ifndef CONFIG_USR_DEV_USBOTGHS_RXFLVL_BUDGET
+# define CONFIG_USR_DEV_USBOTGHS_RXFLVL_BUDGET 8
+#endif
+
+/* RxFIFO status entries drained per RXFLVL handler execution */
+static usbotghs_rxflvl_stats_t rxflvl_stats = { 0 };
+
+/* OUT EPs receive error counters */
+static usbotghs_ep_err_stats_t ep_err_stats[USBOTGHS_MAX_OUT_EP] = { 0 };
+
 /*
  * Generic handler, used by default.
  */
@@ -217,13 +221,16 @@ mbed_error_t reset_handler(void)
     }
 
     /* unmask control pipe requested interrupt bits:
-     * activate OEPInt, IEPInt & RxFIFO non-empty.
+     * activate OEPInt, IEPInt & RxFIFO non-empty (except in DMA mode, where
+     * the core DMA writes the received packets).
      * Ready to receive requests on EP0.
      */
 	set_reg_bits(r_CORTEX_M_USBOTG_HS_GINTMSK,
                  USBOTG_HS_GINTMSK_OEPINT_Msk   |
-                 USBOTG_HS_GINTMSK_IEPINT_Msk   |
-				 USBOTG_HS_GINTMSK_RXFLVLM_Msk);
+                 USBOTG_HS_GINTMSK_IEPINT_Msk);
+#if !CONFIG_USR_DEV_USBOTGHS_DMA
+	set_reg_bits(r_CORTEX_M_USBOTG_HS_GINTMSK, USBOTG_HS_GINTMSK_RXFLVLM_Msk);
+#endif
     /* unmask control 0 IN & OUT endpoint interrupts */
 	set_reg_bits(r_CORTEX_M_USBOTG_HS_DAINTMSK,
                  USBOTG_HS_DAINTMSK_IEPM(0)   |
@@ -262,12 +269,12 @@ mbed_error_t reset_handler(void)
     usbotghs_txfifo_flush(0);
     usbotghs_rxfifo_flush(0);
 
-    /* reinit FIFO index and EP0 FIFO. This update ctx->fifo_idx to EP0 FIFO set only */
+    /* reinit the Core FIFO RAM layout (RxFIFO and TxFIFOs). This update ctx->fifo_idx */
     log_printf("[USB HS][RESET] initialize global fifo\n");
     if ((errcode = usbotghs_init_global_fifo()) != MBED_ERROR_NONE) {
         goto err;
     }
-    /* at this time, ctx->fifo_idx is set to EP0 FIFO size only. EP0 buffer are not yet configued */
+    /* at this time, ctx->fifo_idx is the Core FIFO RAM used. EP0 buffer are not yet configued */
 
 
     log_printf("[USB HS][RESET] set EP0 as configured\n");
@@ -342,7 +349,8 @@ mbed_error_t enumdone_handler(void)
 		      USBOTG_HS_DIEPCTL_MPSIZ_Pos(0));
 
 #if CONFIG_USR_DEV_USBOTGHS_DMA
-	set_reg_bits(r_CORTEX_M_USBOTG_HS_DOEPCTL(0), USBOTG_HS_DOEPCTLx_EPENA_Msk);
+    /* EP0 must be enabled for the core DMA to write the SETUP packets */
+    usbotghs_ep0_dma_arm();
 #endif
 #if 0
 // XXX: still SOF IT burst to resolve...
@@ -360,6 +368,115 @@ err:
 }
 
 
+/*
+ * EP0 SETUP packet slots.
+ *
+ * SETUP packets are received in driver owned slots, not in the upper layer EP0 RAM
+ * FIFO: a SETUP packet received while the previous one has not been handed to the
+ * upper layer yet (STUP oepint pending) is queued instead of being dropped. The
+ * back-to-back SETUP packets of a single SETUP stage overwrite each other, only the
+ * last one being valid (USB 2.0 chap. 8.5.3), the slot being committed by the SETUP
+ * stage done status entry. Slots are only accessed in ISR context, without lock.
+ */
+/*@
+  @ requires \valid(ctx);
+  @ assigns *((uint32_t *) (USB_BACKEND_MEMORY_BASE .. USB_BACKEND_MEMORY_END)), ctx->setup_pkts[0 .. USBOTGHS_SETUP_SLOTS - 1][0 .. USBOTGHS_SETUP_PKT_SZ - 1], ctx->setup_tail, ctx->setup_wip;
+  */
+static void usbotghs_setup_slot_write(usbotghs_context_t *ctx)
+{
+    if ((uint8_t)(ctx->setup_head - ctx->setup_tail) >= USBOTGHS_SETUP_SLOTS) {
+        /* no free slot: the oldest pending SETUP packet is superseded */
+        log_printf("[USBOTG][HS] SETUP slots full, oldest SETUP pkt dropped\n");
+        ctx->setup_tail++;
+    }
+#if CONFIG_USR_DEV_USBOTGHS_DMA
+    /* already written in memory by the core DMA */
+    const uint8_t *pkt = usbotghs_ep0_dma_setup_pkt();
+    for (uint8_t i = 0; i < USBOTGHS_SETUP_PKT_SZ; ++i) {
+        ctx->setup_pkts[ctx->setup_head % USBOTGHS_SETUP_SLOTS][i] = pkt[i];
+    }
+#else
+    usbotghs_read_core_fifo(ctx->setup_pkts[ctx->setup_head % USBOTGHS_SETUP_SLOTS],
+                            USBOTGHS_SETUP_PKT_SZ, USBOTG_HS_EP0);
+#endif
+    ctx->setup_wip = true;
+}
+
+/*@
+  @ requires \valid(ctx);
+  @ assigns ctx->setup_head, ctx->setup_wip;
+  */
+static void usbotghs_setup_slot_commit(usbotghs_context_t *ctx)
+{
+    if (ctx->setup_wip == true) {
+        ctx->setup_head++;
+        ctx->setup_wip = false;
+    }
+}
+
+/*
+ * Copy the oldest pending SETUP packet to the EP0 RAM FIFO, and return its size
+ * (0 if the EP0 RAM FIFO is not able to hold it)
+ */
+/*@
+  @ requires \valid(ctx);
+  @ assigns ctx->setup_tail, ctx->out_eps[0].fifo_idx, ctx->out_eps[0].fifo[0 .. USBOTGHS_SETUP_PKT_SZ - 1];
+  */
+static uint32_t usbotghs_setup_slot_pop(usbotghs_context_t *ctx)
+{
+    usbotghs_ep_t *ep = &ctx->out_eps[USBOTG_HS_EP0];
+    const uint8_t *pkt = ctx->setup_pkts[ctx->setup_tail % USBOTGHS_SETUP_SLOTS];
+    uint32_t size = 0;
+
+    if (ep->fifo == NULL || ep->fifo_size < USBOTGHS_SETUP_PKT_SZ) {
+        log_printf("[USBOTG][HS] no EP0 RAM FIFO, SETUP pkt dropped\n");
+    } else {
+        for (uint8_t i = 0; i < USBOTGHS_SETUP_PKT_SZ; ++i) {
+            ep->fifo[i] = pkt[i];
+        }
+        ep->fifo_idx = USBOTGHS_SETUP_PKT_SZ;
+        size = USBOTGHS_SETUP_PKT_SZ;
+    }
+    ctx->setup_tail++;
+    return size;
+}
+
+/*
+ * Call the upper layer handler of the given OUT EP, handing it size bytes
+ * of received data. Return MBED_ERROR_NOBACKEND if the EP has no valid handler,
+ * or the handler return value
+ */
+/*@
+  @ requires \valid(ctx);
+  @ requires ep_id < USBOTGHS_MAX_OUT_EP;
+  */
+static mbed_error_t oepint_call_handler(usbotghs_context_t *ctx, uint8_t ep_id, uint32_t size)
+{
+    mbed_error_t errcode = MBED_ERROR_NONE;
+
+    log_printf("[USBOTG][HS] oepint: calling callback\n");
+    /* the received data are handed back to the upper layer: this is the
+     * only barrier of the transfer, packets being copied without any */
+    request_data_membarrier();
+
+    if (ctx->out_eps[ep_id].handler == NULL) {
+        errcode = MBED_ERROR_NOBACKEND;
+        goto err;
+    }
+#ifndef __FRAMAC__
+    if (handler_sanity_check_with_panic((physaddr_t)ctx->out_eps[ep_id].handler)) {
+        errcode = MBED_ERROR_NOBACKEND;
+        goto err;
+    }
+#endif
+    /*@ assert ctx->out_eps[ep_id].handler \in {usbctrl_handle_outepevent, &handler_ep} ;*/
+    /*@ calls usbctrl_handle_outepevent, handler_ep; */
+    /* In FramaC context, upper handler is my_handle_outepevent */
+    errcode = ctx->out_eps[ep_id].handler(usb_otg_hs_dev_infos.id, size, ep_id);
+err:
+    return errcode;
+}
+
 /*
  * OUT endpoint event (reception in device mode, transmission in Host mode)
  *
@@ -402,6 +519,18 @@ mbed_error_t oepint_handler(void)
                 log_printf("[USBOTG][HS] received data on ep %d\n", ep_id);
                 /* calling upper handler */
                 uint32_t doepint = read_reg_value(r_CORTEX_M_USBOTG_HS_DOEPINT(ep_id));
+#if CONFIG_USR_DEV_USBOTGHS_DMA
+                /* no RXFLVL in DMA mode: packets are accounted here, on their
+                 * completion event */
+                if (ep_id == USBOTG_HS_EP0 && (doepint & USBOTG_HS_DOEPINT_STUP_Msk)) {
+                    usbotghs_setup_slot_write(ctx);
+                    usbotghs_setup_slot_commit(ctx);
+                } else if (doepint & USBOTG_HS_DOEPINT_XFRC_Msk) {
+                    usbotghs_recv_dma_complete(ep_id);
+                }
+#endif
+                /* received size, kept as the EP may be re-armed before the callback */
+                uint32_t recv_size = ctx->out_eps[ep_id].fifo_idx;
                 bool callback_to_call = false;
                 bool end_of_transfer = false;
                 if (doepint & USBOTG_HS_DOEPINT_STUP_Msk) {
@@ -409,58 +538,115 @@ mbed_error_t oepint_handler(void)
 		    /* @ assert  (register_t) USB_BACKEND_MEMORY_BASE <=r_CORTEX_M_USBOTG_HS_DOEPINT(ep_id)  <=  (register_t) USB_BACKEND_MEMORY_END; */
 		    /* @ assert r_CORTEX_M_USBOTG_HS_DOEPINT(ep_id) \in ((register_t)(USB_BACKEND_MEMORY_BASE .. USB_BACKEND_MEMORY_END)) ; */
                     set_reg_bits(r_CORTEX_M_USBOTG_HS_DOEPINT(ep_id), USBOTG_HS_DOEPINT_STUP_Msk);
-                    callback_to_call = true;
+                    if (ep_id == USBOTG_HS_EP0 && ctx->setup_head != ctx->setup_tail) {
+                        /* STUP events may have been merged: queued SETUP packets are
+                         * handed to the upper layer in reception order, the last one
+                         * through the generic callback below */
+                        while ((uint8_t)(ctx->setup_head - ctx->setup_tail) > 1) {
+                            recv_size = usbotghs_setup_slot_pop(ctx);
+                            if (recv_size > 0) {
+                                errcode = oepint_call_handler(ctx, ep_id, recv_size);
+                                if (errcode == MBED_ERROR_NOBACKEND) {
+                                    goto err;
+                                }
+                            }
+                        }
+                        recv_size = usbotghs_setup_slot_pop(ctx);
+                        callback_to_call = (recv_size > 0);
+                        /* the core can accept 3 back-to-back SETUP packets again */
+                        set_reg(r_CORTEX_M_USBOTG_HS_DOEPTSIZ(0), 3, USBOTG_HS_DOEPTSIZ_STUPCNT);
+                    } else {
+                        callback_to_call = true;
+                    }
                 }
                 /* Bit 0 XFRC: Data received complete */
                 if (doepint & USBOTG_HS_DOEPINT_XFRC_Msk) {
                     log_printf("[USBOTG][HS] oepint: entering XFRC\n");
                     /* @ assert  (register_t) USB_BACKEND_MEMORY_BASE <=r_CORTEX_M_USBOTG_HS_DOEPINT(ep_id)  <=  (register_t) USB_BACKEND_MEMORY_END; */
                     set_reg_bits(r_CORTEX_M_USBOTG_HS_DOEPINT(ep_id), USBOTG_HS_DOEPINT_XFRC_Msk);
-                    if (ctx->out_eps[ep_id].fifo_idx == 0) {
-                        /* ZLP transfer initialited from the HOST */
-                        continue;
-                    }
-                    end_of_transfer = true;
-                    /* Here we set SNAK bit to avoid receiving data before the next read cmd config.
-                     * If not, a race condition can happen, if RXFLVL handler is executed *before* the EP
-                     * RxFIFO is set by the upper layer */
-                    /* @ assert  (register_t) USB_BACKEND_MEMORY_BASE <=r_CORTEX_M_USBOTG_HS_DOEPCTL(ep_id)  <=  (register_t) USB_BACKEND_MEMORY_END; */
-                    set_reg_bits(r_CORTEX_M_USBOTG_HS_DOEPCTL(ep_id), USBOTG_HS_DOEPCTL_SNAK_Msk);
-                    /* XXX: defragmentation need to be checked for others (not EP0) EPs */
-                    /* always handle defragmentation on EP0 */
-                    if (ctx->out_eps[ep_id].fifo_idx < ctx->out_eps[ep_id].fifo_size) {
-                        if (ctx->out_eps[ep_id].state == USBOTG_HS_EP_STATE_DATA_OUT) {
-                            /* BULK endpoint specific, handle variable length data stage */
-                            callback_to_call = true;
+                    if (ep_id > 0) {
+                        /* Data EPs receive the whole RAM FIFO in a single multi-packet
+                         * transfer (see usbotghs_set_recv_fifo()): XFRC rises once, when
+                         * PKTCNT reaches 0 or on a short packet (including a terminating
+                         * or zero-length one). This is the end of the transfer, whatever
+                         * its size. On XFRC, the core has disabled the EP, which NAKs
+                         * until the upper layer sets the next RAM FIFO and activates it.
+                         * The EP completion policy may shorten the transfer to a single
+                         * packet (EVERY_PKT), or extend it past short packets (FULL_BUFFER) */
+                        log_printf("[USBOTG][HS] oepint: ep %d: %d bytes transfer complete\n", ep_id, ctx->out_eps[ep_id].fifo_idx);
+                        bool keep_receiving = false;
+#if !CONFIG_USR_DEV_USBOTGHS_DMA
+                        /* (in DMA mode, the core DMA can't resume at the unaligned end
+                         * of a short packet: FULL_BUFFER completes as SHORT_PKT) */
+                        /* (a split RAM FIFO header is completed by a short packet) */
+                        keep_receiving = (ctx->out_eps[ep_id].completion == USBOTG_HS_EP_COMPLETE_FULL_BUFFER &&
+                            ctx->out_eps[ep_id].recv_mode != USBOTG_HS_RECV_MODE_STREAM &&
+                            ctx->out_eps[ep_id].fifo_idx < ctx->out_eps[ep_id].fifo_size &&
+                            (ctx->out_eps[ep_id].split_payload == NULL ||
+                             ctx->out_eps[ep_id].fifo_idx > ctx->out_eps[ep_id].split_hdr_size));
+#endif
+                        if (keep_receiving == true) {
+                            /* short packet, but the upper layer waits for a full RAM FIFO:
+                             * keep on receiving in it, without completing the transfer */
+                            usbotghs_recv_fifo_continue(ep_id);
                         } else {
-                            /* handle defragmentation for DATA OUT packets on EP0 */
-                            log_printf("[USBOTG][HS] fragment pkt %d total, %d read\n", ctx->out_eps[ep_id].fifo_size, ctx->out_eps[ep_id].fifo_idx);
-                            /* @ assert  (register_t) USB_BACKEND_MEMORY_BASE <=r_CORTEX_M_USBOTG_HS_DOEPCTL(ep_id)  <=  (register_t) USB_BACKEND_MEMORY_END; */
-                            set_reg_bits(r_CORTEX_M_USBOTG_HS_DOEPCTL(ep_id), USBOTG_HS_DOEPCTL_CNAK_Msk);
+                            end_of_transfer = true;
+                            set_u8_with_membarrier(&ctx->out_eps[ep_id].state, USBOTG_HS_EP_STATE_DATA_OUT);
+                            //@ ghost GHOST_out_eps[ep_id].state = usbotghs_ctx.out_eps[ep_id].state;
+                            callback_to_call = true;
+                            if (ctx->out_eps[ep_id].recv_mode == USBOTG_HS_RECV_MODE_RING) {
+                                /* the buffer is filled: re-arm the EP with the next
+                                 * posted one before calling the upper layer */
+                                usbotghs_recv_ring_complete(ep_id);
+                            } else if (ctx->out_eps[ep_id].recv_mode == USBOTG_HS_RECV_MODE_STREAM) {
+                                /* watermark, short packet or no more room: re-arm the EP
+                                 * on the free space and notify the amount of pending data */
+                                recv_size = usbotghs_recv_stream_complete(ep_id);
+                                callback_to_call = (recv_size > 0);
+                            } else if (ctx->out_eps[ep_id].split_payload != NULL) {
+                                /* header ended by a short packet: re-arm the EP on
+                                 * the payload before calling the upper layer. Otherwise
+                                 * the header is already reported, hand the payload */
+                                recv_size = usbotghs_recv_split_complete(ep_id);
+                            }
                         }
+                    } else if (ctx->out_eps[ep_id].fifo_idx == 0) {
+                        /* ZLP transfer initialited from the HOST */
+                        log_printf("[USBOTG][HS] oepint: ep 0: ZLP received\n");
                     } else {
-                        /* FIFO full */
-                        log_printf("[USBOTG][HS] oepint for %d data size read\n", ctx->out_eps[ep_id].fifo_idx);
-                        set_u8_with_membarrier(&ctx->out_eps[ep_id].state, USBOTG_HS_EP_STATE_DATA_OUT);
-                        callback_to_call = true;
+                        end_of_transfer = true;
+                        /* Here we set SNAK bit to avoid receiving data before the next read cmd config.
+                         * If not, a race condition can happen, if RXFLVL handler is executed *before* the EP
+                         * RxFIFO is set by the upper layer */
+                        /* @ assert  (register_t) USB_BACKEND_MEMORY_BASE <=r_CORTEX_M_USBOTG_HS_DOEPCTL(ep_id)  <=  (register_t) USB_BACKEND_MEMORY_END; */
+                        set_reg_bits(r_CORTEX_M_USBOTG_HS_DOEPCTL(ep_id), USBOTG_HS_DOEPCTL_SNAK_Msk);
+                        /* handle defragmentation on EP0 */
+                        if (ctx->out_eps[ep_id].fifo_idx < ctx->out_eps[ep_id].fifo_size) {
+                            if (ctx->out_eps[ep_id].state == USBOTG_HS_EP_STATE_DATA_OUT) {
+                                /* BULK endpoint specific, handle variable length data stage */
+                                callback_to_call = true;
+                            } else {
+                                /* handle defragmentation for DATA OUT packets on EP0 */
+                                log_printf("[USBOTG][HS] fragment pkt %d total, %d read\n", ctx->out_eps[ep_id].fifo_size, ctx->out_eps[ep_id].fifo_idx);
+                                /* @ assert  (register_t) USB_BACKEND_MEMORY_BASE <=r_CORTEX_M_USBOTG_HS_DOEPCTL(ep_id)  <=  (register_t) USB_BACKEND_MEMORY_END; */
+                                set_reg_bits(r_CORTEX_M_USBOTG_HS_DOEPCTL(ep_id), USBOTG_HS_DOEPCTL_CNAK_Msk);
+                            }
+                        } else {
+                            /* FIFO full */
+                            log_printf("[USBOTG][HS] oepint for %d data size read\n", ctx->out_eps[ep_id].fifo_idx);
+                            set_u8_with_membarrier(&ctx->out_eps[ep_id].state, USBOTG_HS_EP_STATE_DATA_OUT);
+                            callback_to_call = true;
+                        }
                     }
                 }
                 if (callback_to_call == true) {
-                    log_printf("[USBOTG][HS] oepint: calling callback\n");
-
-                    if (ctx->out_eps[ep_id].handler == NULL) {
+                    errcode = oepint_call_handler(ctx, ep_id, recv_size);
+                    if (errcode == MBED_ERROR_NOBACKEND) {
                         goto err;
                     }
-#ifndef __FRAMAC__
-                    if (handler_sanity_check_with_panic((physaddr_t)ctx->out_eps[ep_id].handler)) {
-                        goto err;
+                    if (ctx->out_eps[ep_id].recv_mode == USBOTG_HS_RECV_MODE_FIFO) {
+                        ctx->out_eps[ep_id].fifo_idx = 0;
                     }
-#endif
-		    /*@ assert ctx->out_eps[ep_id].handler \in {usbctrl_handle_outepevent, &handler_ep} ;*/
-		    /*@ calls usbctrl_handle_outepevent, handler_ep; */
-                    /* In FramaC context, upper handler is my_handle_outepevent */
-		    errcode = ctx->out_eps[ep_id].handler(usb_otg_hs_dev_infos.id, ctx->out_eps[ep_id].fifo_idx, ep_id);
-                    ctx->out_eps[ep_id].fifo_idx = 0;
                     if (end_of_transfer == true && ep_id == 0) {
 		      /* We synchronously handle CNAK only for EP0 data. others EP are handled by dedicated upper layer
 		       * class level handlers */
@@ -472,6 +658,12 @@ mbed_error_t oepint_handler(void)
                 /* now that data has been handled, consider FIFO as empty */
                 set_u8_with_membarrier(&(ctx->out_eps[ep_id].state), (uint8_t)USBOTG_HS_EP_STATE_IDLE);
                 //@ ghost GHOST_out_eps[ep_id].state = usbotghs_ctx.out_eps[ep_id].state;
+#if CONFIG_USR_DEV_USBOTGHS_DMA
+                if (ep_id == USBOTG_HS_EP0) {
+                    /* disabled by the core on XFRC and SETUP stage done */
+                    usbotghs_ep0_dma_arm();
+                }
+#endif
             }
             daint >>= 1;
         }
@@ -484,6 +676,38 @@ err:
     return errcode;
 }
 
+/*
+ * Call the upper layer handler of the given IN EP, informing it that a transfer
+ * of size bytes is complete. Return MBED_ERROR_NOBACKEND if the EP has no valid
+ * handler, or the handler return value
+ */
+/*@
+  @ requires \valid(ctx);
+  @ requires ep_id < USBOTGHS_MAX_IN_EP;
+  */
+static mbed_error_t iepint_call_handler(usbotghs_context_t *ctx, uint8_t ep_id, uint32_t size)
+{
+    mbed_error_t errcode = MBED_ERROR_NONE;
+
+    if (ctx->in_eps[ep_id].handler == NULL) {
+        errcode = MBED_ERROR_NOBACKEND;
+        goto err;
+    }
+    /*@ assert ctx->in_eps[ep_id].handler != \null; */
+#ifndef __FRAMAC__
+    if (handler_sanity_check((physaddr_t)ctx->in_eps[ep_id].handler)) {
+        errcode = MBED_ERROR_NOBACKEND;
+        goto err;
+    }
+#endif
+    /*@ assert ctx->in_eps[ep_id].handler \in { &handler_ep}; */
+    /*@ calls  handler_ep; */
+    /* In FramaC context, upper handler is my_handle_inepevent */
+    errcode = ctx->in_eps[ep_id].handler(usb_otg_hs_dev_infos.id, size, ep_id);
+err:
+    return errcode;
+}
+
 /*
  * IN endpoint event (transmission in device mode, reception in Host mode)
  *
@@ -505,8 +729,10 @@ mbed_error_t iepint_handler(void)
     usbotghs_context_t *ctx = usbotghs_get_context();
     uint16_t daint = 0;
     uint32_t diepintx = 0;
-    /* get EPx on which the event came */
-    daint = (uint16_t)(read_reg_value(r_CORTEX_M_USBOTG_HS_DAINT) & 0xff);
+    /* get EPx on which the event came. EPs which IN interrupt is masked (a
+     * transfer is being set by the main thread) are left for later */
+    daint = (uint16_t)(read_reg_value(r_CORTEX_M_USBOTG_HS_DAINT) &
+                       read_reg_value(r_CORTEX_M_USBOTG_HS_DAINTMSK) & 0xff);
     /* checking current mode */
 #if CONFIG_USR_DRV_USBOTGHS_MODE_DEVICE
         /*
@@ -522,7 +748,7 @@ mbed_error_t iepint_handler(void)
           @ loop variant USBOTGHS_MAX_IN_EP - ep_id;
 	*/
 
-	// @ loop assigns ep_id, *((uint32_t *) (USB_BACKEND_MEMORY_BASE .. USB_BACKEND_MEMORY_END)), usbotghs_ctx.in_eps[0 .. USBOTGHS_MAX_IN_EP-1].core_txfifo_empty,usbotghs_ctx.in_eps[0 .. USBOTGHS_MAX_IN_EP-1].fifo_idx,usbotghs_ctx.in_eps[0 .. USBOTGHS_MAX_IN_EP-1].fifo_lck,usbotghs_ctx.in_eps[0 .. USBOTGHS_MAX_IN_EP-1].fifo, GHOST_in_eps[0 .. USBOTGHS_MAX_IN_EP-1].state, usbotghs_ctx.in_eps[0 .. USBOTGHS_MAX_IN_EP-1].state, daint,errcode,diepintx;
+	// @ loop assigns ep_id, *((uint32_t *) (USB_BACKEND_MEMORY_BASE .. USB_BACKEND_MEMORY_END)), usbotghs_ctx.in_eps[0 .. USBOTGHS_MAX_IN_EP-1].core_txfifo_empty,usbotghs_ctx.in_eps[0 .. USBOTGHS_MAX_IN_EP-1].fifo_idx,usbotghs_ctx.in_eps[0 .. USBOTGHS_MAX_IN_EP-1].fifo_owner,usbotghs_ctx.in_eps[0 .. USBOTGHS_MAX_IN_EP-1].fifo, GHOST_in_eps[0 .. USBOTGHS_MAX_IN_EP-1].state, usbotghs_ctx.in_eps[0 .. USBOTGHS_MAX_IN_EP-1].state, daint,errcode,diepintx;
 	for (ep_id = 0; ep_id < USBOTGHS_MAX_IN_EP; ++ep_id) {
             if (daint == 0) {
                 /* no more EPs to handle */
@@ -538,12 +764,19 @@ mbed_error_t iepint_handler(void)
 		/*@ assert 0<= ep_id < USBOTGHS_MAX_IN_EP ; */
                 diepintx = read_reg_value(r_CORTEX_M_USBOTG_HS_DIEPINT(ep_id));
 
-                /* Bit 7 TXFE: Transmit FIFO empty */
-                if (diepintx & USBOTG_HS_DIEPINT_TOC_Msk) {
-		  /*@ assert  (register_t) USB_BACKEND_MEMORY_BASE <=r_CORTEX_M_USBOTG_HS_DIEPINT(ep_id)  <=  (register_t) USB_BACKEND_MEMORY_END; */
-		    set_reg_bits(r_CORTEX_M_USBOTG_HS_DIEPINT(ep_id), USBOTG_HS_DIEPINT_TXFE_Msk);
+                /* Bit 7 TXFE: Transmit FIFO empty (read only). This event is not
+                 * masked by DIEPMSK but by DIEPEMPMSK, which is set only while
+                 * a transfer is waiting for room in the Core TxFIFO */
+                if ((diepintx & USBOTG_HS_DIEPINT_TXFE_Msk) &&
+                    (read_reg_value(r_CORTEX_M_USBOTG_HS_DIEPEMPMSK) & USBOTG_HS_DIEPEMPMSK_INEPTXFEM(ep_id))) {
                     ctx->in_eps[ep_id].core_txfifo_empty = true;
                     log_printf("[USBOTG][HS] iepint: ep %d: TxFifo empty\n", ep_id);
+                    /* push the next packets of the current transfer */
+                    if (usbotghs_fill_epx_txfifo(ep_id) != MBED_ERROR_NONE) {
+                        log_printf("[USBOTG][HS] iepint: ep %d: TxFIFO refill failed\n", ep_id);
+                        /* no more refill for this transfer */
+                        clear_reg_bits(r_CORTEX_M_USBOTG_HS_DIEPEMPMSK, USBOTG_HS_DIEPEMPMSK_INEPTXFEM(ep_id));
+                    }
                 }
 
                 /* Bit 6 INEPNE: IN endpoint NAK effective */
@@ -592,51 +825,77 @@ mbed_error_t iepint_handler(void)
 
                             log_printf("[USBOTG][HS] iepint: ep %d: still in fragmented transfer (%d on %d), continue...\n", ep_id, ctx->in_eps[ep_id].fifo_idx, ctx->in_eps[ep_id].fifo_size);
                             /* still in fragmentation transfer. We need to start a new
-                             * transmission of the bigger size between mpsize and residual size
+                             * transmission of the next fragment (upto 3 packets on EP0)
                              * in order to finish the current transfer. The EP state is untouched */
-                            /* 1. Configure the endpoint to specify the amount of data to send, at
-                             * most MPSize */
-                            uint32_t datasize = ctx->in_eps[ep_id].fifo_size - ctx->in_eps[ep_id].fifo_idx;
-                            if (datasize > ctx->in_eps[ep_id].mpsize) {
-                                datasize = ctx->in_eps[ep_id].mpsize;
-                            }
+                            /* 1. Configure the endpoint to specify the amount of data to send */
+                            uint32_t datasize = usbotghs_ep0_fragment_size(ctx->in_eps[ep_id].fifo_size - ctx->in_eps[ep_id].fifo_idx,
+                                                                          ctx->in_eps[ep_id].mpsize);
+                            uint32_t pktcnt = (datasize / ctx->in_eps[ep_id].mpsize) + ((datasize % ctx->in_eps[ep_id].mpsize) ? 1 : 0);
                             /*@ assert  (register_t) USB_BACKEND_MEMORY_BASE <=r_CORTEX_M_USBOTG_HS_DIEPTSIZ(ep_id)  <=  (register_t) USB_BACKEND_MEMORY_END; */
                             set_reg_value(r_CORTEX_M_USBOTG_HS_DIEPTSIZ(ep_id),
-                                    1,
+                                    pktcnt,
                                     USBOTG_HS_DIEPTSIZ_PKTCNT_Msk(ep_id),
                                     USBOTG_HS_DIEPTSIZ_PKTCNT_Pos(ep_id));
                             set_reg_value(r_CORTEX_M_USBOTG_HS_DIEPTSIZ(ep_id),
                                     datasize,
                                     USBOTG_HS_DIEPTSIZ_XFRSIZ_Msk(ep_id),
                                     USBOTG_HS_DIEPTSIZ_XFRSIZ_Pos(ep_id));
+#if CONFIG_USR_DEV_USBOTGHS_DMA
+                            /* 2. the next fragment is fetched by the core DMA on EP enable */
+                            usbotghs_xmit_dma_prepare(ep_id, datasize);
+                            ctx->in_eps[ep_id].fifo_idx += datasize;
+#endif
                             /*@ assert  (register_t) USB_BACKEND_MEMORY_BASE <=r_CORTEX_M_USBOTG_HS_DIEPCTL(ep_id)  <=  (register_t) USB_BACKEND_MEMORY_END; */
                             set_reg_bits(r_CORTEX_M_USBOTG_HS_DIEPCTL(ep_id),
                                     USBOTG_HS_DIEPCTL_CNAK_Msk | USBOTG_HS_DIEPCTL_EPENA_Msk);
+#if !CONFIG_USR_DEV_USBOTGHS_DMA
                             /* 2. write data to fifo */
                             usbotghs_write_epx_fifo(datasize, ep_id);
+#endif
+                        } else if (ctx->in_eps[ep_id].zlp_pending) {
+                            /* the transfer ended with a full packet: terminate it with
+                             * a ZLP. The upper layer is informed on the ZLP XFRC */
+                            log_printf("[USBOTG][HS] iepint: ep %d: sending terminating ZLP\n", ep_id);
+                            ctx->in_eps[ep_id].zlp_pending = false;
+                            usbotghs_xmit_zlp(ep_id);
                         } else {
+                            uint32_t xmit_size = ctx->in_eps[ep_id].fifo_idx;
+                            /* the RAM FIFO is released before calling the upper handler, which
+                             * may start a new transfer */
+                            ctx->in_eps[ep_id].fifo = 0;
+                            ctx->in_eps[ep_id].fifo_idx = 0;
+                            ctx->in_eps[ep_id].fifo_size = 0;
+                            ctx->in_eps[ep_id].iov = NULL;
                             /* now EP is idle */
                             set_u8_with_membarrier(&(ctx->in_eps[ep_id].state), (uint8_t)USBOTG_HS_EP_STATE_IDLE);
                             //@ ghost GHOST_in_eps[ep_id].state = usbotghs_ctx.in_eps[ep_id].state;
-                            /* inform libctrl of transfert complete */
-
-
-                            if (ctx->in_eps[ep_id].handler == NULL) {
-                                goto err;
+                            uint8_t dropped = 0;
+                            /* start the next queued transfer (if any) without waiting for the
+                             * upper layer */
+                            if (ep_id > 0) {
+                                usbotghs_xmit_next(ep_id, &dropped);
                             }
-                            /*@ assert ctx->in_eps[ep_id].handler != \null; */
-#ifndef __FRAMAC__
-                            if (handler_sanity_check((physaddr_t)ctx->in_eps[ep_id].handler)) {
-                                goto err;
+                            /* standalone ZLPs (usbotghs_send_zlp()) have no upper
+                             * layer completion */
+                            if (xmit_size > 0) {
+                                /* inform libctrl of transfert complete */
+                                errcode = iepint_call_handler(ctx, ep_id, xmit_size);
+                                if (errcode == MBED_ERROR_NOBACKEND) {
+                                    goto err;
+                                }
+                            }
+                            /* queued transfers which couldn't be started are complete,
+                             * nothing being sent */
+                            /*@
+                              @ loop assigns dropped, errcode;
+                              @ loop variant dropped;
+                              */
+                            for (; dropped > 0; --dropped) {
+                                errcode = iepint_call_handler(ctx, ep_id, 0);
+                                if (errcode == MBED_ERROR_NOBACKEND) {
+                                    goto err;
+                                }
                             }
-#endif
-                            /*@ assert ctx->in_eps[ep_id].handler \in { &handler_ep}; */
-                            /*@ calls  handler_ep; */
-                            /* In FramaC context, upper handler is my_handle_inepevent */
-                            errcode = ctx->in_eps[ep_id].handler(usb_otg_hs_dev_infos.id, ctx->in_eps[ep_id].fifo_idx, ep_id);
-                            ctx->in_eps[ep_id].fifo = 0;
-                            ctx->in_eps[ep_id].fifo_idx = 0;
-                            ctx->in_eps[ep_id].fifo_size = 0;
                         }
                     } else {
                         log_printf("[USBOTGHS] EP %d not in DATA_IN state ???\n", ep_id);
@@ -663,7 +922,28 @@ err:
 }
 
 /*
- * RXFLV handler, This interrupt is executed when the core as written a complete packet in the RxFIFO.
+ * Drop a packet of bcnt bytes which can't be received on the given EP, leaving
+ * the packets queued behind it in the shared RxFIFO, and count it in the given
+ * EP error counter
+ */
+/*@
+  @ requires epnum < USBOTGHS_MAX_OUT_EP;
+  @ requires \valid(cause);
+  @ assigns ep_err_stats[epnum], *cause;
+  */
+static void rxflvl_discard_pkt(uint8_t epnum, uint16_t bcnt, uint32_t *cause)
+{
+    if (bcnt > 0) {
+        usbotghs_rxfifo_discard(bcnt, epnum);
+        ep_err_stats[epnum].discarded_pkts++;
+        ep_err_stats[epnum].discarded_bytes += bcnt;
+    }
+    (*cause)++;
+}
+
+/*
+ * RxFIFO status entry handler: pop and handle one GRXSTSP entry (and its data), while
+ * RXFLVL is masked.
  *
  * It is hard, here to define complex function contracts, as behaviors depend on volative values (registers value), which,
  * by essence, can't be considered as a precondition check.
@@ -676,7 +956,7 @@ err:
 #ifndef __FRAMAC__
 static
 #endif
-mbed_error_t rxflvl_handler(void)
+mbed_error_t rxflvl_handle_entry(void)
 {
     mbed_error_t errcode = MBED_ERROR_NONE;
 	uint32_t grxstsp;
@@ -689,14 +969,9 @@ mbed_error_t rxflvl_handler(void)
 	uint8_t chnum = 0; /* host case */
 #endif
 	uint32_t size;
+	bool last_pkt = false;
     usbotghs_context_t *ctx;
 
-
-   	/* 1. Mask the RXFLVL interrupt (in OTG_HS_GINTSTS) by writing to RXFLVL = 0
-     * (in OTG_HS_GINTMSK),  until it has read the packet from the receive FIFO
-     */
-	set_reg(r_CORTEX_M_USBOTG_HS_GINTMSK, 0, USBOTG_HS_GINTMSK_RXFLVLM);
-
  	/* 2. Read the Receive status pop register */
     grxstsp = read_reg_value(r_CORTEX_M_USBOTG_HS_GRXSTSP);
 
@@ -718,13 +993,18 @@ mbed_error_t rxflvl_handler(void)
 	size = 0;
     if (epnum >= USBOTGHS_MAX_OUT_EP) {
         log_printf("[USBOTG][HS] invalid register value for epnum ! (fault injection ?)\n");
+        /* any EP FIFO window pops from the shared RxFIFO */
+        if (bcnt > 0) {
+            usbotghs_rxfifo_discard(bcnt, USBOTG_HS_EP0);
+        }
         errcode = MBED_ERROR_UNKNOWN;
         goto err;
     }
     /*@ assert 0 <= epnum < USBOTGHS_MAX_OUT_EP; */
     if (ctx->out_eps[epnum].configured != true) {
-        log_printf("[USBOTG][HS] invalid register value for epnum ! (fault injection ?)\n");
-        errcode = MBED_ERROR_UNKNOWN;
+        log_printf("[USBOTG][HS] packet received on unconfigured EP %d, dropped\n", epnum);
+        rxflvl_discard_pkt(epnum, bcnt, &ep_err_stats[epnum].not_configured);
+        errcode = MBED_ERROR_INVSTATE;
         goto err;
     }
 
@@ -760,23 +1040,11 @@ mbed_error_t rxflvl_handler(void)
                 {
                     log_printf("[USB HS][RXFLVL] EP%d OUT Data PKT (size %d) Recv\n", epnum, bcnt);
 
-                    /* error cases first */
-                    if (ctx->out_eps[epnum].configured != true)
-                    {
-                        log_printf("[USB HS][RXFLVL] EP%d OUT Data PKT on invalid EP!\n", epnum);
-                        /* to clear RXFLVL IT, we must read from FIFO. read to garbage here */
-                        if (bcnt > 0) {
-                            usbotghs_rxfifo_flush(epnum);
-                        }
-                        errcode = MBED_ERROR_INVSTATE;
-                        goto err;
-                    }
+                    /* error cases first (unconfigured EPs are handled above) */
                     if (ctx->out_eps[epnum].state == USBOTG_HS_EP_STATE_SETUP) {
                         /* associated oepint not yet executed, return NYET to host */
                         log_printf("[RXFLVL] recv DATA while in STUP mode!\n");
-                        if (bcnt > 0) {
-                            usbotghs_rxfifo_flush(epnum);
-                        }
+                        rxflvl_discard_pkt(epnum, bcnt, &ep_err_stats[epnum].rejected);
                         usbotghs_endpoint_set_nak(epnum, USBOTG_HS_EP_DIR_OUT);
                         errcode = MBED_ERROR_INVSTATE;
                         goto err;
@@ -792,9 +1060,13 @@ mbed_error_t rxflvl_handler(void)
 
                     /*@ assert usbotghs_ctx.out_eps[epnum].configured == \true; */
                     if (usbotghs_read_epx_fifo(bcnt, epnum) != MBED_ERROR_NONE) {
-                        /* empty fifo on error */
-                        usbotghs_rxfifo_flush(epnum);
+                        /* the packet has not been read: drop it on error */
+                        rxflvl_discard_pkt(epnum, bcnt, &ep_err_stats[epnum].rejected);
                         usbotghs_endpoint_stall(epnum, USBOTG_HS_EP_DIR_OUT);
+                    } else if (epnum != USBOTG_HS_EP0 && usbotghs_recv_split_hdr_done(epnum, bcnt)) {
+                        /* split RAM FIFO: the header can be parsed while the
+                         * payload is being received */
+                        errcode = oepint_call_handler(ctx, epnum, ctx->out_eps[epnum].split_hdr_size);
                     }
                     set_u8_with_membarrier(&(ctx->out_eps[epnum].state), (uint8_t)USBOTG_HS_EP_STATE_DATA_OUT_WIP);
                     //@ ghost GHOST_out_eps[epnum].state = usbotghs_ctx.out_eps[epnum].state;
@@ -813,8 +1085,19 @@ check_variable_length_transfer:
                      * receiving data smaller than MPSize, this means that this is the last DATA packet (see
                      * Data variable length transaction, USB 2.0 std protocol).
                      * We consider variable length data transfer not supported on EP0 */
-                    if ((bcnt < ctx->out_eps[epnum].mpsize) ||
-                            (bcnt == 0 && ctx->out_eps[epnum].fifo_idx >= ctx->out_eps[epnum].mpsize))
+                    if (epnum != USBOTG_HS_EP0 &&
+                        ctx->out_eps[epnum].completion == USBOTG_HS_EP_COMPLETE_EVERY_PKT) {
+                        /* each packet is the last one of its transfer */
+                        last_pkt = true;
+                    } else if (epnum != USBOTG_HS_EP0 &&
+                        ctx->out_eps[epnum].completion == USBOTG_HS_EP_COMPLETE_FULL_BUFFER) {
+                        /* short packets are appended to the current RAM FIFO */
+                        last_pkt = (ctx->out_eps[epnum].fifo_idx >= ctx->out_eps[epnum].fifo_size);
+                    } else {
+                        last_pkt = (bcnt < ctx->out_eps[epnum].mpsize) ||
+                            (bcnt == 0 && ctx->out_eps[epnum].fifo_idx >= ctx->out_eps[epnum].mpsize);
+                    }
+                    if (last_pkt == true)
                     {
                         /* only for BULK endpoints, says the USB standard */
                         if (ctx->out_eps[epnum].type != USBOTG_HS_EP_TYPE_ISOCHRONOUS) {
@@ -828,12 +1111,6 @@ check_variable_length_transfer:
             case PKT_STATUS_OUT_TRANSFER_COMPLETE:
                 {
                     log_printf("[USB HS][RXFLVL] OUT Transfer complete on EP %d\n", epnum);
-                    if (ctx->out_eps[epnum].configured != true) /* which state on OUT TRSFER Complete ? */
-                    {
-                        log_printf("[USB HS][RXFLVL] OUT Data PKT on invalid EP!\n");
-                        errcode = MBED_ERROR_INVSTATE;
-                        goto err;
-                    }
                     //set_u8_with_membarrier(&(ctx->out_eps[epnum].state), (uint8_t)USBOTG_HS_EP_STATE_DATA_OUT);
                     //@ ghost GHOST_out_eps[epnum].state = usbotghs_ctx.out_eps[epnum].state;
                     break;
@@ -846,6 +1123,7 @@ check_variable_length_transfer:
                         goto err;
                     }
                     /* setup transfer complete, no wait oepint to handle this */
+                    usbotghs_setup_slot_commit(ctx);
                     set_u8_with_membarrier(&(ctx->out_eps[epnum].state), (uint8_t)USBOTG_HS_EP_STATE_SETUP);
                     //@ ghost GHOST_out_eps[epnum].state = usbotghs_ctx.out_eps[epnum].state;
                     break;
@@ -859,28 +1137,26 @@ check_variable_length_transfer:
                     }
                     /*@ assert bcnt > 0; */
                     if (epnum != USBOTG_HS_EP0) {
-                        usbotghs_rxfifo_flush(epnum);
+                        rxflvl_discard_pkt(epnum, bcnt, &ep_err_stats[epnum].bad_setup);
                         usbotghs_endpoint_set_nak(epnum, USBOTG_HS_EP_DIR_OUT);
                         errcode = MBED_ERROR_UNSUPORTED_CMD;
                         goto err;
-                    } else if (ctx->out_eps[epnum].state == USBOTG_HS_EP_STATE_SETUP) {
-                        /* associated oepint not yet executed, return NYET to host */
-                        usbotghs_rxfifo_flush(epnum);
-                        usbotghs_endpoint_set_nak(epnum, USBOTG_HS_EP_DIR_OUT);
-                        errcode = MBED_ERROR_INVSTATE;
-                        goto err;
-                    }
-                    /* INFO: here, We don't check the setup pkt size, this is under the responsability of the
-                     * control plane, as the setup pkt size is USB-standard defined, not driver specific */
-                    if (usbotghs_read_epx_fifo(bcnt, epnum)) {
-                        /* empty fifo on error */
-                        usbotghs_rxfifo_flush(epnum);
+                    } else if (bcnt != USBOTGHS_SETUP_PKT_SZ) {
+                        /* SETUP packets are USB-standard defined 8 bytes packets */
+                        rxflvl_discard_pkt(epnum, bcnt, &ep_err_stats[epnum].bad_setup);
                         usbotghs_endpoint_stall(epnum, USBOTG_HS_EP_DIR_OUT);
+                        errcode = MBED_ERROR_INVPARAM;
+                        goto err;
                     }
+                    /* stored in the driver SETUP slots, even if the previous SETUP packet
+                     * has not been handled by the upper layer yet (STUP oepint pending) */
+                    usbotghs_setup_slot_write(ctx);
                     /* After this, the Data stage begins. A Setup stage done should be received, which triggers
                      * a Setup interrupt */
-                    set_u8_with_membarrier(&(ctx->out_eps[epnum].state), (uint8_t)USBOTG_HS_EP_STATE_SETUP_WIP);
-                    //@ ghost GHOST_out_eps[epnum].state = usbotghs_ctx.out_eps[epnum].state;
+                    if (ctx->out_eps[epnum].state != USBOTG_HS_EP_STATE_SETUP) {
+                        set_u8_with_membarrier(&(ctx->out_eps[epnum].state), (uint8_t)USBOTG_HS_EP_STATE_SETUP_WIP);
+                        //@ ghost GHOST_out_eps[epnum].state = usbotghs_ctx.out_eps[epnum].state;
+                    }
                     break;
                 }
             default:
@@ -892,10 +1168,121 @@ err:
 #else
         /* TODO: handle Host mode RXFLVL behavior */
 #endif
+    return errcode;
+}
+
+/*
+ * RXFLV handler, This interrupt is executed when the core as written a complete packet in the RxFIFO.
+ *
+ * The RxFIFO is shared by all the OUT EPs and may already hold the next packets (e.g. back-to-back
+ * bulk OUT packets): status entries are popped while RXFLVL is set, up to the configured budget,
+ * instead of paying a whole ISR entry for each of them. If the budget is reached, RXFLVL is still
+ * set when unmasked and the next entries are handled by the next ISR execution.
+ */
+/*@
+  @ requires \separated(GHOST_out_eps+(0 .. USBOTGHS_MAX_OUT_EP - 1),((uint32_t *) (USB_BACKEND_MEMORY_BASE .. USB_BACKEND_MEMORY_END)), &usbotghs_ctx);
+  @ assigns GHOST_out_eps[0 .. USBOTGHS_MAX_OUT_EP - 1].state, *((uint32_t *) (USB_BACKEND_MEMORY_BASE .. USB_BACKEND_MEMORY_END)), usbotghs_ctx, rxflvl_stats;
+  */
+#ifndef __FRAMAC__
+static
+#endif
+mbed_error_t rxflvl_handler(void)
+{
+    mbed_error_t errcode = MBED_ERROR_NONE;
+    uint32_t drained = 0;
+
+   	/* 1. Mask the RXFLVL interrupt (in OTG_HS_GINTSTS) by writing to RXFLVL = 0
+     * (in OTG_HS_GINTMSK),  until it has read the packet from the receive FIFO
+     */
+	set_reg(r_CORTEX_M_USBOTG_HS_GINTMSK, 0, USBOTG_HS_GINTMSK_RXFLVLM);
+
+    /*@
+      @ loop invariant 0 <= drained <= CONFIG_USR_DEV_USBOTGHS_RXFLVL_BUDGET;
+      @ loop assigns drained, errcode, GHOST_out_eps[0 .. USBOTGHS_MAX_OUT_EP - 1].state, *((uint32_t *) (USB_BACKEND_MEMORY_BASE .. USB_BACKEND_MEMORY_END)), usbotghs_ctx;
+      @ loop variant CONFIG_USR_DEV_USBOTGHS_RXFLVL_BUDGET - drained;
+      */
+    do {
+        errcode = rxflvl_handle_entry();
+        drained++;
+        if (errcode != MBED_ERROR_NONE) {
+            /* the faulty packet has been dropped from the RxFIFO, let the
+             * next ISR execution handle the next entries */
+            break;
+        }
+        if (usbotghs_get_context()->out_eps[0].state == USBOTG_HS_EP_STATE_SETUP) {
+            /* SETUP stage done: the next EP0 packets must wait for the STUP
+             * oepint to be handled by the upper layer */
+            break;
+        }
+    } while (drained < CONFIG_USR_DEV_USBOTGHS_RXFLVL_BUDGET &&
+             get_reg(r_CORTEX_M_USBOTG_HS_GINTSTS, USBOTG_HS_GINTSTS_RXFLVL));
+
+    rxflvl_stats.irqs++;
+    rxflvl_stats.entries += drained;
+    rxflvl_stats.drained[(drained < USBOTGHS_RXFLVL_STATS_BUCKETS ? drained : USBOTGHS_RXFLVL_STATS_BUCKETS) - 1]++;
+    if (drained == CONFIG_USR_DEV_USBOTGHS_RXFLVL_BUDGET &&
+        get_reg(r_CORTEX_M_USBOTG_HS_GINTSTS, USBOTG_HS_GINTSTS_RXFLVL)) {
+        rxflvl_stats.budget_hits++;
+    }
+
 	set_reg(r_CORTEX_M_USBOTG_HS_GINTMSK, 1, USBOTG_HS_GINTMSK_RXFLVLM);
     return errcode;
 }
 
+/*@
+  @ requires \valid(stats);
+  @ assigns *stats;
+  */
+void usbotghs_get_rxflvl_stats(usbotghs_rxflvl_stats_t *stats)
+{
+    if (stats == NULL) {
+        return;
+    }
+    *stats = rxflvl_stats;
+}
+
+/*@
+  @ assigns rxflvl_stats;
+  */
+void usbotghs_clear_rxflvl_stats(void)
+{
+    usbotghs_rxflvl_stats_t empty = { 0 };
+    rxflvl_stats = empty;
+}
+
+/*@
+  @ assigns *stats;
+  @ ensures (stats == NULL || ep_id >= USBOTGHS_MAX_OUT_EP) ==> \result == MBED_ERROR_INVPARAM;
+  */
+mbed_error_t usbotghs_get_ep_err_stats(uint8_t ep_id, usbotghs_ep_err_stats_t *stats)
+{
+    mbed_error_t errcode = MBED_ERROR_NONE;
+    if (stats == NULL || ep_id >= USBOTGHS_MAX_OUT_EP) {
+        errcode = MBED_ERROR_INVPARAM;
+        goto err;
+    }
+    *stats = ep_err_stats[ep_id];
+err:
+    return errcode;
+}
+
+/*@
+  @ assigns ep_err_stats[ep_id];
+  @ ensures ep_id >= USBOTGHS_MAX_OUT_EP ==> \result == MBED_ERROR_INVPARAM;
+  */
+mbed_error_t usbotghs_clear_ep_err_stats(uint8_t ep_id)
+{
+    mbed_error_t errcode = MBED_ERROR_NONE;
+    usbotghs_ep_err_stats_t empty = { 0 };
+    if (ep_id >= USBOTGHS_MAX_OUT_EP) {
+        errcode = MBED_ERROR_INVPARAM;
+        goto err;
+    }
+    ep_err_stats[ep_id] = empty;
+err:
+    return errcode;
+}
+
 
 /*
  * Start-offrame event (new USB frame)
@@ -1045,10 +1432,73 @@ static const usb_otg_hs_isr_handler_t usb_otg_hs_isr_handlers[32] = {
     resume_handler,    /*< Resume/Wakeup event */
 };
 
+/*
+ * Data path events, serviced before all the other pending ones when
+ * CONFIG_USR_DEV_USBOTGHS_IRQ_DATA_FIRST is set, in this order
+ */
+#if CONFIG_USR_DEV_USBOTGHS_IRQ_DATA_FIRST
+static const uint8_t usb_otg_hs_isr_data_first[] = {
+    USBOTGHS_IT_RXFLVL,
+    USBOTGHS_IT_OEPINT,
+    USBOTGHS_IT_IEPINT,
+};
+#endif
+
 /************************************************
  * About ISR dispatchers
  */
 
+/*
+ * Index of the lowest bit set in val (val must not be 0). On Cortex-M4, this is
+ * a RBIT + CLZ pair instead of a loop over each bit of GINTSTS.
+ */
+/*@
+  @ requires val != 0;
+  @ assigns \nothing;
+  @ ensures 0 <= \result < 32;
+  */
+static inline uint8_t usbotghs_isr_lowest_bit(uint32_t val)
+{
+#ifdef __FRAMAC__
+    uint8_t i;
+    /*@
+      @ loop invariant 0 <= i <= 31;
+      @ loop assigns i;
+      @ loop variant 31 - i;
+      */
+    for (i = 0; i < 31; i++) {
+        if (val & ((uint32_t)1 << i)) {
+            break;
+        }
+    }
+    return i;
+#else
+    return (uint8_t)__builtin_ctz(val);
+#endif
+}
+
+/*@
+  @ requires 0 <= i < 32;
+  @ requires \separated(((uint32_t *) (USB_BACKEND_MEMORY_BASE .. USB_BACKEND_MEMORY_END)), &usbotghs_ctx);
+  @ assigns *((uint32_t *) (USB_BACKEND_MEMORY_BASE .. USB_BACKEND_MEMORY_END)), usbotghs_ctx;
+  */
+static inline void usbotghs_isr_dispatch(uint8_t i)
+{
+    /*@ assert i < 32; */
+#if CONFIG_USR_DRV_USBOTGHS_DEBUG
+    /* out of __FRAMAC__ case */
+    usbotghs_int_cnt[i]++;
+#endif
+    /* INFO: as log_printf is a *macro* only resolved by cpp in debug mode,
+     * usbotghs_int_name is accedded only in this mode. There is no
+     * invalid memory access in the other case. */
+
+    /*@ assert usb_otg_hs_isr_handlers[i] \in
+      { &default_handler, &mmism_handler, &otg_handler, &sof_handler, &rxflvl_handler, &reserved_handler, &ususpend_handler, &esuspend_handler, &reset_handler, &enumdone_handler, &iepint_handler, &oepint_handler }; */
+    /*@ calls default_handler, mmism_handler, otg_handler, sof_handler, rxflvl_handler, reserved_handler, ususpend_handler, esuspend_handler, reset_handler, enumdone_handler, iepint_handler, oepint_handler; */
+    usb_otg_hs_isr_handlers[i]();
+}
+
 /*@
   @ requires \separated(((uint32_t *) (USB_BACKEND_MEMORY_BASE .. USB_BACKEND_MEMORY_END)), &usbotghs_ctx);
   @ assigns *((uint32_t *) (USB_BACKEND_MEMORY_BASE .. USB_BACKEND_MEMORY_END)), usbotghs_ctx;
@@ -1058,6 +1508,7 @@ void USBOTGHS_IRQHandler(uint8_t interrupt __attribute__((unused)),
                          uint32_t dr)
 {
 	uint8_t i;
+	uint8_t n;
 	uint32_t intsts = sr;
 	uint32_t intmsk = dr;
 
@@ -1067,39 +1518,40 @@ void USBOTGHS_IRQHandler(uint8_t interrupt __attribute__((unused)),
     uint32_t val = intsts;
     val &= intmsk;
 
+#if CONFIG_USR_DEV_USBOTGHS_IRQ_DATA_FIRST
     /*
-     * Here, for each status flag active, execute the corresponding handler if
-     * the global interrupt mask is also enabled
+     * Data path events first, so that a pending SOF or suspend doesn't delay
+     * the RxFIFO draining or the next IN/OUT transfer
      */
     /*@
-      @ loop invariant 0 <= i <= 32;
-      @ loop assigns val, i, *((uint32_t *) (USB_BACKEND_MEMORY_BASE .. USB_BACKEND_MEMORY_END)), usbotghs_ctx;
-      @ loop variant 32 - i;
+      @ loop invariant 0 <= n <= sizeof(usb_otg_hs_isr_data_first);
+      @ loop assigns val, n, i, *((uint32_t *) (USB_BACKEND_MEMORY_BASE .. USB_BACKEND_MEMORY_END)), usbotghs_ctx;
+      @ loop variant sizeof(usb_otg_hs_isr_data_first) - n;
       */
-	for (i = 0; i < 32; i++) {
-		/* Below code is equivalent to
-         * calculating (!(intsts & ((uint32_t)1 << i)) || !(intmsk & ((uint32_t)1 << i)))
-         */
-        if (val == 0) {
-            break;
+    for (n = 0; n < sizeof(usb_otg_hs_isr_data_first); n++) {
+        i = usb_otg_hs_isr_data_first[n];
+        if (val & ((uint32_t)1 << i)) {
+            val &= ~((uint32_t)1 << i);
+            usbotghs_isr_dispatch(i);
         }
-        if (val & 1)
-        {
-            /*@ assert i < 32; */
-#if CONFIG_USR_DRV_USBOTGHS_DEBUG
-            /* out of __FRAMAC__ case */
-            usbotghs_int_cnt[i]++;
+    }
 #endif
-            /* INFO: as log_printf is a *macro* only resolved by cpp in debug mode,
-             * usbotghs_int_name is accedded only in this mode. There is no
-             * invalid memory access in the other case. */
-
-            /*@ assert usb_otg_hs_isr_handlers[i] \in
-              { &default_handler, &mmism_handler, &otg_handler, &sof_handler, &rxflvl_handler, &reserved_handler, &ususpend_handler, &esuspend_handler, &reset_handler, &enumdone_handler, &iepint_handler, &oepint_handler }; */
-            /*@ calls default_handler, mmism_handler, otg_handler, sof_handler, rxflvl_handler, reserved_handler, ususpend_handler, esuspend_handler, reset_handler, enumdone_handler, iepint_handler, oepint_handler; */
-            usb_otg_hs_isr_handlers[i]();
-        }
-        val >>= 1;
+
+    /*
+     * Here, for each status flag still active, execute the corresponding handler
+     * if the global interrupt mask is also enabled. Only the set bits are visited,
+     * lowest first, each iteration clearing the bit it services.
+     */
+    /*@
+      @ loop invariant 0 <= n <= 32;
+      @ loop assigns val, n, i, *((uint32_t *) (USB_BACKEND_MEMORY_BASE .. USB_BACKEND_MEMORY_END)), usbotghs_ctx;
+      @ loop variant 32 - n;
+      */
+    for (n = 0; n < 32 && val != 0; n++) {
+        i = usbotghs_isr_lowest_bit(val);
+        /* clear the lowest bit set */
+        val &= val - 1;
+        usbotghs_isr_dispatch(i);
     }
 }
 
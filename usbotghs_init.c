@@ -35,6 +35,45 @@
 #define TRIGGER_TXFE_ON_HALF_EMPTY 0
 #define TRIGGER_TXFE_ON_FULL_EMPTY 1
 
+#ifndef CONFIG_USR_DEV_USBOTGHS_DMA_RX_THRESHOLD
+# define CONFIG_USR_DEV_USBOTGHS_DMA_RX_THRESHOLD 8
+#endif
+#ifndef CONFIG_USR_DEV_USBOTGHS_DMA_TX_THRESHOLD
+# define CONFIG_USR_DEV_USBOTGHS_DMA_TX_THRESHOLD 8
+#endif
+
+#if CONFIG_USR_DEV_USBOTGHS_DMA
+/* DMA thresholds, programmed by usbotghs_initialize_device() */
+static usbotghs_dma_thr_cfg_t dma_thr_cfg = {
+    .rx_thr_len  = CONFIG_USR_DEV_USBOTGHS_DMA_RX_THRESHOLD,
+    .tx_thr_len  = CONFIG_USR_DEV_USBOTGHS_DMA_TX_THRESHOLD,
+    .rx_thr      = true,
+    .noniso_thr  = true,
+    .iso_thr     = false,
+    .arb_parking = true,
+};
+/* set once the device mode registers are accessible */
+static bool dma_thr_device_init = false;
+
+/*@
+  @ assigns *((uint32_t *) (USB_BACKEND_MEMORY_BASE .. USB_BACKEND_MEMORY_END));
+  */
+static void usbotghs_apply_dma_thresholds(void)
+{
+    log_printf("[USB HS] dev init: set DMA thresholds (rx %d, tx %d words)\n",
+               dma_thr_cfg.rx_thr_len, dma_thr_cfg.tx_thr_len);
+    /* Arbitrer parking enable (avoid underrun) */
+	set_reg(r_CORTEX_M_USBOTG_HS_DTHRCTL, dma_thr_cfg.arb_parking ? 1 : 0, USBOTG_HS_DTHRCTL_ARPEN);
+    /*threshold for RxFIFO in DWORDs */
+	set_reg(r_CORTEX_M_USBOTG_HS_DTHRCTL, dma_thr_cfg.rx_thr_len, USBOTG_HS_DTHRCTL_RXTHRLEN);
+	set_reg(r_CORTEX_M_USBOTG_HS_DTHRCTL, dma_thr_cfg.rx_thr ? 1 : 0, USBOTG_HS_DTHRCTL_RXTHREN);
+    /*threshold for TxFIFO in DWORDs, enabled per IN EP type */
+	set_reg(r_CORTEX_M_USBOTG_HS_DTHRCTL, dma_thr_cfg.tx_thr_len, USBOTG_HS_DTHRCTL_TXTHRLEN);
+	set_reg(r_CORTEX_M_USBOTG_HS_DTHRCTL, dma_thr_cfg.iso_thr ? 1 : 0, USBOTG_HS_DTHRCTL_ISOTHREN);
+	set_reg(r_CORTEX_M_USBOTG_HS_DTHRCTL, dma_thr_cfg.noniso_thr ? 1 : 0, USBOTG_HS_DTHRCTL_NONISOTHREN);
+}
+#endif
+
 /*
  * Core initialization after Power-On. This configuration must
  * be done irrespective to whatever the DWC_Core is going to be
@@ -314,23 +353,9 @@ mbed_error_t usbotghs_initialize_device(void)
 
 
 #if CONFIG_USR_DEV_USBOTGHS_DMA
-    log_printf("[USB HS] dev init: set DMA thresholds\n");
-    /* set device threshold */
-    /* Arbitrer parking enable (avoid underrun) */
-	set_reg(r_CORTEX_M_USBOTG_HS_DTHRCTL, 1, USBOTG_HS_DTHRCTL_ARPEN);
-    /*threshold for RxFIFO in DWORDs */
-	set_reg(r_CORTEX_M_USBOTG_HS_DTHRCTL, 8, USBOTG_HS_DTHRCTL_RXTHRLEN);
-    /* enable threshold for RxFIFO */
-	set_reg(r_CORTEX_M_USBOTG_HS_DTHRCTL, 1, USBOTG_HS_DTHRCTL_RXTHREN);
-    /*threshold for TxFIFO in DWORDs */
-	set_reg(r_CORTEX_M_USBOTG_HS_DTHRCTL, 8, USBOTG_HS_DTHRCTL_RXTHRLEN);
-    /* enable threshold for TxFIFO */
-	set_reg(r_CORTEX_M_USBOTG_HS_DTHRCTL, 1, USBOTG_HS_DTHRCTL_TXTHREN);
-
-    /* disable threshold for isochronous EP */
-	set_reg(r_CORTEX_M_USBOTG_HS_DTHRCTL, 0, USBOTG_HS_DTHRCTL_ISOTHREN);
-    /* enable threshold for non-isochronous EP */
-	set_reg(r_CORTEX_M_USBOTG_HS_DTHRCTL, 1, USBOTG_HS_DTHRCTL_NONISOTHREN);
+    /* set device thresholds (see usbotghs_set_dma_thresholds()) */
+    usbotghs_apply_dma_thresholds();
+    dma_thr_device_init = true;
 #endif
     /* configure the ULPI backend of the core */
 
@@ -363,3 +388,55 @@ mbed_error_t usbotghs_initialize_host(void)
 
 }
 
+/*@
+  @ assigns GHOST_opaque_drv_privates;
+  @ ensures cfg == NULL ==> \result == MBED_ERROR_INVPARAM || \result == MBED_ERROR_UNSUPORTED_CMD;
+  */
+mbed_error_t usbotghs_set_dma_thresholds(const usbotghs_dma_thr_cfg_t *cfg)
+{
+    mbed_error_t errcode = MBED_ERROR_NONE;
+#if CONFIG_USR_DEV_USBOTGHS_DMA
+    if (cfg == NULL) {
+        errcode = MBED_ERROR_INVPARAM;
+        goto err;
+    }
+    if (cfg->rx_thr_len < USBOTGHS_DMA_THR_LEN_MIN || cfg->rx_thr_len > USBOTGHS_DMA_THR_LEN_MAX ||
+        cfg->tx_thr_len < USBOTGHS_DMA_THR_LEN_MIN || cfg->tx_thr_len > USBOTGHS_DMA_THR_LEN_MAX) {
+        errcode = MBED_ERROR_INVPARAM;
+        goto err;
+    }
+    dma_thr_cfg = *cfg;
+    if (dma_thr_device_init == true) {
+        usbotghs_apply_dma_thresholds();
+    }
+#else
+    /* DTHRCTL is only used by the core DMA */
+    (void)cfg;
+    errcode = MBED_ERROR_UNSUPORTED_CMD;
+    goto err;
+#endif
+err:
+    return errcode;
+}
+
+/*@
+  @ assigns *cfg;
+  @ ensures cfg == NULL ==> \result == MBED_ERROR_INVPARAM || \result == MBED_ERROR_UNSUPORTED_CMD;
+  */
+mbed_error_t usbotghs_get_dma_thresholds(usbotghs_dma_thr_cfg_t *cfg)
+{
+    mbed_error_t errcode = MBED_ERROR_NONE;
+#if CONFIG_USR_DEV_USBOTGHS_DMA
+    if (cfg == NULL) {
+        errcode = MBED_ERROR_INVPARAM;
+        goto err;
+    }
+    *cfg = dma_thr_cfg;
+#else
+    (void)cfg;
+    errcode = MBED_ERROR_UNSUPORTED_CMD;
+    goto err;
+#endif
+err:
+    return errcode;
+}
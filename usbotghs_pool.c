@@ -0,0 +1,224 @@
+/*
+ *
+ * Copyright 2019 The wookey project team <wookey@ssi.gouv.fr>
+ *   - Ryad     Benadjila
+ *   - Arnauld  Michelizza
+ *   - Mathieu  Renard
+ *   - Philippe Thierry
+ *   - Philippe Trebuchet
+ *
+ * This package is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * the Free Software Foundation; either version 3 of the License, or (at
+ * ur option) any later version.
+ *
+ * This package is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this package; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ */
+#include "autoconf.h"
+#include "libc/types.h"
+#include "libc/stdio.h"
+
+#include "api/libusbotghs.h"
+#include "usbotghs.h"
+#include "usbotghs_pool.h"
+
+#ifndef CONFIG_USR_DEV_USBOTGHS_DMA_POOL_BLOCKS
+# define CONFIG_USR_DEV_USBOTGHS_DMA_POOL_BLOCKS 4
+#endif
+#ifndef CONFIG_USR_DEV_USBOTGHS_DMA_POOL_BLOCK_SIZE
+# define CONFIG_USR_DEV_USBOTGHS_DMA_POOL_BLOCK_SIZE 512
+#endif
+
+#if (CONFIG_USR_DEV_USBOTGHS_DMA_POOL_BLOCK_SIZE % 512) != 0
+# error "DMA pool block size must be a multiple of 512 bytes"
+#endif
+
+/*
+ * DMA endpoint buffers pool.
+ *
+ * Statically allocated blocks, of the same size, in the driver .bss (SRAM):
+ * each block is word-aligned, reachable by the core DMA, and its size is a
+ * multiple of any bulk EP mpsize. Free blocks indexes are kept in a stack, so
+ * that allocation and release are O(1). The pool is not protected against
+ * concurrent accesses: it must always be used from the same context (e.g. the
+ * main thread).
+ */
+#if CONFIG_USR_DEV_USBOTGHS_DMA
+static uint32_t dma_pool[CONFIG_USR_DEV_USBOTGHS_DMA_POOL_BLOCKS][CONFIG_USR_DEV_USBOTGHS_DMA_POOL_BLOCK_SIZE / 4];
+static uint8_t  dma_pool_free[CONFIG_USR_DEV_USBOTGHS_DMA_POOL_BLOCKS];
+static bool     dma_pool_used[CONFIG_USR_DEV_USBOTGHS_DMA_POOL_BLOCKS];
+static uint8_t  dma_pool_free_cnt = 0;
+static bool     dma_pool_ready = false;
+#endif
+static usbotghs_dma_pool_stats_t dma_pool_stats = { 0 };
+
+#if CONFIG_USR_DEV_USBOTGHS_DMA
+/*@
+  @ assigns dma_pool_free[0 .. CONFIG_USR_DEV_USBOTGHS_DMA_POOL_BLOCKS - 1], dma_pool_free_cnt, dma_pool_ready, dma_pool_stats;
+  */
+static void usbotghs_dma_pool_init(void)
+{
+    /*@
+      @ loop invariant 0 <= i <= CONFIG_USR_DEV_USBOTGHS_DMA_POOL_BLOCKS;
+      @ loop assigns i, dma_pool_free[0 .. CONFIG_USR_DEV_USBOTGHS_DMA_POOL_BLOCKS - 1];
+      @ loop variant CONFIG_USR_DEV_USBOTGHS_DMA_POOL_BLOCKS - i;
+      */
+    for (uint8_t i = 0; i < CONFIG_USR_DEV_USBOTGHS_DMA_POOL_BLOCKS; ++i) {
+        /* lowest blocks popped first */
+        dma_pool_free[i] = CONFIG_USR_DEV_USBOTGHS_DMA_POOL_BLOCKS - 1 - i;
+    }
+    dma_pool_free_cnt = CONFIG_USR_DEV_USBOTGHS_DMA_POOL_BLOCKS;
+    dma_pool_stats.block_size = CONFIG_USR_DEV_USBOTGHS_DMA_POOL_BLOCK_SIZE;
+    dma_pool_stats.blocks = CONFIG_USR_DEV_USBOTGHS_DMA_POOL_BLOCKS;
+    dma_pool_ready = true;
+}
+#endif
+
+/*@
+  @ assigns \nothing;
+  */
+bool usbotghs_dma_buf_ok(const uint8_t *buf, uint32_t size)
+{
+    physaddr_t start = (physaddr_t)buf;
+    physaddr_t end = start + (size ? size - 1 : 0);
+
+    if ((start & 3) != 0) {
+        return false;
+    }
+    if (end < start || (start <= USBOTGHS_CCM_RAM_END && end >= USBOTGHS_CCM_RAM_BASE)) {
+        return false;
+    }
+    return true;
+}
+
+/*@
+  @ assigns dma_pool_stats.rejected_bufs, dma_pool_stats.rejected_sizes;
+  */
+void usbotghs_dma_count_reject(bool bad_buf)
+{
+    if (bad_buf) {
+        dma_pool_stats.rejected_bufs++;
+    } else {
+        dma_pool_stats.rejected_sizes++;
+    }
+}
+
+/*@
+  @ assigns *buf, *size, dma_pool_stats;
+  @ ensures (buf == NULL || size == NULL) ==> \result == MBED_ERROR_INVPARAM || \result == MBED_ERROR_UNSUPORTED_CMD;
+  */
+mbed_error_t usbotghs_dma_buf_alloc(uint8_t **buf, uint32_t *size)
+{
+    mbed_error_t errcode = MBED_ERROR_NONE;
+#if CONFIG_USR_DEV_USBOTGHS_DMA
+    uint8_t block;
+
+    if (buf == NULL || size == NULL) {
+        errcode = MBED_ERROR_INVPARAM;
+        goto err;
+    }
+    if (dma_pool_ready == false) {
+        usbotghs_dma_pool_init();
+    }
+    if (dma_pool_free_cnt == 0) {
+        log_printf("[USBOTG][HS] DMA pool exhausted\n");
+        dma_pool_stats.alloc_failures++;
+        errcode = MBED_ERROR_NOMEM;
+        goto err;
+    }
+    block = dma_pool_free[--dma_pool_free_cnt];
+    dma_pool_used[block] = true;
+    dma_pool_stats.in_use++;
+    if (dma_pool_stats.in_use > dma_pool_stats.high_water) {
+        dma_pool_stats.high_water = dma_pool_stats.in_use;
+    }
+    *buf = (uint8_t*)dma_pool[block];
+    *size = CONFIG_USR_DEV_USBOTGHS_DMA_POOL_BLOCK_SIZE;
+#else
+    /* no core DMA: any buffer can be used */
+    (void)buf;
+    (void)size;
+    errcode = MBED_ERROR_UNSUPORTED_CMD;
+    goto err;
+#endif
+err:
+    return errcode;
+}
+
+/*@
+  @ assigns dma_pool_stats;
+  @ ensures buf == NULL ==> \result == MBED_ERROR_INVPARAM || \result == MBED_ERROR_UNSUPORTED_CMD;
+  */
+mbed_error_t usbotghs_dma_buf_free(uint8_t *buf)
+{
+    mbed_error_t errcode = MBED_ERROR_NONE;
+#if CONFIG_USR_DEV_USBOTGHS_DMA
+    physaddr_t offset;
+    uint32_t block;
+
+    if (buf == NULL || dma_pool_ready == false ||
+        (physaddr_t)buf < (physaddr_t)dma_pool) {
+        errcode = MBED_ERROR_INVPARAM;
+        goto err;
+    }
+    offset = (physaddr_t)buf - (physaddr_t)dma_pool;
+    block = offset / CONFIG_USR_DEV_USBOTGHS_DMA_POOL_BLOCK_SIZE;
+    if ((offset % CONFIG_USR_DEV_USBOTGHS_DMA_POOL_BLOCK_SIZE) != 0 ||
+        block >= CONFIG_USR_DEV_USBOTGHS_DMA_POOL_BLOCKS ||
+        dma_pool_used[block] == false) {
+        /* not a pool block, or already released */
+        log_printf("[USBOTG][HS] invalid DMA pool buffer %p released\n", buf);
+        errcode = MBED_ERROR_INVPARAM;
+        goto err;
+    }
+    dma_pool_used[block] = false;
+    dma_pool_free[dma_pool_free_cnt++] = (uint8_t)block;
+    dma_pool_stats.in_use--;
+#else
+    (void)buf;
+    errcode = MBED_ERROR_UNSUPORTED_CMD;
+    goto err;
+#endif
+err:
+    return errcode;
+}
+
+/*@
+  @ assigns *stats;
+  @ ensures stats == NULL ==> \result == MBED_ERROR_INVPARAM;
+  */
+mbed_error_t usbotghs_get_dma_pool_stats(usbotghs_dma_pool_stats_t *stats)
+{
+    mbed_error_t errcode = MBED_ERROR_NONE;
+    if (stats == NULL) {
+        errcode = MBED_ERROR_INVPARAM;
+        goto err;
+    }
+#if CONFIG_USR_DEV_USBOTGHS_DMA
+    if (dma_pool_ready == false) {
+        usbotghs_dma_pool_init();
+    }
+#endif
+    *stats = dma_pool_stats;
+err:
+    return errcode;
+}
+
+/*@
+  @ assigns dma_pool_stats;
+  */
+void usbotghs_clear_dma_pool_stats(void)
+{
+    /* the high-water mark restarts from the blocks currently in use */
+    dma_pool_stats.high_water = dma_pool_stats.in_use;
+    dma_pool_stats.alloc_failures = 0;
+    dma_pool_stats.rejected_bufs = 0;
+    dma_pool_stats.rejected_sizes = 0;
+}
@@ -0,0 +1,50 @@
+/*
+ *
+ * Copyright 2019 The wookey project team <wookey@ssi.gouv.fr>
+ *   - Ryad     Benadjila
+ *   - Arnauld  Michelizza
+ *   - Mathieu  Renard
+ *   - Philippe Thierry
+ *   - Philippe Trebuchet
+ *
+ * This package is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * the Free Software Foundation; either version 3 of the License, or (at
+ * ur option) any later version.
+ *
+ * This package is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this package; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ */
+#ifndef USBOTGHS_POOL_H_
+# define USBOTGHS_POOL_H_
+
+#include "libc/types.h"
+
+#include "api/libusbotghs.h"
+
+/*
+ * STM32F4 Core Coupled Memory: only reachable by the CPU (D-bus), not by the
+ * USB OTG HS core DMA
+ */
+#define USBOTGHS_CCM_RAM_BASE   0x10000000UL
+#define USBOTGHS_CCM_RAM_END    0x1000FFFFUL
+
+/*
+ * Check that the size bytes long buffer can be accessed by the core DMA:
+ * word-aligned, out of the CCM RAM.
+ */
+bool usbotghs_dma_buf_ok(const uint8_t *buf, uint32_t size);
+
+/*
+ * Account a transfer refused in DMA mode (see usbotghs_get_dma_pool_stats()),
+ * because of its buffer (bad_buf) or of its size.
+ */
+void usbotghs_dma_count_reject(bool bad_buf);
+
+#endif/*!USBOTGHS_POOL_H_*/
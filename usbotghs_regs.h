@@ -633,6 +633,9 @@
                         : ((uint32_t)0x3 << USBOTG_HS_DIEPTSIZ_PKTCNT_Pos(EP)))
 # define USBOTG_HS_DIEPTSIZ_MCNT_Pos(EP)        29
 # define USBOTG_HS_DIEPTSIZ_MCNT_Msk(EP)        ((EP) > 0 ? ((uint32_t)0x3 << USBOTG_HS_DIEPTSIZ_MCNT_Pos(EP)) : 0)
+/* EP0 transfer limits (XFRSIZ is 7 bits, PKTCNT is 2 bits long for EP0) */
+# define USBOTG_HS_DIEPTSIZ0_XFRSIZ_MAX          0x7f
+# define USBOTG_HS_DIEPTSIZ0_PKTCNT_MAX          0x3
 
 /* Device EPx DMA address register */
 # define USBOTG_HS_DIEPDMA_DMAADDR_Pos        0
@@ -706,6 +709,8 @@
 # define USBOTG_HS_DOEPTSIZ_PKTCNT_Pos(EP)        19
 # define USBOTG_HS_DOEPTSIZ_PKTCNT_Msk(EP)        ((EP) > 0 ? ((uint32_t)0x3ff << USBOTG_HS_DOEPTSIZ_PKTCNT_Pos(EP)) \
                         : ((uint32_t)1 << USBOTG_HS_DOEPTSIZ_PKTCNT_Pos(EP)))
+# define USBOTG_HS_DOEPTSIZ_XFRSIZ_MAX         0x7ffff /* EP > 0 */
+# define USBOTG_HS_DOEPTSIZ_PKTCNT_MAX         0x3ff   /* EP > 0 */
 # define USBOTG_HS_DOEPTSIZ_STUPCNT_Pos        29 /* Applies to control OUT EP */
 # define USBOTG_HS_DOEPTSIZ_STUPCNT_Msk        ((uint32_t)3 << USBOTG_HS_DOEPTSIZ_STUPCNT_Pos)
 # define USBOTG_HS_DOEPTSIZ_RXDPID_Pos        29 /* Applies to isochronous OUT EP */